@@ -34,6 +34,10 @@
 #include <libintl.h>
 #include <vector>
 #include <cassert>
+#include <cstdlib>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 #include "libzwerg.h"
 
@@ -50,15 +54,100 @@ Searches for PATTERN in FILEs.\n\
 \n\
 -s, --no-messages	suppress error messages\n\
 -q, --quiet, --silent	suppress all normal output\n\
-    --verbose		show query parse in addition to normal output\n\
+    --verbose		show query parse and its optimization in addition\n\
+			to normal output\n\
 -H, --with-filename	print the filename for each match\n\
 -h, --no-filename	suppress printing filename on output\n\
 -c, --count		print only a count of query results\n\
+-j, --jobs=N		process up to N files in parallel, or with a single\n\
+			file, split its units among N threads\n\
+    --unordered		with -j and a single file, print results in the\n\
+			order in which they are found\n\
+    --index-cache=DIR	keep DIE indices of processed files in DIR, and\n\
+			reuse them on subsequent runs\n\
 \n\
     --help		this message\n\
 ";
 }
 
+namespace
+{
+  // Outcome of running a query on one file.  In parallel mode this
+  // is filled in by a worker thread, and then printed by the main
+  // thread, so that output of each file is kept together and files
+  // are reported in the order in which they were given.
+  struct file_result
+  {
+    // Produced stacks, in order.  Owned by this object until printed.
+    // With -c, stacks are only counted and not kept.
+    std::vector <zw_stack *> stacks;
+    uint64_t count = 0;
+
+    // When the query couldn't be started at all, the reason is stored
+    // here and OPEN_FAILED is set.  Otherwise ERROR, if non-empty,
+    // holds the error that stopped iteration over results.
+    std::string error;
+    bool open_failed = false;
+
+    bool done = false;
+  };
+
+  // Run QUERY on file FN and pass each produced stack to YIELD, which
+  // takes over ownership of the stack.  When YIELD returns false, no
+  // more results are requested.  With JOBS > 1, units of the file are
+  // split among that many threads.  Otherwise the query is evaluated
+  // with PLAN, which was compiled from QUERY.
+  template <class Yield>
+  void
+  run_query (zw_query const *query, zw_plan *plan, std::string const &fn,
+	     unsigned jobs, bool ordered, file_result &fr, Yield yield)
+  {
+    zw_error *err;
+    auto fail = [&] (bool open_failed)
+      {
+	fr.error = zw_error_message (err);
+	fr.open_failed = open_failed;
+	zw_error_destroy (err);
+      };
+
+    zw_stack *stack = zw_stack_init (&err);
+    if (stack == nullptr)
+      return fail (true);
+
+    if (fn != "")
+      {
+	zw_value *dwv = zw_value_init_dwarf (fn.c_str (), &err);
+	if (dwv == nullptr
+	    || ! zw_stack_push_take (stack, dwv, &err))
+	  {
+	    zw_stack_destroy (stack);
+	    return fail (true);
+	  }
+      }
+
+    zw_result *result = jobs > 1
+      ? zw_query_execute_parallel (query, stack, jobs, ordered, &err)
+      : zw_plan_execute (plan, stack, &err);
+    zw_stack_destroy (stack);
+    if (result == nullptr)
+      return fail (true);
+
+    while (true)
+      {
+	zw_stack *out;
+	if (! zw_result_next (result, &out, &err))
+	  {
+	    fail (false);
+	    break;
+	  }
+	if (out == nullptr || ! yield (out))
+	  break;
+      }
+
+    zw_result_destroy (result);
+  }
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -68,6 +157,8 @@ main(int argc, char *argv[])
   enum
   {
     verbose_flag = 257,
+    unordered_flag,
+    index_cache_flag,
     help_flag,
   };
 
@@ -81,16 +172,21 @@ main(int argc, char *argv[])
     {"with-filename", no_argument, nullptr, 'H'},
     {"no-filename", no_argument, nullptr, 'h'},
     {"file", required_argument, nullptr, 'f'},
+    {"jobs", required_argument, nullptr, 'j'},
+    {"unordered", no_argument, nullptr, unordered_flag},
+    {"index-cache", required_argument, nullptr, index_cache_flag},
     {"help", no_argument, nullptr, help_flag},
     {nullptr, no_argument, nullptr, 0},
   };
-  static char const *options = "ce:Hhqsf:O:";
+  static char const *options = "ce:Hhqsf:j:O:";
 
   int verbosity = 0;
   bool no_messages = false;
   bool show_count = false;
   bool with_filename = false;
   bool no_filename = false;
+  unsigned jobs = 1;
+  bool ordered = true;
 
   std::vector <std::string> to_process;
 
@@ -104,9 +200,18 @@ main(int argc, char *argv[])
   zw_vocabulary const *voc_dw = zw_vocabulary_dwarf (&err);
   assert (voc_dw != nullptr); // XXX
 
-  auto error_throw = [] (zw_error *err)
+  // Set while threads other than the main one may be evaluating
+  // queries.  Static destructors must not run under their hands then.
+  bool threaded = false;
+
+  auto error_throw = [&threaded] (zw_error *err)
     {
       std::cerr << "Error: " << zw_error_message (err) << std::endl;
+      if (threaded)
+	{
+	  std::cout.flush ();
+	  std::_Exit (1);
+	}
       std::exit (1);
     };
 
@@ -114,7 +219,10 @@ main(int argc, char *argv[])
       || ! zw_vocabulary_add (voc, voc_dw, &err))
     error_throw (err);
 
-  zw_query *query = nullptr;
+  // Queries are only parsed after all options are seen, so that
+  // --verbose applies regardless of where it is given.
+  std::string query_str;
+  bool have_query = false;
 
   while (true)
     {
@@ -125,8 +233,8 @@ main(int argc, char *argv[])
       switch (c)
 	{
 	case 'e':
-	  if ((query = zw_query_parse (voc, optarg, &err)) == nullptr)
-	    error_throw (err);
+	  query_str = optarg;
+	  have_query = true;
 	  break;
 
 	case 'c':
@@ -149,6 +257,15 @@ main(int argc, char *argv[])
 	  verbosity = 1;
 	  break;
 
+	case unordered_flag:
+	  ordered = false;
+	  break;
+
+	case index_cache_flag:
+	  if (! zw_set_index_cache_dir (optarg, &err))
+	    error_throw (err);
+	  break;
+
 	case help_flag:
 	  show_help ();
 	  return 0;
@@ -157,14 +274,25 @@ main(int argc, char *argv[])
 	  no_messages = true;
 	  break;
 
+	case 'j':
+	  {
+	    char *end;
+	    long n = std::strtol (optarg, &end, 10);
+	    if (*optarg == '\0' || *end != '\0' || n <= 0)
+	      {
+		std::cerr << "Invalid number of jobs: " << optarg << std::endl;
+		std::exit (2);
+	      }
+	    jobs = n;
+	    break;
+	  }
+
 	case 'f':
 	  {
 	    std::ifstream ifs {optarg};
-	    std::string str {std::istreambuf_iterator <char> {ifs},
-			     std::istreambuf_iterator <char> {}};
-	    if ((query = zw_query_parse_len
-		 (voc, str.c_str (), str.length (), &err)) == nullptr)
-	      error_throw (err);
+	    query_str.assign (std::istreambuf_iterator <char> {ifs},
+			      std::istreambuf_iterator <char> {});
+	    have_query = true;
 	    break;
 	  }
 
@@ -176,18 +304,35 @@ main(int argc, char *argv[])
   argc -= optind;
   argv += optind;
 
-  if (query == nullptr)
+  if (! have_query)
     {
       if (argc == 0)
 	{
 	  std::cerr << "No query specified.\n";
 	  return 2;
 	}
-      if ((query = zw_query_parse (voc, *argv++, &err)) == nullptr)
-	error_throw (err);
+      query_str = *argv++;
       argc--;
     }
 
+  if (verbosity > 0 && ! zw_set_optimizer_trace (true, &err))
+    error_throw (err);
+
+  zw_query *query = zw_query_parse_len (voc, query_str.c_str (),
+					query_str.length (), &err);
+  if (query == nullptr)
+    error_throw (err);
+
+  // The query is compiled once, and the plan then reused for all
+  // files.  Each worker thread needs a plan of its own.
+  auto compile = [&] ()
+    {
+      zw_plan *plan = zw_query_compile (query, &err);
+      if (plan == nullptr)
+	error_throw (err);
+      return plan;
+    };
+
   if (argc == 0)
     // No input files.
     to_process.push_back ("");
@@ -202,72 +347,168 @@ main(int argc, char *argv[])
 
   bool errors = false;
   bool match = false;
-  for (auto const &fn: to_process)
+  threaded = jobs > 1;
+
+  auto show_result = [&] (std::string const &fn, zw_stack *out,
+			  uint64_t &count)
+    {
+      match = true;
+      if (! show_count)
+	{
+	  if (with_filename)
+	    std::cout << fn << ":\n";
+	  if (zw_stack_depth (out) > 1)
+	    std::cout << "---\n";
+	  if (! zw_stack_dump_xxx (out, &err))
+	    error_throw (err);
+	}
+      else
+	++count;
+      zw_stack_destroy (out);
+    };
+
+  auto show_summary = [&] (std::string const &fn, file_result const &fr,
+			   uint64_t count)
     {
-      zw_stack *stack = zw_stack_init (&err);
-      if (stack == nullptr)
+      if (fr.open_failed)
 	{
-	fail:
 	  if (! no_messages)
-	    std::cout << "dwgrep: " << fn << ": "
-		      << zw_error_message (err) << std::endl;
-	  zw_error_destroy (err);
+	    std::cout << "dwgrep: " << fn << ": " << fr.error << std::endl;
 	  if (verbosity >= 0)
 	    errors = true;
-	  continue;
+	  return;
 	}
 
-      if (fn != "")
+      if (fr.error != "" && ! no_messages)
+	std::cerr << "dwgrep: " << fn << ": " << fr.error << std::endl;
+
+      if (show_count)
 	{
-	  zw_value *dwv = zw_value_init_dwarf (fn.c_str (), &err);
-	  if (dwv == nullptr
-	      || ! zw_stack_push_take (stack, dwv, &err))
-	    goto fail;
+	  if (with_filename)
+	    std::cout << fn << ":";
+	  std::cout << std::dec << count << std::endl;
 	}
+    };
 
-      zw_result *result = zw_query_execute (query, stack, &err);
-      if (result == nullptr)
-	goto fail;
-
-      uint64_t count = 0;
-      while (true)
+  if (jobs <= 1 || to_process.size () <= 1)
+    {
+      zw_plan *plan = compile ();
+      for (auto const &fn: to_process)
 	{
-	  zw_stack *out;
-	  if (! zw_result_next (result, &out, &err))
+	  file_result fr;
+	  uint64_t count = 0;
+	  run_query (query, plan, fn, jobs, ordered, fr, [&] (zw_stack *out)
 	    {
-	      if (! no_messages)
-		std::cerr << "dwgrep: " << fn << ": "
-			  << zw_error_message (err) << std::endl;
-	      zw_error_destroy (err);
-	      break;
+	      // grep: Exit immediately with zero status if any match
+	      // is found, even if an error was detected.  With -j,
+	      // workers of the parallel evaluation may still be busy,
+	      // so don't run static destructors under their hands.
+	      if (verbosity < 0)
+		{
+		  std::cout.flush ();
+		  std::_Exit (0);
+		}
+
+	      show_result (fn, out, count);
+	      return true;
+	    });
+	  show_summary (fn, fr, count);
+	}
+      zw_plan_destroy (plan);
+    }
+  else
+    {
+      // Files are handed out to workers in order.  Workers only run
+      // ahead of the printing thread by a bounded number of files, so
+      // that results of a slow file don't pile up an unbounded amount
+      // of finished, but not yet printed, files.
+      std::vector <file_result> results (to_process.size ());
+      std::mutex mut;
+      std::condition_variable cv;
+      size_t next_file = 0;
+      size_t printed = 0;
+      size_t window = 2 * jobs;
+
+      auto worker = [&] (zw_plan *plan)
+	{
+	  while (true)
+	    {
+	      size_t i;
+	      {
+		std::unique_lock <std::mutex> lock {mut};
+		cv.wait (lock, [&] () {
+		    return next_file >= results.size ()
+		      || next_file < printed + window;
+		  });
+		if (next_file >= results.size ())
+		  return;
+		i = next_file++;
+	      }
+
+	      file_result &fr = results[i];
+	      run_query (query, plan, to_process[i], 1, true, fr,
+			 [&] (zw_stack *out)
+			 {
+			   ++fr.count;
+			   if (show_count)
+			     zw_stack_destroy (out);
+			   else
+			     fr.stacks.push_back (out);
+			   // With -q, one result is all we need to know.
+			   return verbosity >= 0;
+			 });
+
+	      {
+		std::lock_guard <std::mutex> lock {mut};
+		fr.done = true;
+	      }
+	      cv.notify_all ();
 	    }
-	  if (out == nullptr)
-	    break;
+	};
 
-	  // grep: Exit immediately with zero status if any match
-	  // is found, even if an error was detected.
-	  if (verbosity < 0)
-	    std::exit (0);
+      std::vector <zw_plan *> plans;
+      std::vector <std::thread> workers;
+      for (unsigned j = 0; j < jobs && j < to_process.size (); ++j)
+	{
+	  plans.push_back (compile ());
+	  workers.emplace_back (worker, plans.back ());
+	}
+
+      for (size_t i = 0; i < results.size (); ++i)
+	{
+	  file_result &fr = results[i];
+	  {
+	    std::unique_lock <std::mutex> lock {mut};
+	    cv.wait (lock, [&] () { return fr.done; });
+	  }
 
-	  match = true;
-	  if (! show_count)
+	  if (verbosity < 0 && fr.count > 0)
 	    {
-	      if (with_filename)
-		std::cout << fn << ":\n";
-	      if (zw_stack_depth (out) > 1)
-		std::cout << "---\n";
-	      if (! zw_stack_dump_xxx (out, &err))
-		error_throw (err);
+	      // Other workers may still be busy, so don't wait for them
+	      // and don't run static destructors under their hands.
+	      std::cout.flush ();
+	      std::_Exit (0);
 	    }
-	  else
-	    ++count;
+
+	  if (fr.count > 0)
+	    match = true;
+	  uint64_t count = 0;
+	  for (zw_stack *out: fr.stacks)
+	    show_result (to_process[i], out, count);
+	  fr.stacks.clear ();
+	  show_summary (to_process[i], fr, fr.count);
+
+	  {
+	    std::lock_guard <std::mutex> lock {mut};
+	    printed = i + 1;
+	  }
+	  cv.notify_all ();
 	}
 
-      if (show_count)
+      for (size_t j = 0; j < workers.size (); ++j)
 	{
-	  if (with_filename)
-	    std::cout << fn << ":";
-	  std::cout << std::dec << count << std::endl;
+	  workers[j].join ();
+	  zw_plan_destroy (plans[j]);
 	}
     }
 
@@ -75,44 +75,41 @@ namespace
     return std::make_unique <single_value> (std::move (value));
   }
 
-  std::unique_ptr <value_producer <value>>
-  pass_block (Dwarf_Block const &block)
+  std::unique_ptr <value>
+  block_value (Dwarf_Block const &block)
   {
     value_seq::seq_t vv;
     for (Dwarf_Word i = 0; i < block.length; ++i)
       vv.push_back (std::make_unique <value_cst>
 		    (constant { block.data[i], &hex_constant_dom }, 0));
-    return pass_single_value
-      (std::make_unique <value_seq> (std::move (vv), 0));
+    return std::make_unique <value_seq> (std::move (vv), 0);
   }
 
-  std::unique_ptr <value_producer <value>>
+  std::unique_ptr <value>
   atval_unsigned_with_domain (Dwarf_Attribute attr, constant_dom const &dom)
   {
     Dwarf_Word uval;
     if (dwarf_formudata (&attr, &uval) != 0)
       throw_libdw ();
-    return pass_single_value
-      (std::make_unique <value_cst> (constant {uval, &dom}, 0));
+    return std::make_unique <value_cst> (constant {uval, &dom}, 0);
   }
 
-  std::unique_ptr <value_producer <value>>
+  std::unique_ptr <value>
   atval_unsigned (Dwarf_Attribute attr)
   {
     return atval_unsigned_with_domain (attr, dec_constant_dom);
   }
 
-  std::unique_ptr <value_producer <value>>
+  std::unique_ptr <value>
   atval_signed (Dwarf_Attribute attr)
   {
     Dwarf_Sword sval;
     if (dwarf_formsdata (&attr, &sval) != 0)
       throw_libdw ();
-    return pass_single_value
-      (std::make_unique <value_cst> (constant {sval, &dec_constant_dom}, 0));
+    return std::make_unique <value_cst> (constant {sval, &dec_constant_dom}, 0);
   }
 
-  std::unique_ptr <value_producer <value>>
+  std::unique_ptr <value>
   atval_addr (Dwarf_Attribute attr)
   {
     // XXX Eventually we might want to have a dedicated type that
@@ -121,20 +118,20 @@ namespace
     Dwarf_Addr addr;
     if (dwarf_formaddr (&attr, &addr) != 0)
       throw_libdw ();
-    return pass_single_value
-      (std::make_unique <value_cst> (constant {addr, &dw_address_dom ()}, 0));
+    return std::make_unique <value_cst>
+      (constant {addr, &dw_address_dom ()}, 0);
   }
 
   struct locexpr_producer
     : public value_producer <value>
   {
-    std::shared_ptr <dwfl_context> m_dwctx;
+    dwctx_handle m_dwctx;
     Dwarf_Attribute m_attr;
     Dwarf_Addr m_base;
     ptrdiff_t m_offset;
     size_t m_i;
 
-    locexpr_producer (std::shared_ptr <dwfl_context> dwctx,
+    locexpr_producer (dwctx_handle dwctx,
 		      Dwarf_Attribute attr)
       : m_dwctx {dwctx}
       , m_attr (attr)
@@ -169,13 +166,13 @@ namespace
   struct macinfo_producer
     : public value_producer <value>
   {
-    std::shared_ptr <dwfl_context> m_dwctx;
+    dwctx_handle m_dwctx;
     Dwarf_Die m_cudie;
     Dwarf_Addr m_base;
     ptrdiff_t m_offset;
     size_t m_i;
 
-    macinfo_producer (std::shared_ptr <dwfl_context> dwctx,
+    macinfo_producer (dwctx_handle dwctx,
 		      Dwarf_Die cudie)
       : m_dwctx {dwctx}
       , m_cudie (cudie)
@@ -299,9 +296,11 @@ die_ranges (Dwarf_Die die)
 
 namespace
 {
-  std::unique_ptr <value_producer <value>>
-  handle_at_dependent_value (Dwarf_Attribute attr, Dwarf_Die die,
-			     std::shared_ptr <dwfl_context> dwctx)
+  // Values of constant and block forms whose meaning depends on
+  // the attribute.  Returns nullptr for attributes that can have
+  // several values, at_value produces those.
+  std::unique_ptr <value>
+  at_dependent_single_value (Dwarf_Attribute attr, Dwarf_Die die)
   {
     switch (dwarf_whatattr (&attr))
       {
@@ -369,7 +368,7 @@ namespace
 	  if (fn == nullptr)
 	    throw_libdw ();
 
-	  return pass_single_value (std::make_unique <value_str> (fn, 0));
+	  return std::make_unique <value_str> (fn, 0);
 	}
 
       case DW_AT_const_value:
@@ -555,18 +554,11 @@ namespace
       case DW_AT_static_link:
       case DW_AT_use_location:
       case DW_AT_vtable_elem_location:
-	return std::make_unique <locexpr_producer> (dwctx, attr);
+      case DW_AT_macro_info:
+	return nullptr;
 
       case DW_AT_ranges:
-	return pass_single_value (die_ranges (die));
-
-      case DW_AT_macro_info:
-	{
-	  Dwarf_Die cudie;
-	  if (dwarf_diecu (&die, &cudie, nullptr, nullptr) == nullptr)
-	    throw_libdw ();
-	  return std::make_unique <macinfo_producer> (dwctx, cudie);
-	}
+	return die_ranges (die);
 
       case DW_AT_GNU_macros:
 	std::cerr << "DW_AT_GNU_macros NIY\n";
@@ -593,7 +585,7 @@ namespace
 	if (dwarf_formblock (&attr, &block) != 0)
 	  throw_libdw ();
 
-	return pass_block (block);
+	return block_value (block);
       }
 
     std::cerr << dwarf_whatattr (&attr) << std::endl << std::flush;
@@ -602,9 +594,9 @@ namespace
   }
 }
 
-std::unique_ptr <value_producer <value>>
-at_value (std::shared_ptr <dwfl_context> dwctx,
-	  Dwarf_Die die, Dwarf_Attribute attr)
+std::unique_ptr <value>
+at_single_value (dwctx_handle dwctx,
+		 Dwarf_Die die, Dwarf_Attribute attr)
 {
   switch (dwarf_whatform (&attr))
     {
@@ -615,7 +607,7 @@ at_value (std::shared_ptr <dwfl_context> dwctx,
 	const char *str = dwarf_formstring (&attr);
 	if (str == nullptr)
 	  throw_libdw ();
-	return pass_single_value (std::make_unique <value_str> (str, 0));
+	return std::make_unique <value_str> (*dwctx, str, 0);
       }
 
     case DW_FORM_ref_addr:
@@ -629,8 +621,7 @@ at_value (std::shared_ptr <dwfl_context> dwctx,
 	Dwarf_Die die;
 	if (dwarf_formref_die (&attr, &die) == nullptr)
 	  throw_libdw ();
-	return pass_single_value
-	  (std::make_unique <value_die> (dwctx, die, 0, doneness::cooked));
+	return std::make_unique <value_die> (dwctx, die, 0, doneness::cooked);
       }
 
     case DW_FORM_sdata:
@@ -648,9 +639,8 @@ at_value (std::shared_ptr <dwfl_context> dwctx,
 	bool flag;
 	if (dwarf_formflag (&attr, &flag) != 0)
 	  throw_libdw ();
-	return pass_single_value
-	  (std::make_unique <value_cst>
-	   (constant {static_cast <unsigned> (flag), &bool_constant_dom}, 0));
+	return std::make_unique <value_cst>
+	  (constant {static_cast <unsigned> (flag), &bool_constant_dom}, 0);
       }
 
     case DW_FORM_data1:
@@ -662,17 +652,62 @@ at_value (std::shared_ptr <dwfl_context> dwctx,
     case DW_FORM_block2:
     case DW_FORM_block4:
     case DW_FORM_block:
-      return handle_at_dependent_value (attr, die, dwctx);
-
-    case DW_FORM_exprloc:
-      return std::make_unique <locexpr_producer> (dwctx, attr);
+      return at_dependent_single_value (attr, die);
 
     case DW_FORM_ref_sig8:
       std::cerr << "Form unhandled: "
 		<< constant (dwarf_whatform (&attr), &dw_form_dom ())
 		<< std::endl;
-      return pass_single_value
-	(std::make_unique <value_str> ("(form unhandled)", 0));
+      return std::make_unique <value_str> ("(form unhandled)", 0);
+    }
+
+  return nullptr;
+}
+
+std::unique_ptr <value_producer <value>>
+at_value (dwctx_handle dwctx,
+	  Dwarf_Die die, Dwarf_Attribute attr)
+{
+  if (auto v = at_single_value (dwctx, die, attr))
+    return pass_single_value (std::move (v));
+
+  switch (dwarf_whatform (&attr))
+    {
+    case DW_FORM_data1:
+    case DW_FORM_data2:
+    case DW_FORM_data4:
+    case DW_FORM_data8:
+    case DW_FORM_sec_offset:
+    case DW_FORM_block1:
+    case DW_FORM_block2:
+    case DW_FORM_block4:
+    case DW_FORM_block:
+      // Location lists and macro information.
+      switch (dwarf_whatattr (&attr))
+	{
+	case DW_AT_macro_info:
+	  {
+	    Dwarf_Die cudie;
+	    if (dwarf_diecu (&die, &cudie, nullptr, nullptr) == nullptr)
+	      throw_libdw ();
+	    return std::make_unique <macinfo_producer> (dwctx, cudie);
+	  }
+
+	case DW_AT_data_member_location:
+	case DW_AT_data_location:
+	case DW_AT_frame_base:
+	case DW_AT_location:
+	case DW_AT_return_addr:
+	case DW_AT_segment:
+	case DW_AT_static_link:
+	case DW_AT_use_location:
+	case DW_AT_vtable_elem_location:
+	  return std::make_unique <locexpr_producer> (dwctx, attr);
+	}
+      break;
+
+    case DW_FORM_exprloc:
+      return std::make_unique <locexpr_producer> (dwctx, attr);
 
     case DW_FORM_indirect:
       assert (! "Unexpected DW_FORM_indirect");
@@ -712,7 +747,7 @@ namespace
   // represents unary, both non-default represent binary op.
   template <unsigned N>
   std::unique_ptr <value_producer <value>>
-  locexpr_op_values (std::shared_ptr <dwfl_context> dwctx,
+  locexpr_op_values (dwctx_handle dwctx,
 		     Dwarf_Attribute const &at, Dwarf_Op const *op)
   {
     auto signed_cst = [] (Dwarf_Word w, constant_dom const *dom)
@@ -806,7 +841,7 @@ namespace
 	      (const_cast <Dwarf_Attribute *> (&at), op, &block) != 0)
 	    throw_libdw ();
 
-	  return select <N> (pass_block (block),
+	  return select <N> (pass_single_value (block_value (block)),
 			     std::make_unique <null_producer> ());
 	}
 
@@ -840,21 +875,21 @@ namespace
 	    (pass_single_value
 		(std::make_unique <value_die> (dwctx, die, 0,
 					       doneness::cooked)),
-	     pass_block (block));
+	     pass_single_value (block_value (block)));
 	}
       }
   }
 }
 
 std::unique_ptr <value_producer <value>>
-dwop_number (std::shared_ptr <dwfl_context> dwctx,
+dwop_number (dwctx_handle dwctx,
 	     Dwarf_Attribute const &attr, Dwarf_Op const *op)
 {
   return locexpr_op_values <0> (dwctx, attr, op);
 }
 
 std::unique_ptr <value_producer <value>>
-dwop_number2 (std::shared_ptr <dwfl_context> dwctx,
+dwop_number2 (dwctx_handle dwctx,
 	     Dwarf_Attribute const &attr, Dwarf_Op const *op)
 {
   return locexpr_op_values <1> (dwctx, attr, op);
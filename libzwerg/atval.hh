@@ -37,18 +37,26 @@ class value_aset;
 
 // Obtain a value of ATTR at DIE.
 std::unique_ptr <value_producer <value>>
-at_value (std::shared_ptr <dwfl_context> dwctx,
+at_value (dwctx_handle dwctx,
 	  Dwarf_Die die, Dwarf_Attribute attr);
 
+// Obtain the value of ATTR at DIE directly, if it has exactly one.
+// This is the case for most attributes, and avoids allocating a
+// producer.  Returns nullptr for attributes that at_value needs to
+// produce, such as location expressions.
+std::unique_ptr <value>
+at_single_value (dwctx_handle dwctx,
+		 Dwarf_Die die, Dwarf_Attribute attr);
+
 // Obtain DIE's ranges.
 std::unique_ptr <value_aset> die_ranges (Dwarf_Die die);
 
 std::unique_ptr <value_producer <value>>
-dwop_number (std::shared_ptr <dwfl_context> dwctx,
+dwop_number (dwctx_handle dwctx,
 	     Dwarf_Attribute const &attr, Dwarf_Op const *op);
 
 std::unique_ptr <value_producer <value>>
-dwop_number2 (std::shared_ptr <dwfl_context> dwctx,
+dwop_number2 (dwctx_handle dwctx,
 	      Dwarf_Attribute const &attr, Dwarf_Op const *op);
 
 #endif /* _ATVAL_H_ */
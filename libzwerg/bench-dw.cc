@@ -0,0 +1,502 @@
+/*
+   Copyright (C) 2014 Red Hat, Inc.
+   This file is part of dwgrep.
+
+   This file is free software; you can redistribute it and/or modify
+   it under the terms of either
+
+     * the GNU Lesser General Public License as published by the Free
+       Software Foundation; either version 3 of the License, or (at
+       your option) any later version
+
+   or
+
+     * the GNU General Public License as published by the Free
+       Software Foundation; either version 2 of the License, or (at
+       your option) any later version
+
+   or both in parallel, as here.
+
+   dwgrep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received copies of the GNU General Public License and
+   the GNU Lesser General Public License along with this program.  If
+   not, see <http://www.gnu.org/licenses/>.  */
+
+// Micro-benchmarks for libzwerg.  Usage:
+//
+//   bench-dw FILE [BENCHMARK...]
+//
+// Runs the named benchmarks (or all of them) against FILE, which is
+// best a binary with a large amount of debuginfo.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "atval.hh"
+#include "builtin-dw.hh"
+#include "builtin.hh"
+#include "dwfl_context.hh"
+#include "dwit.hh"
+#include "init.hh"
+#include "libzwergP.hh"
+#include "op.hh"
+#include "overload.hh"
+#include "parser.hh"
+#include "value-cst.hh"
+#include "value-dw.hh"
+
+// Count calls to the global allocator, for the "alloc" benchmark.
+static std::atomic <size_t> heap_allocs {0};
+
+void *
+operator new (size_t size)
+{
+  ++heap_allocs;
+  if (void *ret = std::malloc (size != 0 ? size : 1))
+    return ret;
+  throw std::bad_alloc ();
+}
+
+void
+operator delete (void *ptr) noexcept
+{
+  std::free (ptr);
+}
+
+void
+operator delete (void *ptr, size_t) noexcept
+{
+  std::free (ptr);
+}
+
+namespace
+{
+  using clock = std::chrono::steady_clock;
+
+  double
+  seconds_since (clock::time_point start)
+  {
+    return std::chrono::duration <double> (clock::now () - start).count ();
+  }
+
+  void
+  report (std::string const &what, size_t n, double secs)
+  {
+    std::cout << what << ": " << n << " in " << secs << "s ("
+	      << (secs > 0 ? n / secs : 0) << "/s)" << std::endl;
+  }
+
+  struct bench_context
+  {
+    std::string fn;
+    std::unique_ptr <vocabulary> voc;
+
+    // Keeps alive contexts of Dwarf values that benchmarks make.
+    dwctx_registry dwctxs;
+
+    std::unique_ptr <value_dwarf>
+    dwarf ()
+    {
+      auto ret = std::make_unique <value_dwarf> (fn, 0, doneness::cooked);
+      dwctxs.add (ret->get_dwctx ());
+      return ret;
+    }
+  };
+
+  // Run query Q on a freshly opened FN, and report how long it takes
+  // to pull all results.
+  size_t
+  time_query (bench_context &ctx, std::string const &q)
+  {
+    auto stk = std::make_unique <stack> ();
+    stk->push (ctx.dwarf ());
+
+    tree t = parse_query (*ctx.voc, q);
+    t.simplify ();
+
+    auto start = clock::now ();
+    auto op = t.build_exec (std::make_shared <op_origin> (std::move (stk)));
+    size_t n = 0;
+    while (op->next () != nullptr)
+      ++n;
+    report ("`" + q + "'", n, seconds_since (start));
+    return n;
+  }
+
+  std::vector <Dwarf_Die>
+  all_dies (dwfl_context &dwctx)
+  {
+    std::vector <Dwarf_Die> ret;
+    for (Dwarf *dw: all_dwarfs (dwctx))
+      for (all_dies_iterator it {dw}; it != all_dies_iterator::end (); ++it)
+	ret.push_back (**it);
+    return ret;
+  }
+
+  void
+  bench_parent (bench_context &ctx)
+  {
+    dwfl_context dwctx {open_dwfl (ctx.fn)};
+    auto dies = all_dies (dwctx);
+
+    // The first round includes building the parent index.
+    for (int round = 0; round < 3; ++round)
+      {
+	auto start = clock::now ();
+	for (auto &die: dies)
+	  dwctx.find_parent (die);
+	report (round == 0 ? "find_parent (cold)" : "find_parent",
+		dies.size (), seconds_since (start));
+      }
+
+    time_query (ctx, "entry parent");
+    time_query (ctx, "entry ?TAG_member parent parent");
+  }
+
+  // Report how many heap allocations running query Q makes per DIE
+  // of the file, and per result.  The query is pulled twice, the
+  // first time to warm up caches and indices, which would otherwise
+  // dominate the count.
+  void
+  count_allocs (bench_context &ctx, std::string const &q, size_t ndies)
+  {
+    tree t = parse_query (*ctx.voc, q);
+    t.simplify ();
+
+    auto stk = std::make_unique <stack> ();
+    stk->push (ctx.dwarf ());
+    auto origin = std::make_shared <op_origin> (nullptr);
+    auto op = t.build_exec (origin);
+
+    size_t n = 0;
+    for (int round = 0; round < 2; ++round)
+      {
+	op->reset ();
+	origin->set_next (std::make_unique <stack> (*stk));
+
+	size_t before = heap_allocs;
+	n = 0;
+	while (op->next () != nullptr)
+	  ++n;
+	size_t allocs = heap_allocs - before;
+
+	if (round == 1)
+	  std::cout << "`" << q << "': " << allocs << " allocations, "
+		    << (double) allocs / ndies << "/DIE, "
+		    << (n > 0 ? (double) allocs / n : 0) << "/result"
+		    << std::endl;
+      }
+  }
+
+  void
+  bench_alloc (bench_context &ctx)
+  {
+    size_t ndies;
+    {
+      dwfl_context dwctx {open_dwfl (ctx.fn)};
+      ndies = all_dies (dwctx).size ();
+    }
+
+    count_allocs (ctx, "entry", ndies);
+    count_allocs (ctx, "entry ?TAG_subprogram name", ndies);
+    count_allocs (ctx, "entry ?AT_name name", ndies);
+    count_allocs (ctx, "entry child", ndies);
+  }
+
+  // Transitive closures keep track of stacks that they've already
+  // seen.  Best run on a C++ binary with deep class hierarchies.
+  void
+  bench_closure (bench_context &ctx)
+  {
+    time_query (ctx, "entry parent*");
+    time_query (ctx, "entry ?TAG_member (@AT_type)*");
+    time_query (ctx, "entry ?TAG_class_type "
+		"(child ?TAG_inheritance @AT_type)*");
+    time_query (ctx, "entry ?TAG_structure_type child*");
+  }
+
+  // Measure how long it takes overloaded word NAME to pick the
+  // overload for stack STK.
+  void
+  time_dispatch (bench_context &ctx, std::string const &name, stack &stk)
+  {
+    auto bi = std::dynamic_pointer_cast <overloaded_builtin const>
+      (ctx.voc->find (name));
+    assert (bi != nullptr);
+    auto inst = bi->get_overload_tab ()->instantiate ();
+
+    size_t const n = 10000000;
+    size_t found = 0;
+    auto start = clock::now ();
+    for (size_t i = 0; i < n; ++i)
+      if (inst.find_exec (stk).second != nullptr)
+	++found;
+    double secs = seconds_since (start);
+
+    report ("dispatch `" + name + "'", found, secs);
+    std::cout << "  " << secs / n * 1e9 << "ns/call" << std::endl;
+  }
+
+  void
+  bench_dispatch (bench_context &ctx)
+  {
+    auto dwctx = std::make_shared <dwfl_context> (open_dwfl (ctx.fn));
+    Dwarf_Die die = all_dies (*dwctx).back ();
+
+    {
+      stack stk;
+      stk.push (std::make_unique <value_die> (dwctx, die, 0,
+					      doneness::cooked));
+      time_dispatch (ctx, "name", stk);
+      time_dispatch (ctx, "offset", stk);
+    }
+
+    {
+      stack stk;
+      stk.push (std::make_unique <value_cst>
+		(constant {1, &dec_constant_dom}, 0));
+      stk.push (std::make_unique <value_cst>
+		(constant {2, &dec_constant_dom}, 0));
+      time_dispatch (ctx, "add", stk);
+    }
+  }
+
+  // Regular expression matching, with a needle that's a literal in
+  // the query, and with one that changes with each DIE.
+  void
+  bench_match (bench_context &ctx)
+  {
+    time_query (ctx, "entry ?AT_name ?(name =~ \"^_ZN.*Foo.*\")");
+    time_query (ctx, "entry ?AT_name ?(name =~ \".*(main|init).*\")");
+    time_query (ctx, "entry ?AT_name ?(name =~ name)");
+  }
+
+  // Compare the cost of decoding attribute values through a value
+  // producer, and directly for attributes that have a single value.
+  void
+  bench_atval (bench_context &ctx)
+  {
+    auto dwctx = std::make_shared <dwfl_context> (open_dwfl (ctx.fn));
+
+    std::vector <std::pair <Dwarf_Die, Dwarf_Attribute>> attrs;
+    for (auto &die: all_dies (*dwctx))
+      for (attr_iterator it {&die}; it != attr_iterator::end (); ++it)
+	attrs.push_back (std::make_pair (die, **it));
+
+    auto run = [&] (std::string const &what, bool single)
+      {
+	size_t n = 0;
+	size_t before = heap_allocs;
+	auto start = clock::now ();
+	for (auto const &a: attrs)
+	  if (auto v = single
+	      ? at_single_value (dwctx, a.first, a.second) : nullptr)
+	    ++n;
+	  else
+	    {
+	      auto vpr = at_value (dwctx, a.first, a.second);
+	      while (vpr->next () != nullptr)
+		++n;
+	    }
+	report (what, attrs.size (), seconds_since (start));
+	std::cout << "  " << n << " values, "
+		  << (double) (heap_allocs - before) / attrs.size ()
+		  << " allocations/attribute" << std::endl;
+      };
+
+    run ("at_value", false);
+    run ("at_single_value", true);
+
+    time_query (ctx, "entry @AT_name");
+    time_query (ctx, "entry @AT_decl_line");
+  }
+
+  // Copy a stack of DIE's over and over, as ops do all the time, from
+  // one thread and from several threads at once.  All the DIE's refer
+  // to the same context.
+  void
+  bench_clone (bench_context &ctx)
+  {
+    auto dwarf = ctx.dwarf ();
+    auto dies = all_dies (*dwarf->get_dwctx ());
+
+    stack stk;
+    for (size_t i = 0; i < 4 && i < dies.size (); ++i)
+      stk.push (std::make_unique <value_die> (dwarf->get_dwctx (), dies[i],
+					      0, doneness::cooked));
+
+    size_t const n = 1000000;
+    for (unsigned nthreads: {1, 4})
+      {
+	auto start = clock::now ();
+	std::vector <std::thread> threads;
+	for (unsigned t = 0; t < nthreads; ++t)
+	  threads.emplace_back ([&] ()
+	    {
+	      for (size_t i = 0; i < n; ++i)
+		stack copy {stk};
+	    });
+	for (auto &thr: threads)
+	  thr.join ();
+	report ("stack copies, " + std::to_string (nthreads) + " threads",
+		n * nthreads, seconds_since (start));
+      }
+
+    time_query (ctx, "entry ?(child) ?(parent)");
+  }
+
+  // Capture all DIE's in a sequence, which keeps a value per DIE
+  // around at once, and then visit them again.
+  void
+  bench_capture (bench_context &ctx)
+  {
+    std::cout << "sizeof (value_die): " << sizeof (value_die) << std::endl;
+    time_query (ctx, "[entry] length");
+    time_query (ctx, "[entry] elem parent");
+  }
+
+  // Measure how long it takes to parse and build a large query, such
+  // as one that's loaded with -f.  It's made of many alternatives
+  // that each use words with lots of overloads.
+  void
+  bench_build (bench_context &ctx)
+  {
+    std::string q = "entry (";
+    for (int i = 0; i < 500; ++i)
+      q += std::string (i > 0 ? ", " : "")
+	+ "?(name == \"f" + std::to_string (i) + "\") "
+	+ "[attribute (value, label, form)] length";
+    q += ")";
+
+    auto start = clock::now ();
+    tree t = parse_query (*ctx.voc, q);
+    t.simplify ();
+    report ("parse", 1, seconds_since (start));
+
+    size_t const n = 100;
+    size_t before = heap_allocs;
+    start = clock::now ();
+    for (size_t i = 0; i < n; ++i)
+      t.build_exec (std::make_shared <op_origin> (nullptr));
+    double secs = seconds_since (start);
+    report ("build", n, secs);
+    std::cout << "  " << (heap_allocs - before) / n
+	      << " allocations/build" << std::endl;
+  }
+
+  // Compare the ways of pulling results through the C API: owned
+  // stacks, borrowed batches, and a callback.
+  void
+  bench_result (bench_context &ctx)
+  {
+    zw_error *err = nullptr;
+    zw_vocabulary const *voc = zw_vocabulary_dwarf (&err);
+    zw_query *query = zw_query_parse (voc, "entry (name, offset)", &err);
+    zw_stack *input = zw_stack_init (&err);
+    zw_stack_push_take (input, zw_value_init_dwarf (ctx.fn.c_str (), &err),
+			&err);
+
+    auto time_api = [&] (std::string const &what,
+			 std::function <size_t (zw_result *)> pull)
+      {
+	zw_result *result = zw_query_execute (query, input, &err);
+	size_t before = heap_allocs;
+	auto start = clock::now ();
+	size_t n = pull (result);
+	double secs = seconds_since (start);
+	size_t allocs = heap_allocs - before;
+	zw_result_destroy (result);
+
+	report (what, n, secs);
+	std::cout << "  " << (n > 0 ? (double) allocs / n : 0)
+		  << " allocations/result" << std::endl;
+      };
+
+    time_api ("zw_result_next", [&] (zw_result *result)
+      {
+	size_t n = 0;
+	zw_stack *out;
+	while (zw_result_next (result, &out, &err) && out != nullptr)
+	  {
+	    zw_stack_destroy (out);
+	    ++n;
+	  }
+	return n;
+      });
+
+    time_api ("zw_result_next_n", [&] (zw_result *result)
+      {
+	size_t n = 0, count;
+	zw_stack const *outs[64];
+	while (zw_result_next_n (result, outs, 64, &count, &err) && count > 0)
+	  n += count;
+	return n;
+      });
+
+    size_t n = 0;
+    auto start = clock::now ();
+    zw_query_execute_foreach (query, input,
+			      [] (zw_stack const *stk, void *data)
+			      {
+				++*static_cast <size_t *> (data);
+				return true;
+			      }, &n, &err);
+    report ("zw_query_execute_foreach", n, seconds_since (start));
+
+    zw_stack_destroy (input);
+    zw_query_destroy (query);
+  }
+
+  std::vector <std::pair <std::string,
+			  std::function <void (bench_context &)>>> benchmarks
+    = {
+    {"parent", bench_parent},
+    {"alloc", bench_alloc},
+    {"closure", bench_closure},
+    {"dispatch", bench_dispatch},
+    {"build", bench_build},
+    {"match", bench_match},
+    {"atval", bench_atval},
+    {"clone", bench_clone},
+    {"capture", bench_capture},
+    {"result", bench_result},
+  };
+}
+
+int
+main (int argc, char *argv[])
+{
+  if (argc < 2)
+    {
+      std::cerr << "Usage: " << argv[0] << " FILE [BENCHMARK...]\n";
+      return 2;
+    }
+
+  bench_context ctx;
+  ctx.fn = argv[1];
+  ctx.voc = std::make_unique <vocabulary>
+    (*dwgrep_vocabulary_core (), *dwgrep_vocabulary_dw ());
+
+  std::vector <std::string> which {argv + 2, argv + argc};
+  for (auto const &b: benchmarks)
+    if (which.empty ()
+	|| std::find (which.begin (), which.end (), b.first) != which.end ())
+      {
+	std::cout << "== " << b.first << std::endl;
+	b.second (ctx);
+      }
+
+  return 0;
+}
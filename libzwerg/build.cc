@@ -31,8 +31,10 @@
 #include <memory>
 
 #include "op.hh"
+#include "overload.hh"
 #include "scope.hh"
 #include "tree.hh"
+#include "value-closure.hh"
 #include "value-cst.hh"
 #include "value-seq.hh"
 #include "value-str.hh"
@@ -101,8 +103,125 @@ tree::build_pred () const
   abort ();
 }
 
+namespace
+{
+  void
+  apply_builtin_effect (builtin const &bi, stack_types &types)
+  {
+    if (auto ovl = dynamic_cast <overloaded_builtin const *> (&bi))
+      {
+	if (auto pegged = ovl->peg (types))
+	  types.apply (pegged->protomap ());
+	else
+	  ovl->apply_effect (types);
+      }
+    else
+      types.apply (bi.protomap ());
+  }
+}
+
+void
+tree::infer_types (stack_types &types) const
+{
+  switch (m_tt)
+    {
+    case tree_type::CAT:
+      for (auto const &t: m_children)
+	t.infer_types (types);
+      return;
+
+    case tree_type::ALT:
+    case tree_type::OR:
+      {
+	std::vector <stack_types> branch_types (m_children.size (), types);
+	for (size_t i = 0; i < m_children.size (); ++i)
+	  m_children[i].infer_types (branch_types[i]);
+	types = stack_types::join (branch_types);
+	return;
+      }
+
+    case tree_type::IFELSE:
+      {
+	std::vector <stack_types> branch_types (2, types);
+	child (1).infer_types (branch_types[0]);
+	child (2).infer_types (branch_types[1]);
+	types = stack_types::join (branch_types);
+	return;
+      }
+
+    case tree_type::SCOPE:
+      child (0).infer_types (types);
+      return;
+
+    case tree_type::SUBX_EVAL:
+      {
+	stack_types sub = types;
+	child (0).infer_types (sub);
+	size_t keep = cst ().value ().uval ();
+	for (size_t i = keep; i-- > 0; )
+	  types.push (sub.at (i));
+	return;
+      }
+
+    case tree_type::F_BUILTIN:
+      if (m_builtin->build_pred () == nullptr)
+	apply_builtin_effect (*m_builtin, types);
+      return;
+
+    case tree_type::ASSERT:
+    case tree_type::NOP:
+    case tree_type::F_DEBUG:
+      return;
+
+    case tree_type::CONST:
+      types.push (value_cst::vtype);
+      return;
+
+    case tree_type::STR:
+    case tree_type::FORMAT:
+      types.push (value_str::vtype);
+      return;
+
+    case tree_type::EMPTY_LIST:
+    case tree_type::CAPTURE:
+      types.push (value_seq::vtype);
+      return;
+
+    case tree_type::BLOCK:
+      types.push (value_closure::vtype);
+      return;
+
+    case tree_type::BIND:
+      types.pop (1);
+      return;
+
+    case tree_type::READ:
+      // This might be a function call.
+    case tree_type::CLOSE_STAR:
+      types.forget ();
+      return;
+
+    case tree_type::PRED_AND:
+    case tree_type::PRED_OR:
+    case tree_type::PRED_NOT:
+    case tree_type::PRED_SUBX_ANY:
+    case tree_type::PRED_SUBX_CMP:
+      assert (! "Should never get here.");
+      abort ();
+    }
+
+  abort ();
+}
+
 std::shared_ptr <op>
 tree::build_exec (std::shared_ptr <op> upstream) const
+{
+  stack_types types;
+  return build_exec (upstream, types);
+}
+
+std::shared_ptr <op>
+tree::build_exec (std::shared_ptr <op> upstream, stack_types &types) const
 {
   if (upstream == nullptr)
     upstream = std::make_shared <op_origin> (std::make_unique <stack> ());
@@ -110,8 +229,21 @@ tree::build_exec (std::shared_ptr <op> upstream) const
   switch (m_tt)
     {
     case tree_type::CAT:
-      for (auto const &tree: m_children)
-	upstream = tree.build_exec (upstream);
+      for (size_t i = 0; i < m_children.size (); ++i)
+	{
+	  tree const &t = m_children[i];
+	  if (i + 1 < m_children.size () && t.m_tt == tree_type::F_BUILTIN)
+	    if (auto op = t.m_builtin->build_exec_fused
+				(upstream, m_children[i + 1]))
+	      {
+		upstream = op;
+		t.infer_types (types);
+		m_children[++i].infer_types (types);
+		continue;
+	      }
+
+	  upstream = t.build_exec (upstream, types);
+	}
       return upstream;
 
     case tree_type::ALT:
@@ -126,13 +258,11 @@ tree::build_exec (std::shared_ptr <op> upstream) const
 	    ops.push_back (std::make_shared <op_tine> (upstream, f, done, i));
 	}
 
-	auto build_branch = [] (tree const &ch, std::shared_ptr <op> o)
-	  {
-	    return ch.build_exec (o);
-	  };
-
-	std::transform (m_children.begin (), m_children.end (),
-			ops.begin (), ops.begin (), build_branch);
+	// Each branch sees the same stacks.
+	std::vector <stack_types> branch_types (m_children.size (), types);
+	for (size_t i = 0; i < m_children.size (); ++i)
+	  ops[i] = m_children[i].build_exec (ops[i], branch_types[i]);
+	types = stack_types::join (branch_types);
 
 	return std::make_shared <op_merge> (ops, done);
       }
@@ -140,12 +270,14 @@ tree::build_exec (std::shared_ptr <op> upstream) const
     case tree_type::OR:
       {
 	auto o = std::make_shared <op_or> (upstream);
-	for (auto const &tree: m_children)
+	std::vector <stack_types> branch_types (m_children.size (), types);
+	for (size_t i = 0; i < m_children.size (); ++i)
 	  {
 	    auto origin2 = std::make_shared <op_origin> (nullptr);
-	    auto op = tree.build_exec (origin2);
+	    auto op = m_children[i].build_exec (origin2, branch_types[i]);
 	    o->add_branch (origin2, op);
 	  }
+	types = stack_types::join (branch_types);
 	return o;
       }
 
@@ -154,10 +286,29 @@ tree::build_exec (std::shared_ptr <op> upstream) const
 
     case tree_type::F_BUILTIN:
       {
+	// If the overload that will be chosen is known statically,
+	// build it directly instead of dispatching at runtime.
+	auto ovl = dynamic_cast <overloaded_builtin const *> (m_builtin.get ());
+	auto pegged = ovl != nullptr ? ovl->peg (types) : nullptr;
+
+	if (auto pb = dynamic_cast <overloaded_pred_builtin const *> (ovl))
+	  if (pegged != nullptr)
+	    return std::make_shared <op_assert>
+	      (upstream, maybe_invert (pegged->build_pred (), pb->m_positive));
+
 	if (auto pred = build_pred ())
 	  return std::make_shared <op_assert> (upstream, std::move (pred));
+
+	if (pegged != nullptr)
+	  if (auto op = pegged->build_exec (upstream))
+	    {
+	      types.apply (pegged->protomap ());
+	      return op;
+	    }
+
 	auto op = m_builtin->build_exec (upstream);
 	assert (op != nullptr);
+	apply_builtin_effect (*m_builtin, types);
 	return op;
       }
 
@@ -179,66 +330,85 @@ tree::build_exec (std::shared_ptr <op> upstream) const
 	      strgr = std::make_shared <stringer_op> (strgr, origin2, op);
 	    }
 
+	types.push (value_str::vtype);
 	return std::make_shared <op_format> (upstream, s_origin, strgr);
       }
 
     case tree_type::CONST:
       {
 	auto val = std::make_unique <value_cst> (cst (), 0);
+	types.push (value_cst::vtype);
 	return std::make_shared <op_const> (upstream, std::move (val));
       }
 
     case tree_type::STR:
       {
 	auto val = std::make_unique <value_str> (std::string (str ()), 0);
+	types.push (value_str::vtype);
 	return std::make_shared <op_const> (upstream, std::move (val));
       }
 
     case tree_type::EMPTY_LIST:
       {
 	auto val = std::make_unique <value_seq> (value_seq::seq_t {}, 0);
+	types.push (value_seq::vtype);
 	return std::make_shared <op_const> (upstream, std::move (val));
       }
 
     case tree_type::CAPTURE:
       {
 	auto origin = std::make_shared <op_origin> (nullptr);
-	auto op = child (0).build_exec (origin);
+	stack_types sub = types;
+	auto op = child (0).build_exec (origin, sub);
+	types.push (value_seq::vtype);
 	return std::make_shared <op_capture> (upstream, origin, op);
       }
 
     case tree_type::SUBX_EVAL:
       {
 	auto origin = std::make_shared <op_origin> (nullptr);
-	auto op = child (0).build_exec (origin);
-	return std::make_shared <op_subx> (upstream, origin, op,
-					   cst ().value ().uval ());
+	stack_types sub = types;
+	auto op = child (0).build_exec (origin, sub);
+
+	// The top KEEP values that the subexpression yields are pushed
+	// on the original stack.
+	size_t keep = cst ().value ().uval ();
+	for (size_t i = keep; i-- > 0; )
+	  types.push (sub.at (i));
+
+	return std::make_shared <op_subx> (upstream, origin, op, keep);
       }
 
     case tree_type::CLOSE_STAR:
       {
 	auto origin = std::make_shared <op_origin> (nullptr);
 	auto op = child (0).build_exec (origin);
+	types.forget ();
 	return std::make_shared <op_tr_closure> (upstream, origin, op);
       }
 
     case tree_type::SCOPE:
       {
+	// Scope passes through whatever its body yields.
 	auto origin = std::make_shared <op_origin> (nullptr);
-	auto op = child (0).build_exec (origin);
+	auto op = child (0).build_exec (origin, types);
 	return std::make_shared <op_scope> (upstream, origin, op,
 					    scp ()->num_names ());
       }
 
     case tree_type::BLOCK:
       assert (scp () == nullptr);
+      types.push (value_closure::vtype);
       return std::make_shared <op_lex_closure> (upstream, child (0));
 
     case tree_type::BIND:
+      types.pop (1);
       return std::make_shared <op_bind>
 	(upstream, cst ().value ().uval (), scp ()->index (str ()));
 
     case tree_type::READ:
+      // This might be a function call.
+      types.forget ();
       return std::make_shared <op_read>
 	(upstream, cst ().value ().uval (), scp ()->index (str ()));
 
@@ -248,13 +418,18 @@ tree::build_exec (std::shared_ptr <op> upstream) const
     case tree_type::IFELSE:
       {
 	auto cond_origin = std::make_shared <op_origin> (nullptr);
-	auto cond_op = child (0).build_exec (cond_origin);
+	stack_types cond_types = types;
+	auto cond_op = child (0).build_exec (cond_origin, cond_types);
+
+	std::vector <stack_types> branch_types (2, types);
 
 	auto then_origin = std::make_shared <op_origin> (nullptr);
-	auto then_op = child (1).build_exec (then_origin);
+	auto then_op = child (1).build_exec (then_origin, branch_types[0]);
 
 	auto else_origin = std::make_shared <op_origin> (nullptr);
-	auto else_op = child (2).build_exec (else_origin);
+	auto else_op = child (2).build_exec (else_origin, branch_types[1]);
+
+	types = stack_types::join (branch_types);
 
 	return std::make_shared <op_ifelse> (upstream, cond_origin, cond_op,
 					     then_origin, then_op,
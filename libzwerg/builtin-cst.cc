@@ -229,6 +229,12 @@ op_type::next ()
   return nullptr;
 }
 
+std::string
+op_type::name () const
+{
+  return "type";
+}
+
 std::string
 op_type::docstring ()
 {
@@ -241,6 +247,31 @@ as T_CONST, T_DIE, T_STR, etc.).
 )docstring";
 }
 
+std::shared_ptr <op>
+builtin_type::build_exec (std::shared_ptr <op> upstream) const
+{
+  return std::make_shared <op_type> (upstream);
+}
+
+char const *
+builtin_type::name () const
+{
+  return "type";
+}
+
+std::string
+builtin_type::docstring () const
+{
+  return op_type::docstring ();
+}
+
+builtin_protomap
+builtin_type::protomap () const
+{
+  return { builtin_prototype ({value::vtype}, yield::once,
+			      {value_cst::vtype}) };
+}
+
 stack::uptr
 op_pos::next ()
 {
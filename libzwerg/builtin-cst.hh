@@ -45,6 +45,12 @@ public:
     : m_value {std::move (value)}
   {}
 
+  value const &
+  get_value () const
+  {
+    return *m_value;
+  }
+
   std::shared_ptr <op> build_exec (std::shared_ptr <op> upstream)
     const override;
 
@@ -98,10 +104,25 @@ struct op_type
 {
   using inner_op::inner_op;
   stack::uptr next () override;
+  std::string name () const override;
 
   static std::string docstring ();
 };
 
+// The word `type'.  It has a class of its own so that the optimizer
+// can recognize it and compute its result when the type of TOS is
+// known statically.
+struct builtin_type
+  : public builtin
+{
+  std::shared_ptr <op> build_exec (std::shared_ptr <op> upstream)
+    const override;
+
+  char const *name () const override;
+  std::string docstring () const override;
+  builtin_protomap protomap () const override;
+};
+
 struct op_pos
   : public inner_op
 {
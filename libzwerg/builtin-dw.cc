@@ -26,6 +26,8 @@
    the GNU Lesser General Public License along with this program.  If
    not, see <http://www.gnu.org/licenses/>.  */
 
+#include <cstring>
+#include <functional>
 #include <memory>
 #include <sstream>
 
@@ -48,78 +50,88 @@
 // dwopen
 namespace
 {
+  // Values made from a Dwarf value refer to its context without
+  // keeping it alive, so contexts of opened files go to the registry
+  // of the query result that is being evaluated.  When the op runs
+  // outside of any such scope, it keeps the contexts itself.
   struct op_dwopen_str
     : public op_overload <value_dwarf, value_str>
   {
     using op_overload::op_overload;
 
+    dwctx_registry m_opened;
+
     std::unique_ptr <value_dwarf>
     operate (std::unique_ptr <value_str> a) override
     {
-      return std::make_unique <value_dwarf> (a->get_string (), 0,
-					     doneness::cooked);
+      std::string const &fn = a->get_string ();
+      auto dwctx = std::make_shared <dwfl_context> (fn, true);
+      if (dwctx_registry *dwctxs = dwctx_scope::current ())
+	dwctxs->add (dwctx);
+      else
+	m_opened.add (dwctx);
+      return std::make_unique <value_dwarf> (fn, dwctx, 0, doneness::cooked);
     }
   };
 }
 
-
 // unit
-namespace
+std::vector <Dwarf *>
+all_dwarfs (dwfl_context &dwctx)
 {
-  std::vector <Dwarf *>
-  all_dwarfs (dwfl_context &dwctx)
-  {
-    std::vector <Dwarf *> ret;
-    std::for_each (dwfl_module_iterator {dwctx.get_dwfl ()},
-		   dwfl_module_iterator::end (),
-		   [&] (std::pair <Dwarf *, Dwarf_Addr> p)
-		   {
-		     ret.push_back (p.first);
-		     if (Dwarf *alt = dwarf_getalt (p.first))
-		       ret.push_back (alt);
-		   });
-    return ret;
-  }
+  std::vector <Dwarf *> ret;
+  std::for_each (dwfl_module_iterator {dwctx.get_dwfl ()},
+		 dwfl_module_iterator::end (),
+		 [&] (std::pair <Dwarf *, Dwarf_Addr> p)
+		 {
+		   ret.push_back (p.first);
+		   if (Dwarf *alt = dwarf_getalt (p.first))
+		     ret.push_back (alt);
+		 });
+  return ret;
+}
 
-  bool
-  maybe_next_dwarf (cu_iterator &cuit,
-		    std::vector <Dwarf *>::iterator &it,
-		    std::vector <Dwarf *>::iterator const end)
-  {
-    while (cuit == cu_iterator::end ())
-      if (it == end)
-	return false;
-      else
-	cuit = cu_iterator {*it++};
+bool
+maybe_next_dwarf (cu_iterator &cuit,
+		  std::vector <Dwarf *>::iterator &it,
+		  std::vector <Dwarf *>::iterator const end)
+{
+  while (cuit == cu_iterator::end ())
+    if (it == end)
+      return false;
+    else
+      cuit = cu_iterator {*it++};
+  return true;
+}
+
+bool
+next_acceptable_unit (doneness d, cu_iterator &it)
+{
+  if (d == doneness::raw)
     return true;
-  }
 
-  bool
-  next_acceptable_unit (doneness d, cu_iterator &it)
-  {
-    if (d == doneness::raw)
+  for (; it != cu_iterator::end (); ++it)
+    // In cooked mode, we reject partial units.
+    // XXX Should we reject type units as well?
+    if (dwarf_tag (*it) != DW_TAG_partial_unit)
       return true;
 
-    for (; it != cu_iterator::end (); ++it)
-      // In cooked mode, we reject partial units.
-      // XXX Should we reject type units as well?
-      if (dwarf_tag (*it) != DW_TAG_partial_unit)
-	return true;
-
-    return false;
-  }
+  return false;
+}
 
+namespace
+{
   struct dwarf_unit_producer
     : public value_producer <value_cu>
   {
-    std::shared_ptr <dwfl_context> m_dwctx;
+    dwctx_handle m_dwctx;
     std::vector <Dwarf *> m_dwarfs;
     std::vector <Dwarf *>::iterator m_it;
     cu_iterator m_cuit;
     size_t m_i;
     doneness m_doneness;
 
-    dwarf_unit_producer (std::shared_ptr <dwfl_context> dwctx, doneness d)
+    dwarf_unit_producer (dwctx_handle dwctx, doneness d)
       : m_dwctx {dwctx}
       , m_dwarfs {all_dwarfs (*dwctx)}
       , m_it {m_dwarfs.begin ()}
@@ -158,7 +170,7 @@ namespace
   };
 
   std::unique_ptr <value_cu>
-  cu_for_die (std::shared_ptr <dwfl_context> dwctx, Dwarf_Die die, doneness d)
+  cu_for_die (dwctx_handle dwctx, Dwarf_Die die, doneness d)
   {
     Dwarf_Die cudie;
     if (dwarf_diecu (&die, &cudie, nullptr, nullptr) == nullptr)
@@ -227,8 +239,8 @@ namespace
   template <class It>
   bool
   import_partial_units (std::vector <std::pair <It, It>> &stack,
-			std::shared_ptr <dwfl_context> dwctx,
-			std::shared_ptr <value_die> &import)
+			dwctx_handle dwctx,
+			import_chain const *&import)
   {
     Dwarf_Die *die = *stack.back ().first;
     Dwarf_Attribute at_import;
@@ -240,8 +252,7 @@ namespace
       {
 	// Do this first, before we bump the iterator and DIE gets
 	// invalidated.
-	import = std::make_shared <value_die> (dwctx, import, *die, 0,
-					       doneness::cooked);
+	import = dwctx->import_chain_of (import, *die);
 
 	// Skip DW_TAG_imported_unit.
 	stack.back ().first++;
@@ -257,7 +268,7 @@ namespace
   template <class It>
   bool
   drop_finished_imports (std::vector <std::pair <It, It>> &stack,
-			 std::shared_ptr <value_die> &import)
+			 import_chain const *&import)
   {
     assert (! stack.empty ());
     if (stack.back ().first != stack.back ().second)
@@ -268,7 +279,7 @@ namespace
     // We have one more item in STACK than values in IMPORT chain, so
     // this can actually be empty at this point.
     if (import != nullptr)
-      import = import->get_import ();
+      import = import->m_parent;
 
     return true;
   }
@@ -280,20 +291,21 @@ namespace
   struct die_it_producer
     : public value_producer <value_die>
   {
-    std::shared_ptr <dwfl_context> m_dwctx;
+    dwctx_handle m_dwctx;
 
     // Stack of iterator ranges.
     std::vector <std::pair <It, It>> m_stack;
 
     // Chain of DIE's where partial units were imported.
-    std::shared_ptr <value_die> m_import;
+    import_chain const *m_import;
 
     size_t m_i;
     doneness m_doneness;
 
-    die_it_producer (std::shared_ptr <dwfl_context> dwctx, Dwarf_Die die,
+    die_it_producer (dwctx_handle dwctx, Dwarf_Die die,
 		     doneness d)
       : m_dwctx {dwctx}
+      , m_import {nullptr}
       , m_i {0}
       , m_doneness {d}
     {
@@ -313,10 +325,24 @@ namespace
       return std::make_unique <value_die>
 	(m_dwctx, m_import, **m_stack.back ().first++, m_i++, m_doneness);
     }
+
+    // Unlike the default, this calls next without virtual dispatch.
+    size_t
+    next_batch (std::vector <std::unique_ptr <value_die>> &out,
+		size_t max) override
+    {
+      size_t n = 0;
+      for (; n < max; ++n)
+	if (auto v = die_it_producer::next ())
+	  out.push_back (std::move (v));
+	else
+	  break;
+      return n;
+    }
   };
 
   std::unique_ptr <value_producer <value_die>>
-  make_cu_entry_producer (std::shared_ptr <dwfl_context> dwctx, Dwarf_CU &cu,
+  make_cu_entry_producer (dwctx_handle dwctx, Dwarf_CU &cu,
 			  doneness d)
   {
     return std::make_unique <die_it_producer <all_dies_iterator>>
@@ -347,6 +373,10 @@ namespace
     stack::uptr
     next () override
     { return m_upstream->next (); }
+
+    size_t
+    next_batch (stack_batch &out, size_t max) override
+    { return m_upstream->next_batch (out, max); }
   };
 
   struct op_entry_dwarf
@@ -379,7 +409,7 @@ namespace
     struct producer
       : public value_producer <value_abbrev>
     {
-      std::shared_ptr <dwfl_context> m_dwctx;
+      dwctx_handle m_dwctx;
       std::vector <Dwarf_Abbrev *> m_abbrevs;
       Dwarf_Die m_cudie;
       Dwarf_Off m_offset;
@@ -418,11 +448,518 @@ namespace
   };
 }
 
-// child
+// entry ?TAG_*, entry (@AT_name == STR), entry ?(address CONST ?contains),
+// entry (offset == CONST)
+namespace
+{
+  // Positive tag assertions (?TAG_*, ?DW_TAG_*) are of this type, so
+  // that `entry' can recognize them and answer from a tag index.
+  struct tag_pred_builtin
+    : public overloaded_pred_builtin
+  {
+    int m_tag;
+
+    tag_pred_builtin (char const *name, std::shared_ptr <overload_tab> t,
+		      bool positive, int tag)
+      : overloaded_pred_builtin {name, t, positive}
+      , m_tag {tag}
+    {}
+  };
+
+  // Likewise for @AT_* and @DW_AT_*.
+  struct atval_builtin
+    : public overloaded_op_builtin
+  {
+    int m_atname;
+
+    atval_builtin (char const *name, std::shared_ptr <overload_tab> t,
+		   int atname)
+      : overloaded_op_builtin {name, t}
+      , m_atname {atname}
+    {}
+  };
+
+  // Yields DIE's listed in one of the DIE indices.  T is an index
+  // entry, which has at least M_OFFSET and M_POS.  Entries are read
+  // in place, so the index has to outlive the producer.
+  template <class T>
+  struct indexed_die_producer
+    : public value_producer <value_die>
+  {
+    dwctx_handle m_dwctx;
+    Dwarf *m_dw;
+    T const *m_it;
+    T const *m_end;
+    doneness m_doneness;
+
+    indexed_die_producer (dwctx_handle dwctx, Dwarf *dw,
+			  std::pair <T const *, T const *> range, doneness d)
+      : m_dwctx {dwctx}
+      , m_dw {dw}
+      , m_it {range.first}
+      , m_end {range.second}
+      , m_doneness {d}
+    {}
+
+    std::unique_ptr <value_die>
+    next () override
+    {
+      if (m_it == m_end)
+	return nullptr;
+
+      T const &entry = *m_it++;
+      Dwarf_Die die;
+      if (dwarf_offdie (m_dw, entry.m_offset, &die) == nullptr)
+	throw_libdw ();
+
+      return std::make_unique <value_die> (m_dwctx, die, entry.m_pos,
+					   m_doneness);
+    }
+  };
+
+  // The same for entries that are computed for each lookup, and that
+  // the producer therefore owns.
+  template <class T>
+  struct owning_indexed_die_producer
+    : public indexed_die_producer <T>
+  {
+    std::vector <T> m_dies;
+
+    owning_indexed_die_producer (dwctx_handle dwctx, Dwarf *dw,
+				 std::vector <T> dies, doneness d)
+      : indexed_die_producer <T> {dwctx, dw, {nullptr, nullptr}, d}
+      , m_dies {std::move (dies)}
+    {
+      this->m_it = m_dies.data ();
+      this->m_end = m_dies.data () + m_dies.size ();
+    }
+  };
+
+  template <class T>
+  std::unique_ptr <value_producer <value_die>>
+  make_indexed_die_producer (dwctx_handle dwctx,
+			     Dwarf *dw, std::pair <T const *, T const *> range,
+			     doneness d)
+  {
+    return std::make_unique <indexed_die_producer <T>> (dwctx, dw, range, d);
+  }
+
+  // Filters DIE's coming from another producer by tag.
+  struct tag_filter_producer
+    : public value_producer <value_die>
+  {
+    std::unique_ptr <value_producer <value_die>> m_prod;
+    int m_tag;
+
+    tag_filter_producer (std::unique_ptr <value_producer <value_die>> prod,
+			 int tag)
+      : m_prod {std::move (prod)}
+      , m_tag {tag}
+    {}
+
+    std::unique_ptr <value_die>
+    next () override
+    {
+      while (auto v = m_prod->next ())
+	{
+	  Dwarf_Die die = v->get_die ();
+	  if (dwarf_tag (&die) == m_tag)
+	    return v;
+	}
+      return nullptr;
+    }
+  };
+
+  // Given a unit, produce a superset of DIE's of that unit that the
+  // reduced expression would yield, with the same positions.
+  using unit_producer_maker = std::function
+    <std::unique_ptr <value_producer <value_die>>
+	(dwctx_handle, Dwarf_CU &, doneness)>;
+
+  // Produces, for each unit that M_UNITS yields, values that the
+  // maker makes for that unit.
+  struct unit_chain_producer
+    : public value_producer <value_die>
+  {
+    std::unique_ptr <value_producer <value_cu>> m_units;
+    unit_producer_maker m_maker;
+    std::unique_ptr <value_producer <value_die>> m_prod;
+
+    unit_chain_producer (std::unique_ptr <value_producer <value_cu>> units,
+			 unit_producer_maker maker)
+      : m_units {std::move (units)}
+      , m_maker {maker}
+    {}
+
+    std::unique_ptr <value_die>
+    next () override
+    {
+      while (true)
+	{
+	  if (m_prod != nullptr)
+	    {
+	      if (auto v = m_prod->next ())
+		return v;
+	      m_prod = nullptr;
+	    }
+
+	  auto cu = m_units->next ();
+	  if (cu == nullptr)
+	    return nullptr;
+	  m_prod = m_maker (cu->get_dwctx (), cu->get_cu (),
+			    cu->get_doneness ());
+	}
+    }
+  };
+
+  // Makes a unit_producer_maker for one operand of reduced `entry'.
+  // A maker can thus share work between units of one Dwarf operand.
+  using unit_producer_maker_factory = std::function <unit_producer_maker ()>;
+
+  // For makers that have nothing to share, one of them serves all
+  // operands.
+  unit_producer_maker_factory
+  shared_maker (unit_producer_maker maker)
+  {
+    return [maker] () { return maker; };
+  }
+
+  // This implements reduced `entry' for Dwarf and unit operands.
+  class op_entry_reduced
+    : public op_reduced_base <value_die>
+  {
+    unit_producer_maker_factory m_factory;
+
+  protected:
+    bool
+    make_producer (stack &stk,
+		   std::unique_ptr <value_producer <value_die>> &ret) override
+    {
+      if (auto cu = stk.top_as <value_cu> ())
+	{
+	  ret = m_factory () (cu->get_dwctx (), cu->get_cu (),
+			      cu->get_doneness ());
+	  stk.pop ();
+	  return true;
+	}
+
+      if (auto dw = stk.top_as <value_dwarf> ())
+	{
+	  ret = std::make_unique <unit_chain_producer>
+	    (std::make_unique <dwarf_unit_producer> (dw->get_dwctx (),
+						     dw->get_doneness ()),
+	     m_factory ());
+	  stk.pop ();
+	  return true;
+	}
+
+      return false;
+    }
+
+  public:
+    op_entry_reduced (std::shared_ptr <op> upstream,
+		      unit_producer_maker_factory factory,
+		      std::unique_ptr <pred> verify,
+		      builtin const &entry, tree const &next)
+      : op_reduced_base {upstream, std::move (verify), entry, next}
+      , m_factory {factory}
+    {}
+  };
+
+  std::unique_ptr <value_producer <value_die>>
+  make_cu_tag_producer (dwctx_handle dwctx, Dwarf_CU &cu,
+			int tag, doneness d)
+  {
+    Dwarf_Die cudie = dwpp_cudie (cu);
+    unit_tag_index const &idx = dwctx->tag_index (cudie);
+
+    // Cooked entry inlines imported partial units, which shifts
+    // positions of DIE's that follow.  Just filter in that case.
+    if (d == doneness::cooked && idx.m_has_imports)
+      return std::make_unique <tag_filter_producer>
+	(make_cu_entry_producer (dwctx, cu, d), tag);
+
+    return make_indexed_die_producer (dwctx, dwarf_cu_getdwarf (&cu),
+				      idx.find (tag), d);
+  }
+
+  std::unique_ptr <value_producer <value_die>>
+  make_cu_name_producer (dwctx_handle dwctx, Dwarf_CU &cu,
+			 std::string const &name, doneness d)
+  {
+    Dwarf *dw = dwarf_cu_getdwarf (&cu);
+    Dwarf_Die cudie = dwpp_cudie (cu);
+    Dwarf_Off cu_offset = dwarf_dieoffset (&cudie);
+    dwarf_name_index const &idx
+      = dwctx->name_index (dw, d == doneness::cooked);
+
+    // As above.  The caller checks each DIE, so all of them can be
+    // passed through.
+    if (d == doneness::cooked && idx.m_importing.has_imports (cu_offset))
+      return make_cu_entry_producer (dwctx, cu, d);
+
+    return make_indexed_die_producer (dwctx, dw,
+				      idx.find (name, cu_offset), d);
+  }
+
+  // DIE's that cover one address.  The address is looked up in the
+  // index of a whole Dwarf the first time that a unit of that Dwarf
+  // asks, and units that come after find their DIE's among the same
+  // hits.
+  struct addr_hits
+  {
+    using die_range = dwarf_addr_index::die_range;
+
+    Dwarf_Addr m_addr;
+    std::map <Dwarf *, std::vector <die_range>> m_hits;
+
+    explicit addr_hits (Dwarf_Addr addr)
+      : m_addr {addr}
+    {}
+
+    // Hits in the unit whose CU DIE is at CU_OFFSET.
+    std::vector <die_range>
+    find (dwctx_handle dwctx, Dwarf *dw, Dwarf_Off cu_offset)
+    {
+      auto it = m_hits.find (dw);
+      if (it == m_hits.end ())
+	it = m_hits.insert (std::make_pair
+			    (dw, dwctx->addr_index (dw).find (m_addr))).first;
+
+      // Hits come in order of their offsets, so those of one unit are
+      // next to each other.
+      auto r = std::equal_range
+	(it->second.begin (), it->second.end (),
+	 die_range {0, 0, cu_offset, 0, 0},
+	 [] (die_range const &a, die_range const &b)
+	 { return a.m_cu_offset < b.m_cu_offset; });
+      return std::vector <die_range> (r.first, r.second);
+    }
+  };
+
+  std::unique_ptr <value_producer <value_die>>
+  make_cu_addr_producer (dwctx_handle dwctx, Dwarf_CU &cu,
+			 addr_hits &hits, doneness d)
+  {
+    Dwarf *dw = dwarf_cu_getdwarf (&cu);
+    Dwarf_Die cudie = dwpp_cudie (cu);
+    Dwarf_Off cu_offset = dwarf_dieoffset (&cudie);
+    dwarf_addr_index const &idx = dwctx->addr_index (dw);
+
+    if (d == doneness::cooked && idx.m_importing.has_imports (cu_offset))
+      return make_cu_entry_producer (dwctx, cu, d);
+
+    return std::make_unique
+      <owning_indexed_die_producer <dwarf_addr_index::die_range>>
+      (dwctx, dw, hits.find (dwctx, dw, cu_offset), d);
+  }
+
+  // Recognize NEXT as ?(address CONST ?contains), and store the
+  // constant to ADDR.
+  bool
+  is_address_containment (tree const &next, Dwarf_Addr &addr)
+  {
+    if (next.tt () != tree_type::ASSERT
+	|| next.child (0).tt () != tree_type::PRED_SUBX_ANY
+	|| next.child (0).child (0).tt () != tree_type::CAT)
+      return false;
+
+    tree const &cat = next.child (0).child (0);
+    if (cat.m_children.size () != 3
+	|| cat.child (0).tt () != tree_type::F_BUILTIN
+	|| strcmp (cat.child (0).m_builtin->name (), "address") != 0
+	|| cat.child (1).tt () != tree_type::CONST
+	|| cat.child (2).tt () != tree_type::F_BUILTIN
+	|| strcmp (cat.child (2).m_builtin->name (), "?contains") != 0)
+      return false;
+
+    // Leave constants that ?contains would warn about to the
+    // unreduced computation.
+    constant const &cst = cat.child (1).cst ();
+    if (! cst.dom ()->safe_arith () || cst.value () < 0)
+      return false;
+
+    addr = cst.value ().uval ();
+    return true;
+  }
+
+  // Recognize NEXT as a comparison of @AT_name (or @DW_AT_name) with
+  // a string literal, and store that literal to NAME.
+  bool
+  is_name_comparison (tree const &next, std::string &name)
+  {
+    if (next.tt () != tree_type::ASSERT
+	|| next.child (0).tt () != tree_type::PRED_SUBX_CMP)
+      return false;
+
+    tree const &cmp = next.child (0);
+    tree const &op = cmp.child (2);
+    if (op.tt () != tree_type::F_BUILTIN
+	|| strcmp (op.m_builtin->name (), "?eq") != 0)
+      return false;
+
+    auto is_atval_name = [] (tree const &t)
+      {
+	if (t.tt () != tree_type::F_BUILTIN)
+	  return false;
+	auto ab = dynamic_cast <atval_builtin const *> (t.m_builtin.get ());
+	return ab != nullptr && ab->m_atname == DW_AT_name;
+      };
+
+    auto is_literal = [] (tree const &t)
+      {
+	return t.tt () == tree_type::STR
+	  || (t.tt () == tree_type::FORMAT
+	      && t.m_children.size () == 1
+	      && t.child (0).tt () == tree_type::STR);
+      };
+
+    auto literal = [] (tree const &t) -> std::string const &
+      {
+	return t.tt () == tree_type::STR ? t.str () : t.child (0).str ();
+      };
+
+    for (size_t i = 0; i < 2; ++i)
+      if (is_atval_name (cmp.child (i)) && is_literal (cmp.child (1 - i)))
+	{
+	  name = literal (cmp.child (1 - i));
+	  return true;
+	}
+
+    return false;
+  }
+
+  std::unique_ptr <value_producer <value_die>>
+  make_cu_offset_producer (dwctx_handle dwctx,
+			   Dwarf_CU &cu, Dwarf_Off offset, doneness d)
+  {
+    auto none = [] ()
+      {
+	return std::make_unique <value_producer_single <value_die>> (nullptr);
+      };
+
+    Dwarf_Die die;
+    if (dwarf_offdie (dwarf_cu_getdwarf (&cu), offset, &die) == nullptr)
+      return none ();
+
+    // Only the unit that OFFSET falls into needs to be looked into.
+    // In cooked mode, units that import it need to be as well.
+    Dwarf_Die cudie = dwpp_cudie (cu);
+    Dwarf_Die die_cudie = dwpp_cudie (die);
+    if (dwarf_dieoffset (&die_cudie) != dwarf_dieoffset (&cudie))
+      {
+	if (d == doneness::cooked
+	    && dwarf_tag (&die_cudie) == DW_TAG_partial_unit
+	    && dwctx->tag_index (cudie).m_has_imports)
+	  return make_cu_entry_producer (dwctx, cu, d);
+	return none ();
+      }
+
+    unit_tag_index const &idx = dwctx->tag_index (cudie);
+    if (d == doneness::cooked && idx.m_has_imports)
+      return make_cu_entry_producer (dwctx, cu, d);
+
+    // DIE's of one tag are in the order of positions, and therefore
+    // also of offsets.  An OFFSET that doesn't start a DIE isn't
+    // found.
+    auto range = idx.find (dwarf_tag (&die));
+    auto it = std::lower_bound
+      (range.first, range.second, offset,
+       [] (unit_tag_index::tagged_die const &td, Dwarf_Off off)
+       {
+	 return td.m_offset < off;
+       });
+    if (it == range.second || it->m_offset != offset)
+      return none ();
+
+    return std::make_unique <value_producer_single <value_die>>
+      (std::make_unique <value_die> (dwctx, die, it->m_pos, d));
+  }
+
+  // Reduction points of `entry'.
+
+  std::shared_ptr <op>
+  reduce_entry_tag (std::shared_ptr <op> upstream, tree const &next,
+		    builtin const &self)
+  {
+    if (next.tt () != tree_type::F_BUILTIN)
+      return nullptr;
+
+    auto tp = dynamic_cast <tag_pred_builtin const *> (next.m_builtin.get ());
+    if (tp == nullptr || ! tp->m_positive)
+      return nullptr;
+
+    int tag = tp->m_tag;
+    return std::make_shared <op_entry_reduced>
+      (upstream,
+       shared_maker ([tag] (dwctx_handle dwctx, Dwarf_CU &cu, doneness d)
+		     {
+		       return make_cu_tag_producer (dwctx, cu, tag, d);
+		     }),
+       nullptr, self, next);
+  }
+
+  std::shared_ptr <op>
+  reduce_entry_name (std::shared_ptr <op> upstream, tree const &next,
+		     builtin const &self)
+  {
+    std::string name;
+    if (! is_name_comparison (next, name))
+      return nullptr;
+
+    return std::make_shared <op_entry_reduced>
+      (upstream,
+       shared_maker ([name] (dwctx_handle dwctx, Dwarf_CU &cu, doneness d)
+		     {
+		       return make_cu_name_producer (dwctx, cu, name, d);
+		     }),
+       next.child (0).build_pred (), self, next);
+  }
+
+  std::shared_ptr <op>
+  reduce_entry_address (std::shared_ptr <op> upstream, tree const &next,
+			builtin const &self)
+  {
+    Dwarf_Addr addr;
+    if (! is_address_containment (next, addr))
+      return nullptr;
+
+    return std::make_shared <op_entry_reduced>
+      (upstream,
+       [addr] () -> unit_producer_maker
+       {
+	 auto hits = std::make_shared <addr_hits> (addr);
+	 return [hits] (dwctx_handle dwctx, Dwarf_CU &cu, doneness d)
+	   {
+	     return make_cu_addr_producer (dwctx, cu, *hits, d);
+	   };
+       },
+       next.child (0).build_pred (), self, next);
+  }
+
+  std::shared_ptr <op>
+  reduce_entry_offset (std::shared_ptr <op> upstream, tree const &next,
+		       builtin const &self)
+  {
+    uint64_t offset;
+    if (! match_word_eq_index (next, "offset", offset))
+      return nullptr;
+
+    return std::make_shared <op_entry_reduced>
+      (upstream,
+       shared_maker ([offset] (dwctx_handle dwctx, Dwarf_CU &cu, doneness d)
+		     {
+		       return make_cu_offset_producer (dwctx, cu, offset, d);
+		     }),
+       next.child (0).build_pred (), self, next);
+  }
+}
+
+// child, child (offset == CONST), child (pos == CONST)
 namespace
 {
   std::unique_ptr <value_producer <value_die>>
-  make_die_child_producer (std::shared_ptr <dwfl_context> dwctx,
+  make_die_child_producer (dwctx_handle dwctx,
 			   Dwarf_Die parent, doneness d)
   {
     return std::make_unique <die_it_producer <child_iterator>>
@@ -441,6 +978,64 @@ namespace
 				      a->get_doneness ());
     }
   };
+
+  // Picks a child by its DIE and position.
+  using child_matcher = std::function <bool (Dwarf_Die &, size_t)>;
+
+  // Yield the first child of PARENT that MATCH picks, without making
+  // values of children before it.  Cooked `child' inlines imported
+  // partial units, which shifts positions of the children that
+  // follow.  If one is met before the match, or there's no match,
+  // all children are yielded instead.
+  std::unique_ptr <value_producer <value_die>>
+  make_die_child_lookup (dwctx_handle dwctx,
+			 Dwarf_Die parent, doneness d,
+			 child_matcher const &match)
+  {
+    Dwarf_Die die;
+    bool more = dwpp_child (parent, die);
+    for (size_t i = 0; more; ++i, more = dwpp_siblingof (die, die))
+      {
+	if (d == doneness::cooked && dwarf_tag (&die) == DW_TAG_imported_unit)
+	  return make_die_child_producer (dwctx, parent, d);
+
+	if (match (die, i))
+	  return std::make_unique <value_producer_single <value_die>>
+	    (std::make_unique <value_die> (dwctx, die, i, d));
+      }
+
+    return std::make_unique <value_producer_single <value_die>> (nullptr);
+  }
+
+  // child (offset == CONST), child (pos == CONST)
+  std::shared_ptr <op>
+  reduce_child (std::shared_ptr <op> upstream, tree const &next,
+		builtin const &self)
+  {
+    uint64_t idx;
+    child_matcher match;
+    if (match_word_eq_index (next, "offset", idx))
+      match = [idx] (Dwarf_Die &die, size_t i)
+	{
+	  return dwarf_dieoffset (&die) == idx;
+	};
+    else if (match_word_eq_index (next, "pos", idx))
+      match = [idx] (Dwarf_Die &die, size_t i)
+	{
+	  return i == idx;
+	};
+    else
+      return nullptr;
+
+    return std::make_shared <op_reduced <value_die, value_die>>
+      (upstream,
+       [match] (std::unique_ptr <value_die> a)
+       {
+	 return make_die_child_lookup (a->get_dwctx (), a->get_die (),
+				       a->get_doneness (), match);
+       },
+       next.child (0).build_pred (), self, next);
+  }
 }
 
 // elem, relem
@@ -575,7 +1170,7 @@ namespace
   };
 }
 
-// attribute
+// attribute, attribute (label == CONST), attribute (pos == CONST)
 namespace
 {
   bool
@@ -608,19 +1203,25 @@ namespace
   struct attribute_producer
     : public value_producer <value_attr>
   {
-    std::shared_ptr <dwfl_context> m_dwctx;
+    dwctx_handle m_dwctx;
     Dwarf_Die m_die;
     attr_iterator m_it;
     size_t m_i;
     doneness m_doneness;
-    bool m_secondary;
+
+    // Attributes of DIE's that M_DIE refers to are taken from nodes
+    // of the integration cache.  M_NODE is null while attributes of
+    // M_DIE itself are walked, M_AT and M_REF index attributes and
+    // references of M_NODE otherwise.
+    std::shared_ptr <integrated_die const> m_node;
+    size_t m_at;
+    size_t m_ref;
 
     // Already seen attributes.
     std::vector <int> m_seen;
 
-    // We store full DIE's to allow DW_AT_specification's in a
-    // separate debug info files.
-    std::vector <Dwarf_Die> m_next;
+    // Nodes of DIE's scheduled for integration.
+    std::vector <std::shared_ptr <integrated_die const>> m_next;
 
     void
     schedule (Dwarf_Attribute &at)
@@ -628,22 +1229,46 @@ namespace
       assert (at.code == DW_AT_abstract_origin
 	      || at.code == DW_AT_specification);
 
-      Dwarf_Die die_mem;
-      if (dwarf_formref_die (&at, &die_mem) == nullptr)
-	throw_libdw ();
-
-      m_next.push_back (die_mem);
+      if (m_node == nullptr)
+	m_next.push_back (m_dwctx->integrated (dwpp_formref_die (at)));
+      else
+	m_next.push_back (m_node->m_refs[m_ref++]);
     }
 
     bool
     next_die ()
     {
-      if (m_next.empty ())
-	return false;
+      // References that close a cycle have no node.
+      while (! m_next.empty ())
+	{
+	  auto node = std::move (m_next.back ());
+	  m_next.pop_back ();
+	  if (node != nullptr)
+	    {
+	      m_node = std::move (node);
+	      m_die = m_node->m_die;
+	      m_at = m_ref = 0;
+	      return true;
+	    }
+	}
+
+      return false;
+    }
+
+    bool
+    next_attr (Dwarf_Attribute &at)
+    {
+      if (m_node == nullptr)
+	{
+	  if (m_it == attr_iterator::end ())
+	    return false;
+	  at = **m_it++;
+	  return true;
+	}
 
-      m_die = m_next.back ();
-      m_it = attr_iterator {&m_die};
-      m_next.pop_back ();
+      if (m_at == m_node->m_attrs.size ())
+	return false;
+      at = m_node->m_attrs[m_at++];
       return true;
     }
 
@@ -656,14 +1281,13 @@ namespace
 
     attribute_producer (std::unique_ptr <value_die> value)
       : m_dwctx {value->get_dwctx ()}
-      , m_it {attr_iterator::end ()}
+      , m_die (value->get_die ())
+      , m_it {&m_die}
       , m_i {0}
       , m_doneness {value->get_doneness ()}
-      , m_secondary {false}
-    {
-      m_next.push_back (value->get_die ());
-      next_die ();
-    }
+      , m_at {0}
+      , m_ref {0}
+    {}
 
     std::unique_ptr <value_attr>
     next () override
@@ -673,13 +1297,10 @@ namespace
       do
 	{
 	again:
-	  while (m_it == attr_iterator::end ())
+	  while (! next_attr (at))
 	    if (! integrate || ! next_die ())
 	      return nullptr;
-	    else
-	      m_secondary = true;
 
-	  at = **m_it++;
 	  if (integrate
 	      && (at.code == DW_AT_specification
 		  || at.code == DW_AT_abstract_origin))
@@ -693,7 +1314,7 @@ namespace
 	      break;
 	    }
 
-	  if (m_secondary && ! attr_should_be_integrated (at.code))
+	  if (m_node != nullptr && ! attr_should_be_integrated (at.code))
 	    goto again;
 	}
       while (integrate && seen (at.code));
@@ -702,6 +1323,19 @@ namespace
       return std::make_unique <value_attr>
 		(m_dwctx, at, m_die, m_i++, m_doneness);
     }
+
+    size_t
+    next_batch (std::vector <std::unique_ptr <value_attr>> &out,
+		size_t max) override
+    {
+      size_t n = 0;
+      for (; n < max; ++n)
+	if (auto v = attribute_producer::next ())
+	  out.push_back (std::move (v));
+	else
+	  break;
+      return n;
+    }
   };
 
   struct op_attribute_die
@@ -716,6 +1350,71 @@ namespace
     }
   };
 
+  // Picks an attribute by its code and position.
+  using attr_matcher = std::function <bool (int, size_t)>;
+
+  // Yield the first attribute of A that MATCH picks, without making
+  // values of attributes before it.  Cooked `attribute' integrates
+  // attributes of DIE's that DW_AT_abstract_origin and
+  // DW_AT_specification refer to.  If A has either, all attributes
+  // are yielded instead.
+  std::unique_ptr <value_producer <value_attr>>
+  make_attribute_lookup (std::unique_ptr <value_die> a,
+			 attr_matcher const &match)
+  {
+    Dwarf_Die die = a->get_die ();
+    if (a->is_cooked ()
+	&& (dwarf_hasattr (&die, DW_AT_abstract_origin)
+	    || dwarf_hasattr (&die, DW_AT_specification)))
+      return std::make_unique <attribute_producer> (std::move (a));
+
+    size_t i = 0;
+    for (attr_iterator it {&die}; it != attr_iterator::end (); ++it, ++i)
+      {
+	Dwarf_Attribute at = **it;
+	if (match (at.code, i))
+	  return std::make_unique <value_producer_single <value_attr>>
+	    (std::make_unique <value_attr> (a->get_dwctx (), at, die, i,
+					    a->get_doneness ()));
+      }
+
+    return std::make_unique <value_producer_single <value_attr>> (nullptr);
+  }
+
+  // attribute (label == DW_AT_*), attribute (pos == CONST)
+  std::shared_ptr <op>
+  reduce_attribute (std::shared_ptr <op> upstream, tree const &next,
+		    builtin const &self)
+  {
+    constant cst;
+    uint64_t idx;
+    attr_matcher match;
+    if (match_word_eq_const (next, "label", cst)
+	&& cst.dom () == &dw_attr_dom () && cst.value () >= 0)
+      {
+	int code = cst.value ().uval ();
+	match = [code] (int atcode, size_t i)
+	  {
+	    return atcode == code;
+	  };
+      }
+    else if (match_word_eq_index (next, "pos", idx))
+      match = [idx] (int atcode, size_t i)
+	{
+	  return i == idx;
+	};
+    else
+      return nullptr;
+
+    return std::make_shared <op_reduced <value_attr, value_die>>
+      (upstream,
+       [match] (std::unique_ptr <value_die> a)
+       {
+	 return make_attribute_lookup (std::move (a), match);
+       },
+       next.child (0).build_pred (), self, next);
+  }
+
   struct op_attribute_abbrev
     : public op_yielding_overload <value_abbrev_attr, value_abbrev>
   {
@@ -792,7 +1491,8 @@ namespace
     std::unique_ptr <value_cst>
     operate (std::unique_ptr <value_die> val) override
     {
-      constant c {dwarf_dieoffset (&val->get_die ()), &dw_offset_dom ()};
+      Dwarf_Die die = val->get_die ();
+      constant c {dwarf_dieoffset (&die), &dw_offset_dom ()};
       return std::make_unique <value_cst> (c, 0);
     }
   };
@@ -942,7 +1642,8 @@ namespace
     std::unique_ptr <value_cst>
     operate (std::unique_ptr <value_die> val) override
     {
-      int tag = dwarf_tag (&val->get_die ());
+      Dwarf_Die die = val->get_die ();
+      int tag = dwarf_tag (&die);
       assert (tag >= 0);
       constant cst {(unsigned) tag, &dw_tag_dom ()};
       return std::make_unique <value_cst> (cst, 0);
@@ -1038,16 +1739,14 @@ namespace
 // parent
 namespace
 {
-  template <class T>
   bool
-  get_parent (T &value, Dwarf_Die &ret)
+  get_parent (dwctx_handle dwctx, Dwarf_Die die, Dwarf_Die &ret)
   {
-    Dwarf_Off par_off = value.get_dwctx ()->find_parent (value.get_die ());
+    Dwarf_Off par_off = dwctx->find_parent (die);
     if (par_off == parent_cache::no_off)
       return false;
 
-    if (dwarf_offdie (dwarf_cu_getdwarf (value.get_die ().cu),
-		      par_off, &ret) == nullptr)
+    if (dwarf_offdie (dwarf_cu_getdwarf (die.cu), par_off, &ret) == nullptr)
       throw_libdw ();
 
     return true;
@@ -1058,42 +1757,33 @@ namespace
   {
     using op_overload::op_overload;
 
-    bool
-    pop_import (std::shared_ptr <value_die> &a)
-    {
-      if (auto b = a->get_import ())
-	{
-	  a = b;
-	  return true;
-	}
-      return false;
-    }
-
     std::unique_ptr <value_die>
-    do_operate (std::shared_ptr <value_die> a)
+    operate (std::unique_ptr <value_die> a) override
     {
       doneness d = a->get_doneness ();
+      Dwarf_Die die = a->get_die ();
+      import_chain const *import
+	= d == doneness::cooked ? a->get_import () : nullptr;
 
       // Both cooked and raw DIE's have parents (unless they don't, in
       // which case we are already at root).  But for cooked DIE's,
       // when the parent is partial unit root, we need to traverse
       // further along the import chain.
       Dwarf_Die par_die;
-      do
-	if (! get_parent (*a, par_die))
-	  return nullptr;
-      while (d == doneness::cooked
-	     && dwarf_tag (&par_die) == DW_TAG_partial_unit
-	     && pop_import (a));
+      while (true)
+	{
+	  if (! get_parent (a->get_dwctx (), die, par_die))
+	    return nullptr;
+	  if (d != doneness::cooked
+	      || dwarf_tag (&par_die) != DW_TAG_partial_unit
+	      || import == nullptr)
+	    break;
+	  die = import->m_die;
+	  import = import->m_parent;
+	}
 
       return std::make_unique <value_die> (a->get_dwctx (), par_die, 0, d);
     }
-
-    std::unique_ptr <value_die>
-    operate (std::unique_ptr <value_die> a) override
-    {
-      return do_operate (std::move (a));
-    }
   };
 }
 
@@ -1146,22 +1836,18 @@ namespace
   {
     using op_overload::op_overload;
 
-    static std::unique_ptr <value_die>
-    do_operate (std::shared_ptr <value_die> a)
+    std::unique_ptr <value_die>
+    operate (std::unique_ptr <value_die> a) override
     {
       auto d = a->get_doneness ();
+      Dwarf_Die die = a->get_die ();
       if (d == doneness::cooked)
-	while (a->get_import () != nullptr)
-	  a = a->get_import ();
+	for (auto import = a->get_import (); import != nullptr;
+	     import = import->m_parent)
+	  die = import->m_die;
 
       return std::make_unique <value_die>
-	(a->get_dwctx (), dwpp_cudie (a->get_die ()), 0, d);
-    }
-
-    std::unique_ptr <value_die>
-    operate (std::unique_ptr <value_die> a) override
-    {
-      return do_operate (std::move (a));
+	(a->get_dwctx (), dwpp_cudie (die), 0, d);
     }
   };
 }
@@ -1179,6 +1865,13 @@ namespace
     {
       return at_value (a->get_dwctx (), a->get_die (), a->get_attr ());
     }
+
+    bool
+    operate_single (std::unique_ptr <value> &ret, value_attr &a) override
+    {
+      ret = at_single_value (a.get_dwctx (), a.get_die (), a.get_attr ());
+      return ret != nullptr;
+    }
   };
 
   struct op_value_loclist_op
@@ -1210,9 +1903,10 @@ namespace
       // Attributes that hold addresses shouldn't generally be found
       // in abstract origins and declarations, so we don't need to
       // concern ourselves with integrating here.
-      if (! dwarf_hasattr (&a->get_die (), DW_AT_low_pc))
+      Dwarf_Die die = a->get_die ();
+      if (! dwarf_hasattr (&die, DW_AT_low_pc))
 	return nullptr;
-      return get_die_addr (&a->get_die (), &dwarf_lowpc);
+      return get_die_addr (&die, &dwarf_lowpc);
     }
   };
 
@@ -1248,9 +1942,10 @@ namespace
       // Attributes that hold addresses shouldn't generally be found
       // in abstract origins and declarations, so we don't need to
       // concern ourselves with integrating here.
-      if (! dwarf_hasattr (&a->get_die (), DW_AT_high_pc))
+      Dwarf_Die die = a->get_die ();
+      if (! dwarf_hasattr (&die, DW_AT_high_pc))
 	return nullptr;
-      return get_die_addr (&a->get_die (), &dwarf_highpc);
+      return get_die_addr (&die, &dwarf_highpc);
     }
   };
 
@@ -1482,6 +2177,91 @@ namespace
   };
 }
 
+// addr2die
+namespace
+{
+  struct addr2die_producer
+    : public value_producer <value_die>
+  {
+    dwctx_handle m_dwctx;
+    std::vector <Dwarf *> m_dwarfs;
+    std::vector <Dwarf *>::iterator m_it;
+    std::unique_ptr <value_producer <value_die>> m_prod;
+    Dwarf_Addr m_addr;
+    size_t m_i;
+    doneness m_doneness;
+
+    addr2die_producer (dwctx_handle dwctx,
+		       Dwarf_Addr addr, doneness d)
+      : m_dwctx {dwctx}
+      , m_dwarfs {all_dwarfs (*dwctx)}
+      , m_it {m_dwarfs.begin ()}
+      , m_addr {addr}
+      , m_i {0}
+      , m_doneness {d}
+    {}
+
+    std::unique_ptr <value_die>
+    next () override
+    {
+      while (true)
+	{
+	  if (m_prod != nullptr)
+	    if (auto v = m_prod->next ())
+	      {
+		v->set_pos (m_i++);
+		return v;
+	      }
+
+	  if (m_it == m_dwarfs.end ())
+	    return nullptr;
+
+	  Dwarf *dw = *m_it++;
+	  m_prod = std::make_unique
+	    <owning_indexed_die_producer <dwarf_addr_index::die_range>>
+	    (m_dwctx, dw, m_dwctx->addr_index (dw).find (m_addr), m_doneness);
+	}
+    }
+  };
+
+  struct op_addr2die_dwarf_cst
+    : public op_yielding_overload <value_die, value_dwarf, value_cst>
+  {
+    using op_yielding_overload::op_yielding_overload;
+
+    std::unique_ptr <value_producer <value_die>>
+    operate (std::unique_ptr <value_dwarf> a,
+	     std::unique_ptr <value_cst> b) override
+    {
+      auto addr = addressify (b->get_constant ());
+      return std::make_unique <addr2die_producer>
+	(a->get_dwctx (), addr.uval (), a->get_doneness ());
+    }
+
+    static std::string
+    docstring ()
+    {
+      return R"docstring(
+
+Takes a Dwarf and an address, and yields all DIE's whose address
+ranges cover that address, in order of their offsets.  Those would
+typically be the unit, the subprogram, and any inlined subroutines and
+lexical blocks that the address is in::
+
+	$ dwgrep ./a.out -e '0x4004f0 addr2die name'
+	---
+	a.c
+	main
+
+This finds the same DIE's as ``raw entry ?(address 0x4004f0
+?contains)`` would, but uses an index of address ranges, which is
+built the first time it's needed.
+
+)docstring";
+    }
+  };
+}
+
 // ?overlaps
 namespace
 {
@@ -1550,14 +2330,14 @@ namespace
   struct abbrev_producer
     : public value_producer <value_abbrev_unit>
   {
-    std::shared_ptr <dwfl_context> m_dwctx;
+    dwctx_handle m_dwctx;
     std::vector <Dwarf *> m_dwarfs;
     std::vector <Dwarf *>::iterator m_it;
     cu_iterator m_cuit;
     size_t m_i;
 
-    abbrev_producer (std::shared_ptr <dwfl_context> dwctx)
-      : m_dwctx {(assert (dwctx != nullptr), dwctx)}
+    abbrev_producer (dwctx_handle dwctx)
+      : m_dwctx {(assert (dwctx.get () != nullptr), dwctx)}
       , m_dwarfs {all_dwarfs (*dwctx)}
       , m_it {m_dwarfs.begin ()}
       , m_cuit {cu_iterator::end ()}
@@ -1608,14 +2388,13 @@ namespace
     std::unique_ptr <value_abbrev>
     operate (std::unique_ptr <value_die> a) override
     {
-      // If the DIE doesn't have an abbreviation yet, force its
-      // look-up.
-      if (a->get_die ().abbrev == nullptr)
-	dwarf_haschildren (&a->get_die ());
-      assert (a->get_die ().abbrev != nullptr);
+      // DIE values don't keep the abbreviation, force its look-up.
+      Dwarf_Die die = a->get_die ();
+      dwarf_haschildren (&die);
+      assert (die.abbrev != nullptr);
 
       return std::make_unique <value_abbrev>
-	(a->get_dwctx (), *a->get_die ().abbrev, 0);
+	(a->get_dwctx (), *die.abbrev, 0);
     }
   };
 }
@@ -1631,7 +2410,8 @@ namespace
     pred_result
     result (value_die &a) override
     {
-      return pred_result (dwarf_haschildren (&a.get_die ()));
+      Dwarf_Die die = a.get_die ();
+      return pred_result (dwarf_haschildren (&die));
     }
   };
 
@@ -1713,21 +2493,25 @@ namespace
     std::unique_ptr <value_str>
     operate (std::unique_ptr <value_die> a) override
     {
+      Dwarf_Die die = a->get_die ();
       if (a->is_cooked ())
 	{
 	  // On cooked DIE's, `name` integrates.
-	  const char *name = dwarf_diename (&a->get_die ());
+	  const char *name = dwarf_diename (&die);
 	  if (name != nullptr)
-	    return std::make_unique <value_str> (name, 0);
+	    return std::make_unique <value_str> (*a->get_dwctx (), name, 0);
 	  else
 	    return nullptr;
 	}
       // Unfortunately there's no non-integrating dwarf_diename
       // counterpart.
-      else if (dwarf_hasattr (&a->get_die (), DW_AT_name))
+      else if (dwarf_hasattr (&die, DW_AT_name))
 	{
-	  Dwarf_Attribute attr = dwpp_attr (a->get_die (), DW_AT_name);
-	  return std::make_unique <value_str> (dwpp_formstring (attr), 0);
+	  Dwarf_Attribute attr = dwpp_attr (die, DW_AT_name);
+	  char const *name = dwarf_formstring (&attr);
+	  if (name == nullptr)
+	    throw_libdw ();
+	  return std::make_unique <value_str> (*a->get_dwctx (), name, 0);
 	}
       else
 	return nullptr;
@@ -1850,8 +2634,40 @@ namespace
 // @AT_*
 namespace
 {
+  // Look up ATNAME among attributes that N integrates.
+  bool
+  find_integrated_attribute (integrated_die const &n, int atname,
+			     Dwarf_Attribute *ret)
+  {
+    for (auto const &at: n.m_attrs)
+      if (at.code == (unsigned) atname)
+	{
+	  if (ret != nullptr)
+	    *ret = at;
+	  return true;
+	}
+
+    auto recursively_find_at = [&] (int atname2)
+      {
+	size_t ref = 0;
+	for (auto const &at: n.m_attrs)
+	  if (at.code == (unsigned) atname2)
+	    // References that close a cycle have no node.
+	    return n.m_refs[ref] != nullptr
+	      && find_integrated_attribute (*n.m_refs[ref], atname, ret);
+	  else if (at.code == DW_AT_specification
+		   || at.code == DW_AT_abstract_origin)
+	    ++ref;
+	return false;
+      };
+
+    return recursively_find_at (DW_AT_specification)
+      || recursively_find_at (DW_AT_abstract_origin);
+  }
+
   bool
-  find_attribute (Dwarf_Die a, int atname, doneness d, Dwarf_Attribute *ret)
+  find_attribute (dwfl_context &dwctx, Dwarf_Die a, int atname,
+		  doneness d, Dwarf_Attribute *ret)
   {
     if (dwarf_hasattr (&a, atname))
       {
@@ -1861,12 +2677,16 @@ namespace
       }
     else if (d == doneness::cooked && attr_should_be_integrated (atname))
       {
+	// Chains of referred-to DIE's are taken from the integration
+	// cache, so that they aren't decoded anew for each DIE that
+	// refers to them.
 	auto recursively_find_at = [&] (int atname2)
 	  {
 	    if (dwarf_hasattr (&a, atname2))
 	      {
 		Dwarf_Attribute at = dwpp_attr (a, atname2);
-		return find_attribute (dwpp_formref_die (at), atname, d, ret);
+		auto node = dwctx.integrated (dwpp_formref_die (at));
+		return find_integrated_attribute (*node, atname, ret);
 	      }
 	    else
 	      return false;
@@ -1894,12 +2714,24 @@ namespace
     operate (std::unique_ptr <value_die> a)
     {
       Dwarf_Attribute attr;
-      if (! find_attribute (a->get_die (), m_atname,
+      if (! find_attribute (*a->get_dwctx (), a->get_die (), m_atname,
 			    a->get_doneness (), &attr))
 	return nullptr;
 
       return at_value (a->get_dwctx (), a->get_die (), attr);
     }
+
+    bool
+    operate_single (std::unique_ptr <value> &ret, value_die &a) override
+    {
+      Dwarf_Attribute attr;
+      if (! find_attribute (*a.get_dwctx (), a.get_die (), m_atname,
+			    a.get_doneness (), &attr))
+	return true;
+
+      ret = at_single_value (a.get_dwctx (), a.get_die (), attr);
+      return ret != nullptr;
+    }
   };
 }
 
@@ -1918,7 +2750,7 @@ namespace
     pred_result
     result (value_die &a) override
     {
-      return find_attribute (a.get_die (), m_atname,
+      return find_attribute (*a.get_dwctx (), a.get_die (), m_atname,
 			     a.get_doneness (), nullptr)
 	? pred_result::yes : pred_result::no;
     }
@@ -2015,7 +2847,8 @@ namespace
     pred_result
     result (value_die &a) override
     {
-      return pred_result (dwarf_tag (&a.get_die ()) == m_tag);
+      Dwarf_Die die = a.get_die ();
+      return pred_result (dwarf_tag (&die) == m_tag);
     }
   };
 
@@ -2205,7 +3038,10 @@ dwgrep_vocabulary_dw ()
     t->add_op_overload <op_entry_cu> ();
     t->add_op_overload <op_entry_abbrev_unit> ();
 
-    voc.add (std::make_shared <overloaded_op_builtin> ("entry", t));
+    voc.add (std::make_shared <reducible_op_builtin>
+	     ("entry", t, std::vector <reduction_point>
+			  {reduce_entry_tag, reduce_entry_name,
+			   reduce_entry_address, reduce_entry_offset}));
   }
 
   {
@@ -2214,7 +3050,9 @@ dwgrep_vocabulary_dw ()
     t->add_op_overload <op_attribute_die> ();
     t->add_op_overload <op_attribute_abbrev> ();
 
-    voc.add (std::make_shared <overloaded_op_builtin> ("attribute", t));
+    voc.add (std::make_shared <reducible_op_builtin>
+	     ("attribute", t, std::vector <reduction_point>
+			      {reduce_attribute}));
   }
 
   {
@@ -2240,7 +3078,8 @@ dwgrep_vocabulary_dw ()
 
     t->add_op_overload <op_child_die> ();
 
-    voc.add (std::make_shared <overloaded_op_builtin> ("child", t));
+    voc.add (std::make_shared <reducible_op_builtin>
+	     ("child", t, std::vector <reduction_point> {reduce_child}));
   }
 
   {
@@ -2395,6 +3234,14 @@ dwgrep_vocabulary_dw ()
       (std::make_shared <overloaded_pred_builtin> ("!contains", t, false));
   }
 
+  {
+    auto t = std::make_shared <overload_tab> ();
+
+    t->add_op_overload <op_addr2die_dwarf_cst> ();
+
+    voc.add (std::make_shared <overloaded_op_builtin> ("addr2die", t));
+  }
+
   {
     auto t = std::make_shared <overload_tab> ();
 
@@ -2521,8 +3368,8 @@ dwgrep_vocabulary_dw ()
 	t->add_op_overload <op_atval_die> (code);
 	// xxx raw shouldn't interpret values
 
-	voc.add (std::make_shared <overloaded_op_builtin> (atname, t));
-	voc.add (std::make_shared <overloaded_op_builtin> (latname, t));
+	voc.add (std::make_shared <atval_builtin> (atname, t, code));
+	voc.add (std::make_shared <atval_builtin> (latname, t, code));
       }
 
       // DW_AT_*
@@ -2545,9 +3392,9 @@ dwgrep_vocabulary_dw ()
       t->add_pred_overload <pred_tag_abbrev> (code);
       t->add_pred_overload <pred_tag_cst> (code);
 
-      voc.add (std::make_shared <overloaded_pred_builtin> (qname, t, true));
+      voc.add (std::make_shared <tag_pred_builtin> (qname, t, true, code));
       voc.add (std::make_shared <overloaded_pred_builtin> (bname, t, false));
-      voc.add (std::make_shared <overloaded_pred_builtin> (lqname, t, true));
+      voc.add (std::make_shared <tag_pred_builtin> (lqname, t, true, code));
       voc.add (std::make_shared <overloaded_pred_builtin> (lbname, t, false));
 
       add_builtin_constant (voc, constant (code, &dw_tag_dom ()), lqname + 1);
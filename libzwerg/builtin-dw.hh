@@ -30,8 +30,27 @@
 #define _BUILTIN_DW_H_
 
 #include <memory>
+#include <vector>
+
+#include "dwit.hh"
+#include "value-dw.hh"
 
 struct vocabulary;
 std::unique_ptr <vocabulary> dwgrep_vocabulary_dw ();
 
+// Main Dwarf's of all modules of DWCTX, each followed by its alt
+// file, if any.
+std::vector <Dwarf *> all_dwarfs (dwfl_context &dwctx);
+
+// Move CUIT to the next Dwarf from the range [IT, END) if it's
+// exhausted.  Returns false when there are no more Dwarf's to look
+// at.
+bool maybe_next_dwarf (cu_iterator &cuit,
+		       std::vector <Dwarf *>::iterator &it,
+		       std::vector <Dwarf *>::iterator const end);
+
+// Skip units that shouldn't be visible in doneness D.  Returns false
+// if IT was exhausted in the process.
+bool next_acceptable_unit (doneness d, cu_iterator &it);
+
 #endif /* _BUILTIN_DW_H_ */
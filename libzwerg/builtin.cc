@@ -26,6 +26,7 @@
    the GNU Lesser General Public License along with this program.  If
    not, see <http://www.gnu.org/licenses/>.  */
 
+#include <cstring>
 #include <memory>
 #include <map>
 #include <set>
@@ -33,7 +34,9 @@
 #include "builtin.hh"
 #include "builtin-cst.hh"
 #include "op.hh"
+#include "stack.hh"
 #include "overload.hh"
+#include "tree.hh"
 #include "value-cst.hh"
 
 std::unique_ptr <pred>
@@ -48,6 +51,13 @@ builtin::build_exec (std::shared_ptr <op> upstream) const
   return nullptr;
 }
 
+std::shared_ptr <op>
+builtin::build_exec_fused (std::shared_ptr <op> upstream,
+			   tree const &next) const
+{
+  return nullptr;
+}
+
 std::string
 builtin::docstring () const
 {
@@ -60,6 +70,134 @@ builtin::protomap () const
   return {};
 }
 
+stack_types::stack_types (stack const &stk)
+{
+  for (size_t i = stk.size (); i-- > 0; )
+    push (stk.get (i).get_type ());
+}
+
+value_type
+stack_types::at (size_t depth) const
+{
+  if (depth >= m_types.size ())
+    return unknown ();
+  return *(m_types.rbegin () + depth);
+}
+
+void
+stack_types::pop (size_t n)
+{
+  if (n > m_types.size ())
+    forget ();
+  else
+    m_types.erase (m_types.end () - n, m_types.end ());
+}
+
+bool
+stack_types::apply (builtin_protomap const &pm)
+{
+  auto is_pred = [] (builtin_prototype const &proto)
+    {
+      return std::get <1> (proto) == yield::pred;
+    };
+
+  for (auto const &proto: pm)
+    if (is_pred (proto) != is_pred (pm.front ())
+	|| std::get <0> (proto).size () != std::get <0> (pm.front ()).size ()
+	|| std::get <2> (proto) != std::get <2> (pm.front ()))
+      {
+	forget ();
+	return false;
+      }
+
+  if (pm.empty ())
+    {
+      forget ();
+      return false;
+    }
+
+  // Predicates leave the stack alone.
+  if (is_pred (pm.front ()))
+    return true;
+
+  pop (std::get <0> (pm.front ()).size ());
+  for (auto vt: std::get <2> (pm.front ()))
+    // Words that yield values of various types declare them as T_???.
+    push (vt == value::vtype ? unknown () : vt);
+  return true;
+}
+
+stack_types
+stack_types::join (std::vector <stack_types> const &branches)
+{
+  for (auto const &types: branches)
+    if (! (types == branches.front ()))
+      return stack_types {};
+  return branches.empty () ? stack_types {} : branches.front ();
+}
+
+bool
+match_word_eq_const (tree const &next, char const *name, constant &cst)
+{
+  if (next.tt () != tree_type::ASSERT)
+    return false;
+
+  // ?(X) is the same as X when X is a lone assertion.
+  tree const *cmp = &next.child (0);
+  if (cmp->tt () == tree_type::PRED_SUBX_ANY
+      && cmp->child (0).tt () == tree_type::ASSERT)
+    cmp = &cmp->child (0).child (0);
+
+  if (cmp->tt () != tree_type::PRED_SUBX_CMP
+      || cmp->child (2).tt () != tree_type::F_BUILTIN
+      || strcmp (cmp->child (2).m_builtin->name (), "?eq") != 0)
+    return false;
+
+  auto is_word = [name] (tree const &t)
+    {
+      return t.tt () == tree_type::F_BUILTIN
+	&& strcmp (t.m_builtin->name (), name) == 0;
+    };
+
+  auto literal = [] (tree const &t, constant &ret)
+    {
+      if (t.tt () == tree_type::CONST)
+	{
+	  ret = t.cst ();
+	  return true;
+	}
+
+      if (t.tt () == tree_type::F_BUILTIN)
+	if (auto bc = dynamic_cast <builtin_constant const *>
+				(t.m_builtin.get ()))
+	  if (auto vc = value::as <value_cst> (&bc->get_value ()))
+	    {
+	      ret = vc->get_constant ();
+	      return true;
+	    }
+
+      return false;
+    };
+
+  for (size_t i = 0; i < 2; ++i)
+    if (is_word (cmp->child (i)) && literal (cmp->child (1 - i), cst))
+      return true;
+
+  return false;
+}
+
+bool
+match_word_eq_index (tree const &next, char const *name, uint64_t &idx)
+{
+  constant cst;
+  if (! match_word_eq_const (next, name, cst)
+      || ! cst.dom ()->safe_arith () || cst.value () < 0)
+    return false;
+
+  idx = cst.value ().uval ();
+  return true;
+}
+
 std::unique_ptr <pred>
 maybe_invert (std::unique_ptr <pred> pred, bool positive)
 {
@@ -39,6 +39,7 @@
 
 struct pred;
 struct op;
+struct tree;
 
 enum class yield
   {
@@ -65,6 +66,62 @@ using builtin_prototype = std::tuple <std::vector <value_type>, yield,
 				      std::vector <value_type>>;
 using builtin_protomap = std::vector <builtin_prototype>;
 
+class stack;
+
+// Static approximation of stacks that flow through some point of a
+// query, used to pick overloads at build time.  It tracks types of
+// values near TOS.  Nothing is known about values below those.
+class stack_types
+{
+  // TOS is last.  unknown () stands for a value whose type is not
+  // known.
+  std::vector <value_type> m_types;
+
+public:
+  // Nothing is known.
+  stack_types () = default;
+
+  // Exactly the types of values on STK.
+  explicit stack_types (stack const &stk);
+
+  static value_type
+  unknown ()
+  {
+    return value_type {0};
+  }
+
+  // Type of value at DEPTH below TOS, or unknown ().
+  value_type at (size_t depth) const;
+
+  void
+  push (value_type vt)
+  {
+    m_types.push_back (vt);
+  }
+
+  void pop (size_t n);
+
+  void
+  forget ()
+  {
+    m_types.clear ();
+  }
+
+  // Apply stack effect described by PM.  If PM is empty, or its
+  // prototypes disagree about the effect, forget everything and
+  // return false.
+  bool apply (builtin_protomap const &pm);
+
+  // Types of stacks that may come from any of BRANCHES.
+  static stack_types join (std::vector <stack_types> const &branches);
+
+  bool
+  operator== (stack_types const &that) const
+  {
+    return m_types == that.m_types;
+  }
+};
+
 class builtin
 {
 public:
@@ -74,12 +131,33 @@ public:
   virtual std::shared_ptr <op>
   build_exec (std::shared_ptr <op> upstream) const;
 
+  // Strength reduction.  When this builtin is immediately followed
+  // by expression NEXT in a concatenation, it is offered a chance to
+  // build a single op that computes both, e.g. by consulting an
+  // index instead of producing values that NEXT would filter out.
+  // nullptr (which is what the default implementation returns) means
+  // there is no such op, and the two are built separately.
+  virtual std::shared_ptr <op>
+  build_exec_fused (std::shared_ptr <op> upstream, tree const &next) const;
+
   virtual char const *name () const = 0;
 
   virtual std::string docstring () const;
   virtual builtin_protomap protomap () const;
 };
 
+// Recognize NEXT as an assertion that the value computed by the word
+// called NAME equals a constant, i.e. as (NAME == CST), (CST == NAME)
+// or ?(NAME == CST).  Builtin constants (such as DW_AT_name) count
+// as constants, too.  On success, store the constant to CST.
+bool match_word_eq_const (tree const &next, char const *name,
+			  constant &cst);
+
+// Likewise, but the constant needs to be a non-negative number that
+// compares to offsets and positions by value.  Store it to IDX.
+bool match_word_eq_index (tree const &next, char const *name,
+			  uint64_t &idx);
+
 // Return either PRED, or PRED_NOT(PRED), depending on POSITIVE.
 std::unique_ptr <pred> maybe_invert (std::unique_ptr <pred> pred,
 				     bool positive);
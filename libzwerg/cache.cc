@@ -28,92 +28,681 @@
 
 #include <cassert>
 #include <algorithm>
+#include <cstring>
+#include <functional>
 #include <memory>
+#include <stdexcept>
 
 #include "cache.hh"
 #include "dwpp.hh"
 #include "dwit.hh"
+#include "index-cache.hh"
 
-void
-parent_cache::recursively_populate_unit (unit_cache_t &uc, Dwarf_Die die,
-					 Dwarf_Off paroff)
+parent_cache::parent_cache (index_cache *idxcache)
+  : m_idxcache {idxcache}
 {
-  while (true)
+  for (auto &slot: m_slots)
+    slot.store (nullptr);
+}
+
+parent_cache::dwarf_index
+parent_cache::build_index (Dwarf *dw)
+{
+  dwarf_index idx;
+  idx.m_dw = dw;
+  auto &offsets = idx.m_own_offsets;
+  auto &parents = idx.m_own_parents;
+
+  // Ancestors of the DIE currently visited, together with their
+  // positions in the index.
+  std::vector <std::pair <Dwarf_Die, uint32_t>> stack;
+
+  for (auto it = cu_iterator { dw }; it != cu_iterator::end (); ++it)
     {
-      Dwarf_Off off = dwarf_dieoffset (&die);
-      uc.push_back (std::make_pair (off, paroff));
+      Dwarf_Die die = **it;
+      while (true)
+	{
+	  assert (offsets.size () < no_parent);
+	  uint32_t pos = offsets.size ();
+	  offsets.push_back (dwarf_dieoffset (&die));
+	  parents.push_back (stack.empty ()
+			     ? no_parent : stack.back ().second);
+
+	  Dwarf_Die child;
+	  if (dwpp_child (die, child))
+	    {
+	      stack.push_back (std::make_pair (die, pos));
+	      die = child;
+	      continue;
+	    }
+
+	  // Find the next sibling of this DIE, or of its closest
+	  // ancestor that has one.
+	  while (! dwpp_siblingof (die, die) && ! stack.empty ())
+	    {
+	      die = stack.back ().first;
+	      stack.pop_back ();
+	    }
+
+	  if (stack.empty ())
+	    break;
+	}
+    }
 
+  // Pre-order traversal visits DIE's in order of their offsets,
+  // which the binary search in find relies on.
+  assert (std::is_sorted (offsets.begin (), offsets.end ()));
+
+  idx.m_offsets = offsets.data ();
+  idx.m_parents = parents.data ();
+  idx.m_ndies = offsets.size ();
+  return idx;
+}
+
+parent_cache::dwarf_index
+parent_cache::load_index (Dwarf *dw)
+{
+  if (m_idxcache != nullptr)
+    if (auto stored = m_idxcache->find (dw))
       {
-	Dwarf_Die child;
-	if (dwpp_child (die, child))
-	  recursively_populate_unit (uc, child, off);
+	dwarf_index idx;
+	idx.m_dw = dw;
+	idx.m_offsets = stored->m_offsets;
+	idx.m_parents = stored->m_parents;
+	idx.m_ndies = stored->m_ndies;
+	idx.m_stored = stored;
+	return idx;
       }
 
-      switch (dwarf_siblingof (&die, &die))
+  dwarf_index idx = build_index (dw);
+  if (m_idxcache != nullptr)
+    m_idxcache->store (dw, idx.m_offsets, idx.m_parents, idx.m_ndies);
+  return idx;
+}
+
+parent_cache::dwarf_index const &
+parent_cache::get_index (Dwarf *dw)
+{
+  for (auto &slot: m_slots)
+    {
+      dwarf_index const *idx = slot.load (std::memory_order_acquire);
+      if (idx == nullptr)
+	break;
+      if (idx->m_dw == dw)
+	return *idx;
+    }
+
+  dwarf_index const &idx = m_indices.get
+    (dw, std::hash <Dwarf *> {} (dw), [&] () { return load_index (dw); });
+
+  // Slots are filled in order, so the lookup above can stop at the
+  // first empty one.
+  for (auto &slot: m_slots)
+    {
+      dwarf_index const *expected = nullptr;
+      if (slot.compare_exchange_strong (expected, &idx,
+					std::memory_order_acq_rel)
+	  || expected == &idx)
+	break;
+    }
+
+  return idx;
+}
+
+Dwarf_Off
+parent_cache::find (Dwarf_Die die)
+{
+  dwarf_index const &idx = get_index (dwarf_cu_getdwarf (die.cu));
+
+  Dwarf_Off dieoff = dwarf_dieoffset (&die);
+  Dwarf_Off const *end = idx.m_offsets + idx.m_ndies;
+  Dwarf_Off const *it = std::lower_bound (idx.m_offsets, end, dieoff);
+
+  // An index loaded from a cache file that went stale doesn't have
+  // to know all DIE's.
+  if (it == end || *it != dieoff)
+    throw std::runtime_error ("DIE index doesn't match the Dwarf");
+
+  uint32_t par = idx.m_parents[it - idx.m_offsets];
+  return par == no_parent ? no_off : idx.m_offsets[par];
+}
+
+
+std::pair <unit_tag_index::tagged_die const *,
+	   unit_tag_index::tagged_die const *>
+unit_tag_index::find (int tag) const
+{
+  tagged_die key {tag, 0, 0};
+  return std::equal_range (m_begin, m_end, key);
+}
+
+tag_cache::tag_cache (index_cache *idxcache)
+  : m_idxcache {idxcache}
+{}
+
+unit_tag_index
+tag_cache::build_index (Dwarf_Die cudie)
+{
+  unit_tag_index idx;
+  idx.m_has_imports = false;
+
+  Dwarf *dw = dwarf_cu_getdwarf (cudie.cu);
+  cu_iterator cuit {dw, cudie};
+  all_dies_iterator it (cuit);
+  all_dies_iterator end (++cuit);
+
+  auto &dies = idx.m_own_dies;
+  for (uint32_t pos = 0; it != end; ++it, ++pos)
+    {
+      int tag = dwarf_tag (*it);
+      if (tag == DW_TAG_imported_unit)
+	idx.m_has_imports = true;
+      dies.push_back ({tag, pos, dwarf_dieoffset (*it)});
+    }
+
+  std::stable_sort (dies.begin (), dies.end ());
+  idx.m_begin = dies.data ();
+  idx.m_end = dies.data () + dies.size ();
+  return idx;
+}
+
+tag_cache::dwarf_indices
+tag_cache::load_indices (Dwarf *dw)
+{
+  dwarf_indices ret;
+  if (auto stored = m_idxcache->find_tags (dw))
+    {
+      uint64_t begin = 0;
+      for (size_t i = 0; i < stored->m_nunits; ++i)
 	{
-	case 0:
-	  break;
-	case -1:
-	  throw_libdw ();
-	case 1:
-	  return;
+	  auto const &u = stored->m_units[i];
+	  unit_tag_index &idx = ret[u.m_offset];
+	  idx.m_begin = stored->m_dies + begin;
+	  idx.m_end = stored->m_dies + u.m_end;
+	  idx.m_stored = stored->m_mapping;
+	  idx.m_has_imports = u.m_has_imports != 0;
+	  begin = u.m_end;
 	}
+      return ret;
     }
+
+  for (auto it = cu_iterator { dw }; it != cu_iterator::end (); ++it)
+    ret.insert (std::make_pair (dwarf_dieoffset (*it), build_index (**it)));
+
+  m_idxcache->store_tags (dw, ret);
+  return ret;
 }
 
-parent_cache::unit_cache_t
-parent_cache::populate_unit (Dwarf_Die die)
+unit_tag_index const &
+tag_cache::get_index (Dwarf_Die cudie)
 {
-  unit_cache_t uc;
-  recursively_populate_unit (uc, die, no_off);
-  return uc;
+  if (m_idxcache != nullptr && m_idxcache->enabled ())
+    {
+      Dwarf *dw = dwarf_cu_getdwarf (cudie.cu);
+      dwarf_indices const &indices = m_dwarf_indices.get
+	(dw, std::hash <Dwarf *> {} (dw), [&] () { return load_indices (dw); });
+
+      // A stale cache file doesn't have to know all units.  Such
+      // units get an index of their own below.
+      auto it = indices.find (dwarf_dieoffset (&cudie));
+      if (it != indices.end ())
+	return it->second;
+    }
+
+  return m_indices.get (cudie.cu, std::hash <Dwarf_CU *> {} (cudie.cu),
+			[&] () { return build_index (cudie); });
 }
 
-Dwarf_Off
-parent_cache::find (Dwarf_Die die)
+std::pair <dwarf_name_index::named_die const *,
+	   dwarf_name_index::named_die const *>
+dwarf_name_index::find (std::string const &name, Dwarf_Off cu_offset) const
 {
-  Dwarf_Die cudie;
-  if (dwarf_diecu (&die, &cudie, nullptr, nullptr) == nullptr)
-    throw_libdw ();
+  std::pair <named_die const *, named_die const *> dies;
+  if (m_stored != nullptr)
+    dies = m_stored->find (name);
+  else
+    {
+      auto it = m_dies.find (name);
+      if (it == m_dies.end ())
+	return std::make_pair (nullptr, nullptr);
+      dies = std::make_pair (it->second.data (),
+			     it->second.data () + it->second.size ());
+    }
 
-  Dwarf_Off cuoff = dwarf_dieoffset (&cudie);
-  Dwarf *dw = dwarf_cu_getdwarf (die.cu);
-  auto key = std::make_pair (dw, cuoff);
+  // Offsets of DIE's grow together with offsets of their units.
+  return std::equal_range
+    (dies.first, dies.second, named_die {cu_offset, 0, 0},
+     [] (named_die const &a, named_die const &b)
+     { return a.m_cu_offset < b.m_cu_offset; });
+}
 
-  auto it = m_cache.find (key);
-  if (it == m_cache.end ())
-    it = m_cache.insert (std::make_pair (key, populate_unit (cudie))).first;
+bool
+importing_units::has_imports (Dwarf_Off cu_offset) const
+{
+  return std::binary_search (m_units.begin (), m_units.end (), cu_offset);
+}
 
-  Dwarf_Off dieoff = dwarf_dieoffset (&die);
-  auto jt = std::lower_bound
-    (it->second.begin (), it->second.end (), dieoff,
-     [] (std::pair <Dwarf_Off, Dwarf_Off> const &a, Dwarf_Off b)
-     {
-       return a.first < b;
-     });
+namespace
+{
+  char const *
+  find_name (Dwarf_Die die, bool cooked)
+  {
+    Dwarf_Attribute at;
+    if (dwarf_attr (&die, DW_AT_name, &at) != nullptr)
+      return dwarf_formstring (&at);
+
+    if (cooked)
+      for (int atname: {DW_AT_specification, DW_AT_abstract_origin})
+	{
+	  Dwarf_Die ref;
+	  if (dwarf_attr (&die, atname, &at) != nullptr
+	      && dwarf_formref_die (&at, &ref) != nullptr)
+	    if (char const *name = find_name (ref, cooked))
+	      return name;
+	}
+
+    return nullptr;
+  }
+}
+
+name_cache::name_cache (index_cache *idxcache)
+  : m_idxcache {idxcache}
+{}
+
+dwarf_name_index
+name_cache::build_index (Dwarf *dw, bool cooked)
+{
+  dwarf_name_index idx;
+
+  for (auto cuit = cu_iterator { dw }; cuit != cu_iterator::end (); )
+    {
+      Dwarf_Off cu_offset = dwarf_dieoffset (*cuit);
+      all_dies_iterator it (cuit);
+      all_dies_iterator end (++cuit);
+
+      bool has_imports = false;
+      for (uint32_t pos = 0; it != end; ++it, ++pos)
+	{
+	  if (dwarf_tag (*it) == DW_TAG_imported_unit)
+	    has_imports = true;
+	  if (char const *name = find_name (**it, cooked))
+	    idx.m_dies[name].push_back ({cu_offset, dwarf_dieoffset (*it), pos});
+	}
+
+      if (has_imports)
+	idx.m_importing.m_units.push_back (cu_offset);
+    }
+
+  return idx;
+}
+
+dwarf_name_index
+name_cache::load_index (Dwarf *dw, bool cooked)
+{
+  if (m_idxcache != nullptr)
+    if (auto stored = m_idxcache->find_names (dw, cooked))
+      {
+	dwarf_name_index idx;
+	idx.m_stored = stored;
+	idx.m_importing.m_units.assign
+	  (stored->m_importing, stored->m_importing + stored->m_nimporting);
+	return idx;
+      }
+
+  dwarf_name_index idx = build_index (dw, cooked);
+  if (m_idxcache != nullptr)
+    m_idxcache->store_names (dw, cooked, idx);
+  return idx;
+}
+
+dwarf_name_index const &
+name_cache::get_index (Dwarf *dw, bool cooked)
+{
+  return m_indices.get (std::make_pair (dw, cooked),
+			std::hash <Dwarf *> {} (dw) + cooked,
+			[&] () { return load_index (dw, cooked); });
+}
+
+void
+dwarf_addr_index::range_list::finish ()
+{
+  std::stable_sort (m_ranges.begin (), m_ranges.end (),
+		    [] (die_range const &a, die_range const &b)
+		    { return a.m_low < b.m_low; });
+
+  m_max_high.reserve (m_ranges.size ());
+  for (auto const &r: m_ranges)
+    m_max_high.push_back (m_max_high.empty () ? r.m_high
+			  : std::max (m_max_high.back (), r.m_high));
+}
+
+void
+dwarf_addr_index::range_list::find (Dwarf_Addr addr,
+				    std::vector <die_range> &ret) const
+{
+  // Ranges past this one start above ADDR.
+  size_t i = std::upper_bound (m_ranges.begin (), m_ranges.end (), addr,
+			       [] (Dwarf_Addr a, die_range const &r)
+			       { return a < r.m_low; })
+    - m_ranges.begin ();
+
+  while (i-- > 0 && m_max_high[i] > addr)
+    if (m_ranges[i].m_high > addr)
+      ret.push_back (m_ranges[i]);
+}
+
+std::vector <dwarf_addr_index::die_range>
+dwarf_addr_index::find (Dwarf_Addr addr) const
+{
+  std::vector <die_range> ret;
+  m_units.find (addr, ret);
+  m_dies.find (addr, ret);
+
+  // A DIE with several ranges could have been found more than once.
+  auto by_offset = [] (die_range const &a, die_range const &b)
+    { return a.m_offset < b.m_offset; };
+  std::sort (ret.begin (), ret.end (), by_offset);
+  ret.erase (std::unique (ret.begin (), ret.end (),
+			  [] (die_range const &a, die_range const &b)
+			  { return a.m_offset == b.m_offset; }),
+	     ret.end ());
+  return ret;
+}
+
+dwarf_addr_index
+addr_cache::build_index (Dwarf *dw)
+{
+  dwarf_addr_index idx;
+
+  for (auto cuit = cu_iterator { dw }; cuit != cu_iterator::end (); )
+    {
+      Dwarf_Off cu_offset = dwarf_dieoffset (*cuit);
+      all_dies_iterator it (cuit);
+      all_dies_iterator end (++cuit);
+
+      bool has_imports = false;
+      for (uint32_t pos = 0; it != end; ++it, ++pos)
+	{
+	  Dwarf_Die *die = *it;
+	  if (dwarf_tag (die) == DW_TAG_imported_unit)
+	    has_imports = true;
+
+	  if (! dwarf_hasattr (die, DW_AT_low_pc)
+	      && ! dwarf_hasattr (die, DW_AT_ranges))
+	    continue;
+
+	  auto &list = pos == 0 ? idx.m_units : idx.m_dies;
+	  Dwarf_Addr base, start, end;
+	  for (ptrdiff_t off = 0;
+	       (off = dwarf_ranges (die, off, &base, &start, &end)) > 0; )
+	    if (start < end)
+	      list.m_ranges.push_back ({start, end, cu_offset,
+					dwarf_dieoffset (die), pos});
+	}
+
+      if (has_imports)
+	idx.m_importing.m_units.push_back (cu_offset);
+    }
+
+  idx.m_units.finish ();
+  idx.m_dies.finish ();
+  return idx;
+}
 
-  assert (jt != it->second.end ());
-  assert (jt->first == dieoff);
-  return jt->second;
+dwarf_addr_index const &
+addr_cache::get_index (Dwarf *dw)
+{
+  return m_indices.get (dw, std::hash <Dwarf *> {} (dw),
+			[&] () { return build_index (dw); });
 }
 
+root_cache::root_cache (index_cache *idxcache)
+  : m_idxcache {idxcache}
+{}
 
 bool
 root_cache::is_root (Dwarf_Die die)
 {
   Dwarf *dw = dwarf_cu_getdwarf (die.cu);
-  auto it = m_cache.find (dw);
-  if (it == m_cache.end ())
+  off_vect const &v = m_cache.get
+    (dw, std::hash <Dwarf *> {} (dw), [&] ()
+     {
+       // Populate the cache for this Dwarf.
+       if (m_idxcache != nullptr)
+	 if (auto stored = m_idxcache->find (dw))
+	   return off_vect (stored->m_units,
+			    stored->m_units + stored->m_nunits);
+
+       off_vect v;
+       for (auto jt = cu_iterator { dw }; jt != cu_iterator::end (); ++jt)
+	 v.push_back (dwarf_dieoffset (*jt));
+       return v;
+     });
+
+  Dwarf_Off dieoff = dwarf_dieoffset (&die);
+  auto jt = std::lower_bound (v.begin (), v.end (), dieoff);
+  return jt != v.end () && *jt == dieoff;
+}
+
+integration_cache::integration_cache (size_t max_nodes)
+  : m_shard_max {std::max <size_t> (1, max_nodes / nshards)}
+{}
+
+integration_cache::shard &
+integration_cache::shard_of (void *addr)
+{
+  // Scramble the bits the same way sharded_map does.
+  uint64_t h = (uint64_t) std::hash <void *> {} (addr) * 0x9e3779b97f4a7c15ull;
+  return m_shards[(h >> 32) % nshards];
+}
+
+integration_cache::node_ptr
+integration_cache::find (void *addr)
+{
+  shard &s = shard_of (addr);
+  std::lock_guard <std::mutex> lock {s.m_mutex};
+  auto it = s.m_index.find (addr);
+  if (it == s.m_index.end ())
+    return nullptr;
+
+  s.m_lru.splice (s.m_lru.begin (), s.m_lru, it->second);
+  return it->second->second;
+}
+
+integration_cache::node_ptr
+integration_cache::insert (void *addr, node_ptr node)
+{
+  shard &s = shard_of (addr);
+  std::lock_guard <std::mutex> lock {s.m_mutex};
+
+  // Another thread may have built the same node meanwhile.  Keep
+  // the first one, so that nodes stay shared.
+  auto it = s.m_index.find (addr);
+  if (it != s.m_index.end ())
     {
-      off_vect v;
-      for (auto jt = cu_iterator { dw }; jt != cu_iterator::end (); ++jt)
-	v.push_back (dwarf_dieoffset (*jt));
+      s.m_lru.splice (s.m_lru.begin (), s.m_lru, it->second);
+      return it->second->second;
+    }
 
-      // Populate the cache for this Dwarf.
-      it = m_cache.insert (std::make_pair (dw, std::move (v))).first;
+  s.m_lru.emplace_front (addr, node);
+  s.m_index[addr] = s.m_lru.begin ();
+  if (s.m_lru.size () > m_shard_max)
+    {
+      s.m_index.erase (s.m_lru.back ().first);
+      s.m_lru.pop_back ();
     }
 
-  Dwarf_Off dieoff = dwarf_dieoffset (&die);
-  auto jt = std::lower_bound (it->second.begin (), it->second.end (), dieoff);
-  return jt != it->second.end () && *jt == dieoff;
+  return node;
+}
+
+integration_cache::node_ptr
+integration_cache::get (Dwarf_Die die)
+{
+  if (auto node = find (die.addr))
+    return node;
+
+  // Nodes that are being built, each with the DIE's that it refers
+  // to.  A node is finished once nodes of all those DIE's are
+  // resolved.  Chains of references can be long, so this is done
+  // without recursion.
+  struct pending
+  {
+    std::shared_ptr <integrated_die> m_node;
+    std::vector <Dwarf_Die> m_refs;
+  };
+  std::vector <pending> stack;
+
+  auto push = [&] (Dwarf_Die d)
+    {
+      pending p {std::make_shared <integrated_die> (), {}};
+      p.m_node->m_die = d;
+      for (attr_iterator it {&p.m_node->m_die};
+	   it != attr_iterator::end (); ++it)
+	{
+	  Dwarf_Attribute at = **it;
+	  p.m_node->m_attrs.push_back (at);
+	  if (at.code == DW_AT_specification
+	      || at.code == DW_AT_abstract_origin)
+	    p.m_refs.push_back (dwpp_formref_die (at));
+	}
+      stack.push_back (std::move (p));
+    };
+
+  push (die);
+  while (true)
+    {
+      pending &top = stack.back ();
+      auto &refs = top.m_node->m_refs;
+      if (refs.size () == top.m_refs.size ())
+	{
+	  node_ptr node = insert (top.m_node->m_die.addr, top.m_node);
+	  stack.pop_back ();
+	  if (stack.empty ())
+	    return node;
+	  stack.back ().m_node->m_refs.push_back (node);
+	  continue;
+	}
+
+      Dwarf_Die ref = top.m_refs[refs.size ()];
+      if (auto node = find (ref.addr))
+	refs.push_back (node);
+      else if (std::any_of (stack.begin (), stack.end (),
+			    [&] (pending const &p)
+			    { return p.m_node->m_die.addr == ref.addr; }))
+	refs.push_back (nullptr);
+      else
+	push (ref);
+    }
+}
+
+size_t
+hash_str (char const *str, size_t length)
+{
+  // FNV-1a.
+  uint64_t h = 0xcbf29ce484222325ull;
+  for (size_t i = 0; i < length; ++i)
+    h = (h ^ (unsigned char) str[i]) * 0x100000001b3ull;
+  return h;
+}
+
+namespace
+{
+  size_t
+  addr_hash (char const *addr)
+  {
+    // Scramble the bits, as the low ones of string addresses say
+    // little.
+    return ((uint64_t) (uintptr_t) addr * 0x9e3779b97f4a7c15ull) >> 32;
+  }
+}
+
+str_intern_cache::addr_table::addr_table (size_t nslots)
+  : m_mask {nslots - 1}
+  , m_slots {new addr_slot[nslots] ()}
+  , m_size {0}
+{}
+
+str_intern_cache::str_intern_cache ()
+{
+  m_addr_tables.emplace_back (new addr_table {256});
+  m_by_addr.store (m_addr_tables.back ().get ());
+}
+
+interned_str const *
+str_intern_cache::find_addr (addr_table const &table, char const *str)
+{
+  // Tables are never full, so the probing ends at an empty slot.
+  for (size_t i = addr_hash (str) & table.m_mask;; i = (i + 1) & table.m_mask)
+    {
+      addr_slot const &slot = table.m_slots[i];
+      char const *addr = slot.m_addr.load (std::memory_order_acquire);
+      if (addr == str)
+	return slot.m_entry.load (std::memory_order_relaxed);
+      if (addr == nullptr)
+	return nullptr;
+    }
+}
+
+void
+str_intern_cache::insert_addr (addr_table &table, char const *str,
+			       interned_str const *entry)
+{
+  size_t i = addr_hash (str) & table.m_mask;
+  while (table.m_slots[i].m_addr.load (std::memory_order_relaxed) != nullptr)
+    i = (i + 1) & table.m_mask;
+
+  table.m_slots[i].m_entry.store (entry, std::memory_order_relaxed);
+  table.m_slots[i].m_addr.store (str, std::memory_order_release);
+  ++table.m_size;
+}
+
+void
+str_intern_cache::add_addr (char const *str, interned_str const *entry)
+{
+  addr_table *table = m_by_addr.load (std::memory_order_relaxed);
+  size_t nslots = table->m_mask + 1;
+  if (2 * (table->m_size + 1) > nslots)
+    {
+      std::unique_ptr <addr_table> bigger {new addr_table {2 * nslots}};
+      for (size_t i = 0; i < nslots; ++i)
+	{
+	  addr_slot const &slot = table->m_slots[i];
+	  if (char const *addr = slot.m_addr.load (std::memory_order_relaxed))
+	    insert_addr (*bigger, addr,
+			 slot.m_entry.load (std::memory_order_relaxed));
+	}
+
+      table = bigger.get ();
+      m_addr_tables.push_back (std::move (bigger));
+      m_by_addr.store (table, std::memory_order_release);
+    }
+
+  insert_addr (*table, str, entry);
+}
+
+interned_str const &
+str_intern_cache::intern (char const *str)
+{
+  if (auto entry = find_addr (*m_by_addr.load (std::memory_order_acquire),
+			      str))
+    return *entry;
+
+  size_t length = std::strlen (str);
+  interned_str key {str, length, hash_str (str, length)};
+
+  std::lock_guard <std::mutex> lock {m_mutex};
+  interned_str const &entry = *m_by_content.insert (key).first;
+  if (find_addr (*m_by_addr.load (std::memory_order_relaxed), str) == nullptr)
+    add_addr (str, &entry);
+  return entry;
+}
+
+import_chain const *
+import_chain_cache::get (import_chain const *parent, Dwarf_Die die)
+{
+  auto key = std::make_pair (parent, die.addr);
+  return &m_chains.get (key, std::hash <void *> {} (die.addr), [&] ()
+    {
+      return import_chain {die, parent};
+    });
 }
@@ -29,39 +29,421 @@
 #ifndef _CACHE_H_
 #define _CACHE_H_
 
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <list>
 #include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
 #include <unordered_set>
 #include <memory>
 #include <vector>
 
 #include <elfutils/libdw.h>
 
+class index_cache;
+struct stored_names;
+
+// A map that can be used from several threads at once.  It is split
+// into several independently locked shards, so that threads looking
+// up different keys mostly don't contend.  Values are never changed
+// or removed once inserted, so references to them stay valid without
+// holding any lock.
+template <class K, class V, size_t N = 16>
+class sharded_map
+{
+  struct shard
+  {
+    std::mutex m_mutex;
+    std::map <K, V> m_map;
+  };
+
+  std::array <shard, N> m_shards;
+
+public:
+  // Find value stored under KEY.  If there is none, call POPULATE to
+  // compute one.  That happens without holding the shard lock, so two
+  // threads may end up computing the value at the same time, in which
+  // case the first one to finish wins.  HASH selects the shard.
+  template <class F>
+  V const &
+  get (K const &key, size_t hash, F populate)
+  {
+    // Scramble the bits, as hashes of pointers tend to have low bits
+    // zero.
+    uint64_t h = (uint64_t) hash * 0x9e3779b97f4a7c15ull;
+    shard &s = m_shards[(h >> 32) % N];
+    {
+      std::lock_guard <std::mutex> lock {s.m_mutex};
+      auto it = s.m_map.find (key);
+      if (it != s.m_map.end ())
+	return it->second;
+    }
+
+    V v = populate ();
+
+    std::lock_guard <std::mutex> lock {s.m_mutex};
+    return s.m_map.insert (std::make_pair (key, std::move (v))).first->second;
+  }
+};
+
+// Parent lookups are served from a flat index built for the whole
+// Dwarf in one pass: a sorted array of DIE offsets, and for each DIE
+// the position of its parent in that array.  Looking up a parent is
+// then a single binary search.  When an index_cache is given, the
+// index is loaded from there if possible, and stored there after it
+// was built.
 class parent_cache
 {
-  using unit_cache_t = std::vector <std::pair <Dwarf_Off, Dwarf_Off>>;
-  using cache_t = std::map <std::pair <Dwarf *, Dwarf_Off>, unit_cache_t>;
+  struct dwarf_index
+  {
+    Dwarf *m_dw;
+    Dwarf_Off const *m_offsets;
+    uint32_t const *m_parents;
+    size_t m_ndies;
 
-  cache_t m_cache;
+    // The arrays above point either into these vectors, or into a
+    // mapping of a cache file kept alive by M_STORED.
+    std::vector <Dwarf_Off> m_own_offsets;
+    std::vector <uint32_t> m_own_parents;
+    std::shared_ptr <void const> m_stored;
+  };
+
+  static uint32_t const no_parent = (uint32_t) -1;
+
+  index_cache *m_idxcache;
+  sharded_map <Dwarf *, dwarf_index, 4> m_indices;
+
+  // There are usually just a couple Dwarf's per context (the main
+  // file and its alt file).  Indices for the first few of them are
+  // published here, so that they can be found without locking.
+  std::array <std::atomic <dwarf_index const *>, 4> m_slots;
 
-  void recursively_populate_unit (unit_cache_t &uc, Dwarf_Die die,
-				  Dwarf_Off paroff);
-  unit_cache_t populate_unit (Dwarf_Die die);
+  static dwarf_index build_index (Dwarf *dw);
+  dwarf_index load_index (Dwarf *dw);
+  dwarf_index const &get_index (Dwarf *dw);
 
 public:
   static Dwarf_Off const no_off = (Dwarf_Off) -1;
+
+  explicit parent_cache (index_cache *idxcache = nullptr);
   Dwarf_Off find (Dwarf_Die die);
 };
 
+// Index of DIE's of one unit by their tag.  It holds the same DIE's
+// in the same order as a raw `entry' on that unit would yield them.
+struct unit_tag_index
+{
+  struct tagged_die
+  {
+    int m_tag;
+    uint32_t m_pos;
+    Dwarf_Off m_offset;
+
+    bool operator< (tagged_die const &that) const
+    { return m_tag < that.m_tag; }
+  };
+
+  // Sorted by tag, and within one tag by position.  These point
+  // either into M_OWN_DIES, or into a mapping of a cache file kept
+  // alive by M_STORED.
+  tagged_die const *m_begin;
+  tagged_die const *m_end;
+
+  std::vector <tagged_die> m_own_dies;
+  std::shared_ptr <void const> m_stored;
+
+  // Whether the unit has any DW_TAG_imported_unit DIE's.  Cooked
+  // `entry' inlines the imported partial units, so positions in
+  // the index are only valid for it if this is false.
+  bool m_has_imports;
+
+  std::pair <tagged_die const *, tagged_die const *>
+  find (int tag) const;
+};
+
+// Tag indices are built lazily, for each unit the first time it's
+// asked about.  When an index_cache is given, indices of all units
+// of a Dwarf are instead loaded from there, or built and stored
+// there, the first time any of them is asked about.
+class tag_cache
+{
+  using dwarf_indices = std::map <Dwarf_Off, unit_tag_index>;
+
+  index_cache *m_idxcache;
+  sharded_map <Dwarf_CU *, unit_tag_index> m_indices;
+  sharded_map <Dwarf *, dwarf_indices, 4> m_dwarf_indices;
+
+  static unit_tag_index build_index (Dwarf_Die cudie);
+  dwarf_indices load_indices (Dwarf *dw);
+
+public:
+  explicit tag_cache (index_cache *idxcache = nullptr);
+  unit_tag_index const &get_index (Dwarf_Die cudie);
+};
+
+// CU DIE offsets of units of one Dwarf that have DW_TAG_imported_unit
+// DIE's.  Per-Dwarf indices keep this, because they can't be used for
+// such units in cooked mode.  See unit_tag_index::m_has_imports.
+struct importing_units
+{
+  // In ascending order.
+  std::vector <Dwarf_Off> m_units;
+
+  bool has_imports (Dwarf_Off cu_offset) const;
+};
+
+// Index of DIE's of one Dwarf by their DW_AT_name.  For a cooked
+// index, names are looked up the way cooked @AT_name does it, i.e.
+// also through DW_AT_specification and DW_AT_abstract_origin.
+struct dwarf_name_index
+{
+  struct named_die
+  {
+    Dwarf_Off m_cu_offset;
+    Dwarf_Off m_offset;
+    uint32_t m_pos;
+  };
+
+  // For each name, DIE's with that name in order of their offsets.
+  // Positions are as a raw `entry' on the unit would give them.  An
+  // index loaded from a cache file keeps these in M_STORED instead.
+  std::unordered_map <std::string, std::vector <named_die>> m_dies;
+  std::shared_ptr <stored_names const> m_stored;
+
+  importing_units m_importing;
+
+  // DIE's called NAME in the unit whose CU DIE is at CU_OFFSET.
+  std::pair <named_die const *, named_die const *>
+  find (std::string const &name, Dwarf_Off cu_offset) const;
+};
+
+// When an index_cache is given, name indices are loaded from there
+// if possible, and stored there after they were built.
+class name_cache
+{
+  index_cache *m_idxcache;
+  sharded_map <std::pair <Dwarf *, bool>, dwarf_name_index, 4> m_indices;
+
+  static dwarf_name_index build_index (Dwarf *dw, bool cooked);
+  dwarf_name_index load_index (Dwarf *dw, bool cooked);
+
+public:
+  explicit name_cache (index_cache *idxcache = nullptr);
+  dwarf_name_index const &get_index (Dwarf *dw, bool cooked);
+};
+
+// Index of DIE's of one Dwarf by addresses that they cover, as given
+// by their DW_AT_low_pc, DW_AT_high_pc and DW_AT_ranges.
+struct dwarf_addr_index
+{
+  struct die_range
+  {
+    Dwarf_Addr m_low;
+    Dwarf_Addr m_high;
+    Dwarf_Off m_cu_offset;
+    Dwarf_Off m_offset;
+    uint32_t m_pos;
+  };
+
+  // Ranges sorted by their start address.  For each of them, the
+  // highest end address among it and all ranges before it is kept in
+  // M_MAX_HIGH, which bounds the backward scan for ranges that cover
+  // a given address.
+  struct range_list
+  {
+    std::vector <die_range> m_ranges;
+    std::vector <Dwarf_Addr> m_max_high;
+
+    void finish ();
+    void find (Dwarf_Addr addr, std::vector <die_range> &ret) const;
+  };
+
+  // Unit DIE's tend to span most of the other DIE's, which would make
+  // the scan above long.  They are therefore kept separately.
+  range_list m_units;
+  range_list m_dies;
+
+  importing_units m_importing;
+
+  // DIE's that cover ADDR, in order of their offsets.
+  std::vector <die_range> find (Dwarf_Addr addr) const;
+};
+
+class addr_cache
+{
+  sharded_map <Dwarf *, dwarf_addr_index, 4> m_indices;
+
+  static dwarf_addr_index build_index (Dwarf *dw);
+
+public:
+  dwarf_addr_index const &get_index (Dwarf *dw);
+};
+
 class root_cache
 {
   using off_vect = std::vector <Dwarf_Off>;
-  using cache_t = std::map <Dwarf *, off_vect>;
+  using cache_t = sharded_map <Dwarf *, off_vect, 4>;
 
+  index_cache *m_idxcache;
   cache_t m_cache;
 
 public:
+  explicit root_cache (index_cache *idxcache = nullptr);
   bool is_root (Dwarf_Die die);
 };
 
+// Cooked attribute lookups integrate into a DIE attributes of DIE's
+// that it refers to through DW_AT_specification and
+// DW_AT_abstract_origin, and of DIE's that those refer to in turn.
+// Many DIE's (e.g. all inlined instances of a function) refer to the
+// same few declarations, so the attributes of referred-to DIE's are
+// decoded once and kept here, together with the resolved references.
+//
+// Nodes are built lazily, the first time a DIE is referred to.  At
+// most MAX_NODES of them are kept, and the least recently used ones
+// are dropped to make room for new ones.  Nodes that are in use stay
+// alive until they are released.
+struct integrated_die
+{
+  Dwarf_Die m_die;
+
+  // All attributes of M_DIE, in order.
+  std::vector <Dwarf_Attribute> m_attrs;
+
+  // Nodes of DIE's that DW_AT_specification and DW_AT_abstract_origin
+  // attributes in M_ATTRS refer to, in the same order.  A reference
+  // that would close a cycle is null.
+  std::vector <std::shared_ptr <integrated_die const>> m_refs;
+};
+
+class integration_cache
+{
+  using node_ptr = std::shared_ptr <integrated_die const>;
+  using lru_list = std::list <std::pair <void *, node_ptr>>;
+
+  static size_t const nshards = 16;
+
+  // Each shard keeps its nodes most recently used first.
+  struct shard
+  {
+    std::mutex m_mutex;
+    lru_list m_lru;
+    std::unordered_map <void *, lru_list::iterator> m_index;
+  };
+
+  std::array <shard, nshards> m_shards;
+  size_t m_shard_max;
+
+  shard &shard_of (void *addr);
+  node_ptr find (void *addr);
+  node_ptr insert (void *addr, node_ptr node);
+
+public:
+  static size_t const default_max_nodes = 1 << 18;
+
+  explicit integration_cache (size_t max_nodes = default_max_nodes);
+  node_ptr get (Dwarf_Die die);
+};
+
+// A string from DWARF data, interned so that all occurrences of equal
+// strings share one entry.  M_STR points into the ELF data, which
+// lives as long as the dwfl_context that the entry comes from.
+struct interned_str
+{
+  char const *m_str;
+  size_t m_length;
+
+  // hash_str of the string, so that it matches hashes of equal
+  // strings that are not interned.
+  size_t m_hash;
+};
+
+// Hash of LENGTH bytes at STR.
+size_t hash_str (char const *str, size_t length);
+
+class str_intern_cache
+{
+  // Entries by addresses of strings seen so far.  Equal names are
+  // usually merged in .debug_str, so most lookups end here, and they
+  // don't lock: slots are only ever filled in, under M_MUTEX, address
+  // last.  A table that gets half full is replaced by a larger copy.
+  // Replaced tables are kept until the cache goes away, as readers
+  // may still be probing them.
+  struct addr_slot
+  {
+    std::atomic <char const *> m_addr;
+    std::atomic <interned_str const *> m_entry;
+  };
+
+  struct addr_table
+  {
+    size_t m_mask;
+    std::unique_ptr <addr_slot[]> m_slots;
+    size_t m_size;
+
+    explicit addr_table (size_t nslots);
+  };
+
+  struct content_hash
+  {
+    size_t
+    operator() (interned_str const &str) const
+    {
+      return str.m_hash;
+    }
+  };
+
+  struct content_eq
+  {
+    bool
+    operator() (interned_str const &a, interned_str const &b) const
+    {
+      return a.m_length == b.m_length
+	&& std::memcmp (a.m_str, b.m_str, a.m_length) == 0;
+    }
+  };
+
+  std::atomic <addr_table *> m_by_addr;
+  std::vector <std::unique_ptr <addr_table>> m_addr_tables;
+
+  // Entries by content.  The keys are the entries themselves, so
+  // they point into the ELF data as well.
+  std::unordered_set <interned_str, content_hash, content_eq> m_by_content;
+  std::mutex m_mutex;
+
+  static interned_str const *find_addr (addr_table const &table,
+					char const *str);
+  static void insert_addr (addr_table &table, char const *str,
+			   interned_str const *entry);
+  void add_addr (char const *str, interned_str const *entry);
+
+public:
+  str_intern_cache ();
+  interned_str const &intern (char const *str);
+};
+
+// A chain of DW_TAG_imported_unit DIE's that a cooked DIE was reached
+// through, innermost first.  Chains are interned, so that a DIE value
+// refers to its chain through a single pointer, and equal chains
+// compare equal by address.
+struct import_chain
+{
+  Dwarf_Die m_die;
+  import_chain const *m_parent;
+};
+
+class import_chain_cache
+{
+  sharded_map <std::pair <import_chain const *, void *>,
+	       import_chain, 16> m_chains;
+
+public:
+  // The chain of PARENT extended by importing DIE.
+  import_chain const *get (import_chain const *parent, Dwarf_Die die);
+};
+
 
 #endif /* _CACHE_H_ */
@@ -324,7 +324,9 @@ string_or_unknown (const char *known, const char *prefix, brevity brv,
                    unsigned int lo_user, unsigned int hi_user,
 		   bool print_unknown_num)
 {
-  static char unknown_buf[40];
+  // Constants are formatted from several threads at once when
+  // queries run in parallel.
+  static thread_local char unknown_buf[40];
 
   if (known != nullptr)
     return known;
@@ -26,14 +26,91 @@
    the GNU Lesser General Public License along with this program.  If
    not, see <http://www.gnu.org/licenses/>.  */
 
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <fcntl.h>
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <cerrno>
+
 #include "std-memory.hh"
 #include "dwfl_context.hh"
+#include "dwpp.hh"
 #include "cache.hh"
+#include "index-cache.hh"
+
+namespace
+{
+  int
+  prime_dwflmod (Dwfl_Module *dwflmod, void **userdata, const char *name,
+		 Dwarf_Addr base, void *arg)
+  {
+    // Prime the ELF file associated with a Dwfl module.  This is
+    // necessary when later we request a Dwarf.  For dwz files, that
+    // would fail with a message about missing symbol table, but it
+    // doesn't if we first prime the ELF file.
+    GElf_Addr bias;
+    if (dwfl_module_getelf (dwflmod, &bias) == nullptr)
+      throw_libdwfl ();
+
+    return DWARF_CB_OK;
+  }
+}
+
+std::shared_ptr <Dwfl>
+open_dwfl (std::string const &fn)
+{
+  int fd = open (fn.c_str (), O_RDONLY);
+  if (fd == -1)
+    throw std::runtime_error
+      (std::error_code (errno, std::system_category ()).message ());
+
+  const static Dwfl_Callbacks callbacks =
+    {
+      .find_elf = dwfl_build_id_find_elf,
+      .find_debuginfo = dwfl_standard_find_debuginfo,
+      .section_address = dwfl_offline_section_address,
+    };
+
+  elf_version (EV_CURRENT);
+
+  auto dwfl = std::shared_ptr <Dwfl> (dwfl_begin (&callbacks), dwfl_end);
+  if (dwfl == nullptr)
+    throw_libdwfl ();
+
+  if (dwfl_report_offline (&*dwfl, fn.c_str (), fn.c_str (), fd) == nullptr)
+    throw_libdwfl ();
+  if (dwfl_report_end (&*dwfl, nullptr, nullptr) != 0)
+    throw_libdwfl ();
+
+  dwfl_getmodules (&*dwfl, &prime_dwflmod, nullptr, 0);
+
+  return dwfl;
+}
 
 struct dwfl_context::pimpl
 {
-  parent_cache m_parcache;
-  root_cache m_rootcache;
+  index_cache m_idxcache {index_cache_dir ()};
+  parent_cache m_parcache {&m_idxcache};
+  root_cache m_rootcache {&m_idxcache};
+  tag_cache m_tagcache {&m_idxcache};
+  name_cache m_namecache {&m_idxcache};
+  addr_cache m_addrcache;
+  integration_cache m_intcache;
+  str_intern_cache m_strcache;
+  import_chain_cache m_importcache;
+
+  // Per-thread handles.  M_FN is empty unless the context was
+  // constructed as per-thread.  The thread that constructed the
+  // context uses the main handle.
+  std::string m_fn;
+  std::thread::id m_owner;
+  std::mutex m_mutex;
+  std::map <std::thread::id, std::shared_ptr <Dwfl>> m_thread_dwfls;
 
   Dwarf_Off
   find_parent (Dwarf_Die die)
@@ -46,6 +123,24 @@ struct dwfl_context::pimpl
   {
     return m_rootcache.is_root (die);
   }
+
+  Dwfl *
+  thread_dwfl (std::thread::id id)
+  {
+    {
+      std::lock_guard <std::mutex> lock {m_mutex};
+      auto it = m_thread_dwfls.find (id);
+      if (it != m_thread_dwfls.end ())
+	return &*it->second;
+    }
+
+    // Only this thread ever inserts under ID, so it's safe to open
+    // the file without holding the lock.
+    auto dwfl = open_dwfl (m_fn);
+
+    std::lock_guard <std::mutex> lock {m_mutex};
+    return &*(m_thread_dwfls[id] = dwfl);
+  }
 };
 
 dwfl_context::dwfl_context (std::shared_ptr <Dwfl> dwfl)
@@ -53,9 +148,33 @@ dwfl_context::dwfl_context (std::shared_ptr <Dwfl> dwfl)
   , m_dwfl {dwfl}
 {}
 
+dwfl_context::dwfl_context (std::string const &fn, bool per_thread)
+  : m_pimpl {std::make_unique <pimpl> ()}
+  , m_dwfl {open_dwfl (fn)}
+{
+  if (per_thread)
+    {
+      m_pimpl->m_fn = fn;
+      m_pimpl->m_owner = std::this_thread::get_id ();
+    }
+}
+
 dwfl_context::~dwfl_context ()
 {}
 
+Dwfl *
+dwfl_context::get_dwfl ()
+{
+  if (m_pimpl->m_fn != "")
+    {
+      auto id = std::this_thread::get_id ();
+      if (id != m_pimpl->m_owner)
+	return m_pimpl->thread_dwfl (id);
+    }
+
+  return &*m_dwfl;
+}
+
 Dwarf_Off
 dwfl_context::find_parent (Dwarf_Die die)
 {
@@ -67,3 +186,86 @@ dwfl_context::is_root (Dwarf_Die die)
 {
   return m_pimpl->is_root (die);
 }
+
+unit_tag_index const &
+dwfl_context::tag_index (Dwarf_Die cudie)
+{
+  return m_pimpl->m_tagcache.get_index (cudie);
+}
+
+dwarf_name_index const &
+dwfl_context::name_index (Dwarf *dw, bool cooked)
+{
+  return m_pimpl->m_namecache.get_index (dw, cooked);
+}
+
+dwarf_addr_index const &
+dwfl_context::addr_index (Dwarf *dw)
+{
+  return m_pimpl->m_addrcache.get_index (dw);
+}
+
+std::shared_ptr <integrated_die const>
+dwfl_context::integrated (Dwarf_Die die)
+{
+  return m_pimpl->m_intcache.get (die);
+}
+
+interned_str const &
+dwfl_context::intern_str (char const *str)
+{
+  return m_pimpl->m_strcache.intern (str);
+}
+
+import_chain const *
+dwfl_context::import_chain_of (import_chain const *parent, Dwarf_Die die)
+{
+  return m_pimpl->m_importcache.get (parent, die);
+}
+
+void
+dwctx_registry::add (std::shared_ptr <dwfl_context> dwctx)
+{
+  std::lock_guard <std::mutex> lock {m_mutex};
+  if (std::find (m_dwctxs.begin (), m_dwctxs.end (), dwctx)
+      == m_dwctxs.end ())
+    m_dwctxs.push_back (std::move (dwctx));
+}
+
+void
+dwctx_registry::add (dwctx_registry const &that)
+{
+  if (&that == this)
+    return;
+
+  std::vector <std::shared_ptr <dwfl_context>> dwctxs;
+  {
+    std::lock_guard <std::mutex> lock {that.m_mutex};
+    dwctxs = that.m_dwctxs;
+  }
+
+  for (auto &dwctx: dwctxs)
+    add (std::move (dwctx));
+}
+
+namespace
+{
+  thread_local dwctx_registry *current_dwctxs = nullptr;
+}
+
+dwctx_scope::dwctx_scope (dwctx_registry &dwctxs)
+  : m_prev {current_dwctxs}
+{
+  current_dwctxs = &dwctxs;
+}
+
+dwctx_scope::~dwctx_scope ()
+{
+  current_dwctxs = m_prev;
+}
+
+dwctx_registry *
+dwctx_scope::current ()
+{
+  return current_dwctxs;
+}
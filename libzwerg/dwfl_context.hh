@@ -30,9 +30,29 @@
 #define _DWFL_CONTEXT_H_
 
 #include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
 #include <elfutils/libdwfl.h>
 
+struct unit_tag_index;
+struct dwarf_name_index;
+struct dwarf_addr_index;
+struct integrated_die;
+struct interned_str;
+struct import_chain;
+
+// Open FN as an offline Dwfl with a single module.
+std::shared_ptr <Dwfl> open_dwfl (std::string const &fn);
+
 // This represents a Dwfl handle together with some query caches.
+//
+// The caches can be consulted from several threads at once.  libdw
+// handles themselves should however not be used concurrently.  A
+// context that is meant to be shared among threads should therefore
+// be constructed with PER_THREAD set, in which case each thread that
+// calls get_dwfl gets its own handle to the same file.  Such handles
+// are kept around until the context is destroyed.
 class dwfl_context
 {
   class pimpl;
@@ -41,13 +61,104 @@ class dwfl_context
 
 public:
   explicit dwfl_context (std::shared_ptr <Dwfl> dwfl);
+  dwfl_context (std::string const &fn, bool per_thread);
   ~dwfl_context ();
 
-  Dwfl *get_dwfl ()
-  { return &*m_dwfl; }
+  Dwfl *get_dwfl ();
 
   Dwarf_Off find_parent (Dwarf_Die die);
   bool is_root (Dwarf_Die die);
+
+  // Tag index of the unit whose CU DIE is CUDIE.
+  unit_tag_index const &tag_index (Dwarf_Die cudie);
+
+  // Index of DIE's of DW by name, either as raw or as cooked
+  // @AT_name would see it.
+  dwarf_name_index const &name_index (Dwarf *dw, bool cooked);
+
+  // Index of DIE's of DW by address.
+  dwarf_addr_index const &addr_index (Dwarf *dw);
+
+  // Attributes of DIE and resolved references of DIE's that it
+  // refers to, as cooked attribute lookups integrate them.
+  std::shared_ptr <integrated_die const> integrated (Dwarf_Die die);
+
+  // Intern STR, which points into ELF data of this context.
+  interned_str const &intern_str (char const *str);
+
+  // Import chain PARENT extended by DW_TAG_imported_unit DIE.
+  import_chain const *import_chain_of (import_chain const *parent,
+				       Dwarf_Die die);
+};
+
+// Values refer to their dwfl_context through a handle, which is a
+// plain pointer.  Values are cloned all the time, and counting
+// references on each clone would mean contended atomic operations
+// on the context's reference count.  Contexts are instead kept alive
+// by whoever holds the owning shared_ptr: Dwarf values, ops that open
+// files, and dwctx_registry's of query results.
+class dwctx_handle
+{
+  dwfl_context *m_dwctx;
+
+public:
+  dwctx_handle (dwfl_context *dwctx)
+    : m_dwctx {dwctx}
+  {}
+
+  dwctx_handle (std::shared_ptr <dwfl_context> const &dwctx)
+    : m_dwctx {dwctx.get ()}
+  {}
+
+  dwfl_context *get () const
+  { return m_dwctx; }
+
+  dwfl_context *operator-> () const
+  { return m_dwctx; }
+
+  dwfl_context &operator* () const
+  { return *m_dwctx; }
+
+  bool operator== (dwctx_handle that) const
+  { return m_dwctx == that.m_dwctx; }
+
+  bool operator!= (dwctx_handle that) const
+  { return m_dwctx != that.m_dwctx; }
+};
+
+// A set of contexts kept alive together.  Each query result has one,
+// holding contexts of Dwarf values of its input, contexts that the
+// input's other values refer to, and contexts that the query opens
+// while it is evaluated, see dwctx_scope.  Stacks and values that the
+// result hands out share it, so that they stay valid after the result
+// is gone.  Contexts can be added from several threads at once.
+class dwctx_registry
+  : public std::enable_shared_from_this <dwctx_registry>
+{
+  mutable std::mutex m_mutex;
+  std::vector <std::shared_ptr <dwfl_context>> m_dwctxs;
+
+public:
+  void add (std::shared_ptr <dwfl_context> dwctx);
+  void add (dwctx_registry const &that);
+};
+
+// Makes DWCTXS the registry that contexts opened by the running thread
+// are added to, for as long as the scope lives.  Scopes nest.
+class dwctx_scope
+{
+  dwctx_registry *m_prev;
+
+public:
+  explicit dwctx_scope (dwctx_registry &dwctxs);
+  ~dwctx_scope ();
+
+  dwctx_scope (dwctx_scope const &) = delete;
+  dwctx_scope &operator= (dwctx_scope const &) = delete;
+
+  // Registry of the innermost scope of the running thread, or
+  // nullptr if there is none.
+  static dwctx_registry *current ();
 };
 
 #endif /* _DWFL_CONTEXT_H_ */
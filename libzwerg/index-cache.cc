@@ -0,0 +1,628 @@
+/*
+   Copyright (C) 2014 Red Hat, Inc.
+   This file is part of dwgrep.
+
+   This file is free software; you can redistribute it and/or modify
+   it under the terms of either
+
+     * the GNU Lesser General Public License as published by the Free
+       Software Foundation; either version 3 of the License, or (at
+       your option) any later version
+
+   or
+
+     * the GNU General Public License as published by the Free
+       Software Foundation; either version 2 of the License, or (at
+       your option) any later version
+
+   or both in parallel, as here.
+
+   dwgrep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received copies of the GNU General Public License and
+   the GNU Lesser General Public License along with this program.  If
+   not, see <http://www.gnu.org/licenses/>.  */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <iomanip>
+#include <vector>
+
+#include <gelf.h>
+#include <elfutils/libdwelf.h>
+
+#include "index-cache.hh"
+
+namespace
+{
+  std::mutex g_dir_mutex;
+  std::string g_dir;
+
+  char const magic[8] = {'Z', 'W', 'I', 'D', 'X', 0, 0, 0};
+  uint32_t const version = 2;
+
+  // Used to detect files written on a machine with different byte
+  // order.
+  uint32_t const byte_order_mark = 0x01020304;
+
+  // Each kind of index is kept in a file of its own.
+  enum class file_kind
+    : uint32_t
+    {
+      parents,
+      tags,
+      raw_names,
+      cooked_names,
+    };
+
+  // Cache file starts with this header.  It's followed by arrays
+  // whose lengths are given by M_COUNTS:
+  //
+  //  - parents: DIE offsets, unit offsets, parent positions.
+  //  - tags: stored_tags::unit's, unit_tag_index::tagged_die's.
+  //  - names: stored_names::name's, dwarf_name_index::named_die's,
+  //    offsets of importing units, bytes of the names.
+  //
+  // Unused counts are zero.
+  struct header
+  {
+    char m_magic[8];
+    uint32_t m_version;
+    uint32_t m_bom;
+    uint32_t m_kind;
+    uint32_t m_reserved;
+    uint64_t m_counts[4];
+  };
+
+  header
+  make_header (file_kind kind, uint64_t n0, uint64_t n1,
+	       uint64_t n2 = 0, uint64_t n3 = 0)
+  {
+    header hdr;
+    memset (&hdr, 0, sizeof hdr);
+    memcpy (hdr.m_magic, magic, sizeof magic);
+    hdr.m_version = version;
+    hdr.m_bom = byte_order_mark;
+    hdr.m_kind = (uint32_t) kind;
+    hdr.m_counts[0] = n0;
+    hdr.m_counts[1] = n1;
+    hdr.m_counts[2] = n2;
+    hdr.m_counts[3] = n3;
+    return hdr;
+  }
+
+  // Take an array of COUNT elements of ELSIZE bytes each from the
+  // SIZE bytes that remain of a file.  Counts come from the file, so
+  // take care not to overflow.
+  bool
+  take (size_t &size, uint64_t count, size_t elsize)
+  {
+    if (count > size / elsize)
+      return false;
+    size -= count * elsize;
+    return true;
+  }
+
+  // Whether HDR describes arrays that fill a file of SIZE bytes.
+  bool
+  sizes_match (header const &hdr, size_t size)
+  {
+    if (size < sizeof (header))
+      return false;
+    size -= sizeof (header);
+
+    uint64_t const *n = hdr.m_counts;
+    switch ((file_kind) hdr.m_kind)
+      {
+      case file_kind::parents:
+	// Parent positions are 32-bit, with (uint32_t)-1 for none.
+	return n[0] < (uint32_t) -1 && n[1] <= n[0] && n[2] == 0 && n[3] == 0
+	  && take (size, n[0], sizeof (Dwarf_Off) + sizeof (uint32_t))
+	  && take (size, n[1], sizeof (Dwarf_Off))
+	  && size == 0;
+
+      case file_kind::tags:
+	return n[2] == 0 && n[3] == 0
+	  && take (size, n[0], sizeof (stored_tags::unit))
+	  && take (size, n[1], sizeof (unit_tag_index::tagged_die))
+	  && size == 0;
+
+      case file_kind::raw_names:
+      case file_kind::cooked_names:
+	return take (size, n[0], sizeof (stored_names::name))
+	  && take (size, n[1], sizeof (dwarf_name_index::named_die))
+	  && take (size, n[2], sizeof (Dwarf_Off))
+	  && take (size, n[3], 1)
+	  && size == 0;
+      }
+
+    return false;
+  }
+
+  // Whether arrays of a cache file are consistent: DIE offsets
+  // ascend, each parent precedes its children in pre-order, and unit
+  // offsets are exactly those of DIE's without a parent.  The file
+  // could be corrupt, or stale in a way that the checksum missed,
+  // and lookups index the arrays by what they find in them.
+  bool
+  arrays_valid (Dwarf_Off const *offsets, uint32_t const *parents,
+		size_t ndies, Dwarf_Off const *units, size_t nunits)
+  {
+    size_t u = 0;
+    for (size_t i = 0; i < ndies; ++i)
+      {
+	if (i > 0 && offsets[i] <= offsets[i - 1])
+	  return false;
+
+	if (parents[i] == (uint32_t) -1)
+	  {
+	    if (u == nunits || units[u] != offsets[i])
+	      return false;
+	    ++u;
+	  }
+	else if (parents[i] >= i)
+	  return false;
+      }
+
+    return u == nunits;
+  }
+
+  // The same for tag indices: units ascend and split the DIE array
+  // between them, and DIE's of each unit are sorted by tag, and
+  // within one tag by positions, which are within the unit.
+  bool
+  tags_valid (stored_tags::unit const *units, size_t nunits,
+	      unit_tag_index::tagged_die const *dies, size_t ndies)
+  {
+    uint64_t begin = 0;
+    for (size_t i = 0; i < nunits; ++i)
+      {
+	auto const &u = units[i];
+	if ((i > 0 && u.m_offset <= units[i - 1].m_offset)
+	    || u.m_end < begin || u.m_end > ndies || u.m_has_imports > 1)
+	  return false;
+
+	for (uint64_t j = begin; j < u.m_end; ++j)
+	  {
+	    if (dies[j].m_pos >= u.m_end - begin)
+	      return false;
+	    if (j > begin
+		&& (dies[j].m_tag < dies[j - 1].m_tag
+		    || (dies[j].m_tag == dies[j - 1].m_tag
+			&& (dies[j].m_pos <= dies[j - 1].m_pos
+			    || dies[j].m_offset <= dies[j - 1].m_offset))))
+	      return false;
+	  }
+
+	begin = u.m_end;
+      }
+
+    return begin == ndies;
+  }
+
+  // Order of names in a cache file.
+  int
+  compare_names (char const *a, size_t alen, char const *b, size_t blen)
+  {
+    if (int r = memcmp (a, b, std::min (alen, blen)))
+      return r;
+    return alen < blen ? -1 : alen > blen ? 1 : 0;
+  }
+
+  // And for name indices: names are within the string table, ascend
+  // and split the DIE array between them, and DIE's of each name
+  // ascend, as do importing units.
+  bool
+  names_valid (stored_names const &st, size_t nstrings)
+  {
+    uint64_t begin = 0;
+    for (size_t i = 0; i < st.m_nnames; ++i)
+      {
+	auto const &n = st.m_names[i];
+	if (n.m_str > nstrings || n.m_length > nstrings - n.m_str
+	    || n.m_end < begin || n.m_end > st.m_ndies)
+	  return false;
+
+	if (i > 0)
+	  {
+	    auto const &prev = st.m_names[i - 1];
+	    if (compare_names (st.m_strings + prev.m_str, prev.m_length,
+			       st.m_strings + n.m_str, n.m_length) >= 0)
+	      return false;
+	  }
+
+	for (uint64_t j = begin + 1; j < n.m_end; ++j)
+	  if (st.m_dies[j].m_cu_offset < st.m_dies[j - 1].m_cu_offset
+	      || st.m_dies[j].m_offset <= st.m_dies[j - 1].m_offset)
+	    return false;
+
+	begin = n.m_end;
+      }
+
+    for (size_t i = 1; i < st.m_nimporting; ++i)
+      if (st.m_importing[i] <= st.m_importing[i - 1])
+	return false;
+
+    return begin == st.m_ndies;
+  }
+
+  // Map cache file FN and check that it holds an index of kind KIND.
+  // Returns its header, or nullptr if there's no usable such file.
+  // The mapping is stored to MAPPING.
+  header const *
+  map_file (std::string const &fn, file_kind kind,
+	    std::shared_ptr <void const> &mapping)
+  {
+    if (fn == "")
+      return nullptr;
+
+    int fd = open (fn.c_str (), O_RDONLY);
+    if (fd == -1)
+      return nullptr;
+
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat (fd, &st) == 0 && (size_t) st.st_size >= sizeof (header))
+      map = mmap (nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close (fd);
+
+    if (map == MAP_FAILED)
+      return nullptr;
+
+    size_t size = st.st_size;
+    mapping = std::shared_ptr <void const>
+      {map, [size] (void const *p)
+	    { munmap (const_cast <void *> (p), size); }};
+
+    auto hdr = static_cast <header const *> (map);
+    if (memcmp (hdr->m_magic, magic, sizeof magic) != 0
+	|| hdr->m_version != version
+	|| hdr->m_bom != byte_order_mark
+	|| hdr->m_kind != (uint32_t) kind
+	|| ! sizes_match (*hdr, size))
+      return nullptr;
+
+    return hdr;
+  }
+
+  // Write HDR followed by PARTS into cache file FN.  Failures are
+  // silently ignored.
+  void
+  write_file (std::string const &fn, header const &hdr,
+	      std::vector <std::pair <void const *, size_t>> const &parts)
+  {
+    if (fn == "")
+      return;
+
+    // Write into a temporary file first and rename it into place, so
+    // that a concurrent reader never sees a partial file.
+    std::string tmp = fn + ".XXXXXX";
+    std::vector <char> tmpl {tmp.begin (), tmp.end ()};
+    tmpl.push_back (0);
+
+    int fd = mkstemp (tmpl.data ());
+    if (fd == -1)
+      return;
+
+    FILE *f = fdopen (fd, "wb");
+    if (f == nullptr)
+      {
+	close (fd);
+	unlink (tmpl.data ());
+	return;
+      }
+
+    bool ok = fwrite (&hdr, sizeof hdr, 1, f) == 1;
+    for (auto const &part: parts)
+      ok = ok && (part.second == 0
+		  || fwrite (part.first, part.second, 1, f) == 1);
+
+    if (fclose (f) != 0 || ! ok || rename (tmpl.data (), fn.c_str ()) != 0)
+      unlink (tmpl.data ());
+  }
+
+  Elf_Data *
+  find_debug_info (Elf *elf)
+  {
+    size_t shstrndx;
+    if (elf_getshdrstrndx (elf, &shstrndx) != 0)
+      return nullptr;
+
+    for (Elf_Scn *scn = nullptr; (scn = elf_nextscn (elf, scn)) != nullptr; )
+      {
+	GElf_Shdr shdr;
+	if (gelf_getshdr (scn, &shdr) == nullptr)
+	  continue;
+
+	char const *name = elf_strptr (elf, shstrndx, shdr.sh_name);
+	if (name != nullptr && (strcmp (name, ".debug_info") == 0
+				|| strcmp (name, ".zdebug_info") == 0))
+	  return elf_rawdata (scn, nullptr);
+      }
+
+    return nullptr;
+  }
+
+  // FNV-1a over the beginning and the end of the section.  Together
+  // with build-id and section size this is meant to catch a stale
+  // file, not to authenticate its contents.
+  uint64_t
+  checksum (Elf_Data const *data)
+  {
+    uint64_t h = 0xcbf29ce484222325ull;
+    auto feed = [&h] (unsigned char const *it, unsigned char const *end)
+      {
+	for (; it != end; ++it)
+	  h = (h ^ *it) * 0x100000001b3ull;
+      };
+
+    size_t const sample = 64 * 1024;
+    auto buf = static_cast <unsigned char const *> (data->d_buf);
+    if (data->d_size <= 2 * sample)
+      feed (buf, buf + data->d_size);
+    else
+      {
+	feed (buf, buf + sample);
+	feed (buf + data->d_size - sample, buf + data->d_size);
+      }
+
+    return h;
+  }
+}
+
+void
+set_index_cache_dir (std::string const &dir)
+{
+  std::lock_guard <std::mutex> lock {g_dir_mutex};
+  g_dir = dir;
+}
+
+std::string
+index_cache_dir ()
+{
+  std::lock_guard <std::mutex> lock {g_dir_mutex};
+  return g_dir;
+}
+
+index_cache::index_cache (std::string const &dir)
+  : m_dir {dir}
+{}
+
+std::string
+index_cache::file_name (Dwarf *dw, char const *ext) const
+{
+  Elf *elf = dwarf_getelf (dw);
+  if (elf == nullptr)
+    return "";
+
+  void const *build_id;
+  ssize_t len = dwelf_elf_gnu_build_id (elf, &build_id);
+  if (len <= 0)
+    return "";
+
+  Elf_Data *data = find_debug_info (elf);
+  if (data == nullptr)
+    return "";
+
+  std::stringstream ss;
+  ss << m_dir << "/" << std::hex << std::setfill ('0');
+  for (ssize_t i = 0; i < len; ++i)
+    ss << std::setw (2)
+       << (unsigned) static_cast <unsigned char const *> (build_id)[i];
+  ss << "-" << data->d_size << "-" << checksum (data) << ext;
+  return ss.str ();
+}
+
+std::shared_ptr <stored_index const>
+index_cache::find (Dwarf *dw)
+{
+  if (! enabled ())
+    return nullptr;
+
+  std::lock_guard <std::mutex> lock {m_mutex};
+  auto it = m_loaded.find (dw);
+  if (it != m_loaded.end ())
+    return it->second;
+
+  auto &ret = m_loaded[dw];
+
+  std::shared_ptr <void const> mapping;
+  header const *hdr = map_file (file_name (dw, ".idx"),
+				file_kind::parents, mapping);
+  if (hdr == nullptr)
+    return nullptr;
+
+  size_t ndies = hdr->m_counts[0];
+  size_t nunits = hdr->m_counts[1];
+  auto offsets = reinterpret_cast <Dwarf_Off const *> (hdr + 1);
+  auto units = offsets + ndies;
+  auto parents = reinterpret_cast <uint32_t const *> (units + nunits);
+  if (! arrays_valid (offsets, parents, ndies, units, nunits))
+    return nullptr;
+
+  ret = std::make_shared <stored_index>
+    (stored_index {offsets, parents, ndies, units, nunits, mapping});
+  return ret;
+}
+
+void
+index_cache::store (Dwarf *dw, Dwarf_Off const *offsets,
+		    uint32_t const *parents, size_t ndies)
+{
+  if (! enabled ())
+    return;
+
+  std::vector <Dwarf_Off> units;
+  for (size_t i = 0; i < ndies; ++i)
+    if (parents[i] == (uint32_t) -1)
+      units.push_back (offsets[i]);
+
+  write_file (file_name (dw, ".idx"),
+	      make_header (file_kind::parents, ndies, units.size ()),
+	      {{offsets, ndies * sizeof *offsets},
+	       {units.data (), units.size () * sizeof (Dwarf_Off)},
+	       {parents, ndies * sizeof *parents}});
+}
+
+std::shared_ptr <stored_tags const>
+index_cache::find_tags (Dwarf *dw)
+{
+  if (! enabled ())
+    return nullptr;
+
+  std::shared_ptr <void const> mapping;
+  header const *hdr = map_file (file_name (dw, ".tags"),
+				file_kind::tags, mapping);
+  if (hdr == nullptr)
+    return nullptr;
+
+  size_t nunits = hdr->m_counts[0];
+  size_t ndies = hdr->m_counts[1];
+  auto units = reinterpret_cast <stored_tags::unit const *> (hdr + 1);
+  auto dies = reinterpret_cast <unit_tag_index::tagged_die const *>
+    (units + nunits);
+  if (! tags_valid (units, nunits, dies, ndies))
+    return nullptr;
+
+  return std::make_shared <stored_tags>
+    (stored_tags {units, nunits, dies, ndies, mapping});
+}
+
+void
+index_cache::store_tags (Dwarf *dw,
+			 std::map <Dwarf_Off, unit_tag_index> const &indices)
+{
+  if (! enabled ())
+    return;
+
+  std::vector <stored_tags::unit> units;
+  std::vector <std::pair <void const *, size_t>> parts {{nullptr, 0}};
+  uint64_t ndies = 0;
+  for (auto const &idx: indices)
+    {
+      size_t n = idx.second.m_end - idx.second.m_begin;
+      ndies += n;
+      units.push_back ({idx.first, ndies, idx.second.m_has_imports});
+      parts.push_back ({idx.second.m_begin, n * sizeof *idx.second.m_begin});
+    }
+  parts[0] = {units.data (), units.size () * sizeof (stored_tags::unit)};
+
+  write_file (file_name (dw, ".tags"),
+	      make_header (file_kind::tags, units.size (), ndies), parts);
+}
+
+std::pair <dwarf_name_index::named_die const *,
+	   dwarf_name_index::named_die const *>
+stored_names::find (std::string const &str) const
+{
+  name const *end = m_names + m_nnames;
+  name const *it = std::lower_bound
+    (m_names, end, str, [this] (name const &n, std::string const &s)
+     {
+       return compare_names (m_strings + n.m_str, n.m_length,
+			     s.data (), s.size ()) < 0;
+     });
+
+  if (it == end || compare_names (m_strings + it->m_str, it->m_length,
+				  str.data (), str.size ()) != 0)
+    return std::make_pair (nullptr, nullptr);
+
+  uint64_t begin = it == m_names ? 0 : it[-1].m_end;
+  return std::make_pair (m_dies + begin, m_dies + it->m_end);
+}
+
+std::shared_ptr <stored_names const>
+index_cache::find_names (Dwarf *dw, bool cooked)
+{
+  if (! enabled ())
+    return nullptr;
+
+  std::shared_ptr <void const> mapping;
+  header const *hdr
+    = map_file (file_name (dw, cooked ? ".cnames" : ".names"),
+		cooked ? file_kind::cooked_names : file_kind::raw_names,
+		mapping);
+  if (hdr == nullptr)
+    return nullptr;
+
+  stored_names ret;
+  ret.m_nnames = hdr->m_counts[0];
+  ret.m_ndies = hdr->m_counts[1];
+  ret.m_nimporting = hdr->m_counts[2];
+  ret.m_names = reinterpret_cast <stored_names::name const *> (hdr + 1);
+  ret.m_dies = reinterpret_cast <dwarf_name_index::named_die const *>
+    (ret.m_names + ret.m_nnames);
+  ret.m_importing = reinterpret_cast <Dwarf_Off const *>
+    (ret.m_dies + ret.m_ndies);
+  ret.m_strings = reinterpret_cast <char const *>
+    (ret.m_importing + ret.m_nimporting);
+  ret.m_mapping = mapping;
+  if (! names_valid (ret, hdr->m_counts[3]))
+    return nullptr;
+
+  return std::make_shared <stored_names> (ret);
+}
+
+void
+index_cache::store_names (Dwarf *dw, bool cooked, dwarf_name_index const &idx)
+{
+  if (! enabled ())
+    return;
+
+  using entry = std::pair <std::string const,
+			   std::vector <dwarf_name_index::named_die>>;
+  std::vector <entry const *> entries;
+  for (auto const &e: idx.m_dies)
+    entries.push_back (&e);
+  std::sort (entries.begin (), entries.end (),
+	     [] (entry const *a, entry const *b)
+	     {
+	       return compare_names (a->first.data (), a->first.size (),
+				     b->first.data (), b->first.size ()) < 0;
+	     });
+
+  std::vector <stored_names::name> names;
+  std::string strings;
+  size_t ndies = 0;
+  for (auto e: entries)
+    {
+      ndies += e->second.size ();
+      names.push_back ({strings.size (), e->first.size (), ndies});
+      strings += e->first;
+    }
+
+  // Copy the DIE's member-wise into zeroed memory, so that padding
+  // that ends up in the file is zero as well.
+  std::vector <dwarf_name_index::named_die> dies (ndies);
+  size_t i = 0;
+  for (auto e: entries)
+    for (auto const &d: e->second)
+      {
+	dies[i].m_cu_offset = d.m_cu_offset;
+	dies[i].m_offset = d.m_offset;
+	dies[i].m_pos = d.m_pos;
+	++i;
+      }
+
+  auto const &importing = idx.m_importing.m_units;
+  write_file (file_name (dw, cooked ? ".cnames" : ".names"),
+	      make_header (cooked ? file_kind::cooked_names
+			   : file_kind::raw_names,
+			   names.size (), ndies, importing.size (),
+			   strings.size ()),
+	      {{names.data (), names.size () * sizeof (stored_names::name)},
+	       {dies.data (), ndies * sizeof (dwarf_name_index::named_die)},
+	       {importing.data (), importing.size () * sizeof (Dwarf_Off)},
+	       {strings.data (), strings.size ()}});
+}
@@ -0,0 +1,164 @@
+/*
+   Copyright (C) 2014 Red Hat, Inc.
+   This file is part of dwgrep.
+
+   This file is free software; you can redistribute it and/or modify
+   it under the terms of either
+
+     * the GNU Lesser General Public License as published by the Free
+       Software Foundation; either version 3 of the License, or (at
+       your option) any later version
+
+   or
+
+     * the GNU General Public License as published by the Free
+       Software Foundation; either version 2 of the License, or (at
+       your option) any later version
+
+   or both in parallel, as here.
+
+   dwgrep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received copies of the GNU General Public License and
+   the GNU Lesser General Public License along with this program.  If
+   not, see <http://www.gnu.org/licenses/>.  */
+
+#ifndef _INDEX_CACHE_H_
+#define _INDEX_CACHE_H_
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <elfutils/libdw.h>
+
+#include "cache.hh"
+
+// Set directory where DIE indices are persisted between runs.  Empty
+// string (the default) turns the on-disk cache off.  This is read
+// when a Dwarf is opened, so it should be set up front.
+void set_index_cache_dir (std::string const &dir);
+std::string index_cache_dir ();
+
+// DIE tables of one Dwarf, as stored in a cache file.  The arrays
+// point directly into a read-only mapping of the file.
+struct stored_index
+{
+  // Offsets of all DIE's in ascending order, and for each of them
+  // the position of its parent in the same array, or (uint32_t)-1.
+  Dwarf_Off const *m_offsets;
+  uint32_t const *m_parents;
+  size_t m_ndies;
+
+  // Offsets of unit DIE's in ascending order.
+  Dwarf_Off const *m_units;
+  size_t m_nunits;
+
+  std::shared_ptr <void const> m_mapping;
+};
+
+// Tag indices of all units of one Dwarf, as stored in a cache file.
+struct stored_tags
+{
+  struct unit
+  {
+    // Offset of the CU DIE.
+    Dwarf_Off m_offset;
+
+    // Position in M_DIES one past the last DIE of this unit.  DIE's
+    // of the unit start where those of the previous one end.
+    uint64_t m_end;
+
+    // See unit_tag_index::m_has_imports.
+    uint64_t m_has_imports;
+  };
+
+  // In ascending order of offsets.
+  unit const *m_units;
+  size_t m_nunits;
+
+  unit_tag_index::tagged_die const *m_dies;
+  size_t m_ndies;
+
+  std::shared_ptr <void const> m_mapping;
+};
+
+// Name index of one Dwarf, as stored in a cache file.
+struct stored_names
+{
+  struct name
+  {
+    // The name is M_LENGTH bytes at M_STRINGS + M_STR.
+    uint64_t m_str;
+    uint64_t m_length;
+
+    // Position in M_DIES one past the last DIE with this name.  As
+    // with units above, DIE's of one name follow those of the
+    // previous one.
+    uint64_t m_end;
+  };
+
+  // In ascending order of the names, as compared by memcmp, shorter
+  // names first if one is a prefix of the other.
+  name const *m_names;
+  size_t m_nnames;
+
+  dwarf_name_index::named_die const *m_dies;
+  size_t m_ndies;
+
+  // See dwarf_name_index::m_importing.
+  Dwarf_Off const *m_importing;
+  size_t m_nimporting;
+
+  char const *m_strings;
+
+  std::shared_ptr <void const> m_mapping;
+
+  // DIE's called STR, or an empty range if there are none.
+  std::pair <dwarf_name_index::named_die const *,
+	     dwarf_name_index::named_die const *>
+  find (std::string const &str) const;
+};
+
+// On-disk cache of DIE indices.  Files are named after the build-id
+// of the ELF file that the Dwarf comes from, and a checksum of its
+// .debug_info section.  Each kind of index is stored in a file of
+// its own.  Dwarf's without build-id are not cached.
+class index_cache
+{
+  std::string m_dir;
+  std::mutex m_mutex;
+  std::map <Dwarf *, std::shared_ptr <stored_index const>> m_loaded;
+
+  std::string file_name (Dwarf *dw, char const *ext) const;
+
+public:
+  explicit index_cache (std::string const &dir);
+
+  bool enabled () const
+  { return m_dir != ""; }
+
+  // Returns nullptr if there's no usable cache file for DW.
+  std::shared_ptr <stored_index const> find (Dwarf *dw);
+
+  // Store the index for DW.  Failures are silently ignored, the
+  // cache is only an optimization.
+  void store (Dwarf *dw, Dwarf_Off const *offsets, uint32_t const *parents,
+	      size_t ndies);
+
+  // The same for tag indices of all units of DW, keyed by offsets of
+  // their CU DIE's.
+  std::shared_ptr <stored_tags const> find_tags (Dwarf *dw);
+  void store_tags (Dwarf *dw,
+		   std::map <Dwarf_Off, unit_tag_index> const &indices);
+
+  // And for the raw or cooked name index of DW.
+  std::shared_ptr <stored_names const> find_names (Dwarf *dw, bool cooked);
+  void store_names (Dwarf *dw, bool cooked, dwarf_name_index const &idx);
+};
+
+#endif /* _INDEX_CACHE_H_ */
@@ -94,7 +94,7 @@ dwgrep_vocabulary_core ()
 
   add_builtin_constant (*voc, constant (0, &bool_constant_dom), "false");
   add_builtin_constant (*voc, constant (1, &bool_constant_dom), "true");
-  add_simple_exec_builtin <op_type> (*voc, "type");
+  voc->add (std::make_shared <builtin_type> ());
   add_simple_exec_builtin <op_pos> (*voc, "pos");
 
   // stack shuffling
@@ -150,7 +150,8 @@ dwgrep_vocabulary_core ()
     t->add_op_overload <op_elem_str> ();
     t->add_op_overload <op_elem_seq> ();
 
-    voc->add (std::make_shared <overloaded_op_builtin> ("elem", t));
+    voc->add (std::make_shared <reducible_op_builtin>
+	      ("elem", t, std::vector <reduction_point> {reduce_elem_seq}));
   }
 
   // "relem"
@@ -160,7 +161,8 @@ dwgrep_vocabulary_core ()
     t->add_op_overload <op_relem_str> ();
     t->add_op_overload <op_relem_seq> ();
 
-    voc->add (std::make_shared <overloaded_op_builtin> ("relem", t));
+    voc->add (std::make_shared <reducible_op_builtin>
+	      ("relem", t, std::vector <reduction_point> {reduce_relem_seq}));
   }
 
   // "empty"
@@ -30,11 +30,15 @@
 #include <string>
 #include <iostream>
 #include <cstring>
+#include <algorithm>
 
 #include "builtin-dw.hh"
 #include "builtin.hh"
+#include "index-cache.hh"
 #include "init.hh"
 #include "op.hh"
+#include "optimize.hh"
+#include "parallel.hh"
 #include "parser.hh"
 #include "stack.hh"
 #include "tree.hh"
@@ -42,6 +46,10 @@
 
 namespace
 {
+  // Whether zw_query_parse* dump the query as it is optimized.  Meant
+  // to be set up front, like the index cache directory.
+  bool optimizer_trace = false;
+
   zw_error *
   zw_error_new (char const *message)
   {
@@ -173,8 +181,8 @@ bool
 zw_stack_push (zw_stack *stack, zw_value const *value, zw_error **out_err)
 {
   return capture_errors ([&] () {
-      stack->m_values.push_back
-	(std::make_unique <zw_value> (value->m_value->clone ()));
+      stack->m_owned.push_back (std::make_unique <zw_value>
+				(value->m_value->clone (), value->m_dwctxs));
       return true;
     }, false, out_err);
 }
@@ -183,9 +191,15 @@ bool
 zw_stack_push_take (zw_stack *stack, zw_value *value, zw_error **out_err)
 {
   return capture_errors ([&] () {
-      stack->m_values.push_back
-	(std::make_unique <zw_value> (std::move (value->m_value)));
-      zw_value_destroy (value);
+      if (value->m_owned == nullptr)
+	{
+	  value->m_owned = value->m_value->clone ();
+	  value->m_value = value->m_owned.get ();
+	}
+      // The stack takes over VALUE itself.  Make room first, so that
+      // VALUE stays with the caller if that fails.
+      stack->m_owned.emplace_back (nullptr);
+      stack->m_owned.back ().reset (value);
       return true;
     }, false, out_err);
 }
@@ -193,24 +207,23 @@ zw_stack_push_take (zw_stack *stack, zw_value *value, zw_error **out_err)
 size_t
 zw_stack_depth (zw_stack const *stack)
 {
-  return stack->m_values.size ();
+  return stack->size ();
 }
 
 zw_value const *
 zw_stack_at (zw_stack const *stack, size_t depth)
 {
   assert (stack != nullptr);
-  assert (depth < stack->m_values.size ());
-  return stack->m_values[stack->m_values.size () - 1 - depth].get ();
+  assert (depth < stack->size ());
+  return &stack->at (stack->size () - 1 - depth);
 }
 
 bool
 zw_stack_dump_xxx (zw_stack const *stack, zw_error **out_err)
 {
   return capture_errors ([&] () {
-      auto const &values = stack->m_values;
-      for (auto it = values.rbegin (); it != values.rend (); ++it)
-	std::cout << *((*it)->m_value) << std::endl;
+      for (size_t i = stack->size (); i-- > 0; )
+	std::cout << *stack->at (i).m_value << std::endl;
       return true;
     }, false, out_err);
 }
@@ -231,10 +244,20 @@ zw_query_parse_len (zw_vocabulary const *voc,
   return capture_errors ([&] () {
       tree t = parse_query (*voc->m_voc, {query, query_len});
       t.simplify ();
+      optimize (t, optimizer_trace ? &std::cerr : nullptr);
       return new zw_query { t };
     }, nullptr, out_err);
 }
 
+bool
+zw_set_optimizer_trace (bool enabled, zw_error **out_err)
+{
+  return capture_errors ([&] () {
+      optimizer_trace = enabled;
+      return true;
+    }, false, out_err);
+}
+
 void
 zw_query_destroy (zw_query *query)
 {
@@ -247,7 +270,10 @@ namespace
   init_dwarf (char const *filename, doneness d, zw_error **out_err)
   {
     return capture_errors ([&] () {
-	return new zw_value { std::make_unique <value_dwarf> (filename, 0, d) };
+	auto dwarf = std::make_unique <value_dwarf> (filename, 0, d);
+	auto dwctxs = std::make_shared <dwctx_registry> ();
+	dwctxs->add (dwarf->get_dwctx ());
+	return new zw_value { std::move (dwarf), std::move (dwctxs) };
       }, nullptr, out_err);
   }
 }
@@ -264,6 +290,15 @@ zw_value_init_dwarf_raw (char const *filename, zw_error **out_err)
   return init_dwarf (filename, doneness::raw, out_err);
 }
 
+bool
+zw_set_index_cache_dir (char const *dir, zw_error **out_err)
+{
+  return capture_errors ([&] () {
+      set_index_cache_dir (dir != nullptr ? dir : "");
+      return true;
+    }, false, out_err);
+}
+
 void
 zw_value_destroy (zw_value *value)
 {
@@ -271,16 +306,150 @@ zw_value_destroy (zw_value *value)
 }
 
 
+namespace
+{
+  void
+  rethrow_pending (zw_result *result)
+  {
+    if (result->m_error != nullptr)
+      {
+	auto err = result->m_error;
+	result->m_error = nullptr;
+	std::rethrow_exception (err);
+      }
+  }
+
+  // Produce at most N stacks into RESULT's batch, and point views
+  // at their values.  Return the number of stacks produced.
+  size_t
+  fill_batch (zw_result *result, size_t n)
+  {
+    rethrow_pending (result);
+
+    auto &batch = result->m_batch;
+    batch.clear ();
+    try
+      {
+	dwctx_scope scope {*result->m_dwctxs};
+	result->m_op->next_batch (batch, n);
+      }
+    catch (...)
+      {
+	if (batch.empty ())
+	  throw;
+	result->m_error = std::current_exception ();
+      }
+
+    if (result->m_views.size () < batch.size ())
+      result->m_views.resize (batch.size ());
+
+    for (size_t i = 0; i < batch.size (); ++i)
+      {
+	stack const &stk = *batch[i];
+	auto &values = result->m_views[i].m_view;
+	values.clear ();
+	for (size_t depth = stk.size (); depth-- > 0; )
+	  values.emplace_back (stk.get (depth), result->m_dwctxs);
+      }
+
+    return batch.size ();
+  }
+
+  std::unique_ptr <stack>
+  copy_input (zw_stack const *input_stack)
+  {
+    auto stk = std::make_unique <stack> ();
+    for (size_t i = 0; i < input_stack->size (); ++i)
+      stk->push (input_stack->at (i).m_value->clone ());
+    return stk;
+  }
+
+  // Contexts that values of INPUT_STACK refer to.
+  std::shared_ptr <dwctx_registry>
+  input_dwctxs (zw_stack const *input_stack)
+  {
+    auto ret = std::make_shared <dwctx_registry> ();
+    for (size_t i = 0; i < input_stack->size (); ++i)
+      if (auto const &dwctxs = input_stack->at (i).m_dwctxs)
+	ret->add (*dwctxs);
+    return ret;
+  }
+
+  zw_result *
+  with_dwctxs (std::unique_ptr <zw_result> result,
+	       zw_stack const *input_stack)
+  {
+    result->m_dwctxs = input_dwctxs (input_stack);
+    return result.release ();
+  }
+
+  // Evaluate QUERY on STK with a plan from QUERY's pool.
+  zw_result
+  make_result (zw_query const *query, std::unique_ptr <stack> stk)
+  {
+    auto plan = query->m_plans->get ();
+    auto op = plan->bind (std::move (stk));
+    return zw_result (op, std::move (plan), query->m_plans);
+  }
+}
+
 zw_result *
 zw_query_execute (zw_query const *query, zw_stack const *input_stack,
 		  zw_error **out_err)
 {
   return capture_errors ([&] () {
-      auto stk = std::make_unique <stack> ();
-      for (auto const &emt: input_stack->m_values)
-	stk->push (emt->m_value->clone ());
-      auto upstream = std::make_shared <op_origin> (std::move (stk));
-      return new zw_result { query->m_query.build_exec (upstream) };
+      return with_dwctxs (std::make_unique <zw_result>
+			  (make_result (query, copy_input (input_stack))),
+			  input_stack);
+    }, nullptr, out_err);
+}
+
+zw_result *
+zw_query_execute_parallel (zw_query const *query, zw_stack const *input_stack,
+			   unsigned nthreads, bool ordered,
+			   zw_error **out_err)
+{
+  return capture_errors ([&] () {
+      auto stk = copy_input (input_stack);
+      auto dwctxs = input_dwctxs (input_stack);
+
+      std::unique_ptr <zw_result> result;
+      if (nthreads > 1)
+	if (auto op = build_parallel_exec (query->m_query, *stk,
+					   nthreads, ordered, dwctxs))
+	  result = std::make_unique <zw_result> (op);
+
+      if (result == nullptr)
+	result = std::make_unique <zw_result>
+	  (make_result (query, std::move (stk)));
+
+      result->m_dwctxs = dwctxs;
+      return result.release ();
+    }, nullptr, out_err);
+}
+
+zw_plan *
+zw_query_compile (zw_query const *query, zw_error **out_err)
+{
+  return capture_errors ([&] () {
+      return new zw_plan { query_plan {query->m_query} };
+    }, nullptr, out_err);
+}
+
+void
+zw_plan_destroy (zw_plan *plan)
+{
+  delete plan;
+}
+
+zw_result *
+zw_plan_execute (zw_plan *plan, zw_stack const *input_stack,
+		 zw_error **out_err)
+{
+  return capture_errors ([&] () {
+      return with_dwctxs (std::make_unique <zw_result>
+			  (plan->m_plan.bind (copy_input (input_stack))),
+			  input_stack);
     }, nullptr, out_err);
 }
 
@@ -288,23 +457,65 @@ bool
 zw_result_next (zw_result *result, zw_stack **out_stack, zw_error **out_err)
 {
   return capture_errors ([&] () {
-      std::unique_ptr <stack> ret = result->m_op->next ();
+      rethrow_pending (result);
+
+      std::unique_ptr <stack> ret;
+      {
+	dwctx_scope scope {*result->m_dwctxs};
+	ret = result->m_op->next ();
+      }
       if (ret == nullptr)
 	{
 	  *out_stack = nullptr;
 	  return true;
 	}
 
-      size_t sz = ret->size ();
+      auto out = std::make_unique <zw_stack> ();
+      out->m_owned.resize (ret->size ());
+      for (size_t i = out->m_owned.size (); i-- > 0; )
+	out->m_owned[i] = std::make_unique <zw_value> (ret->pop (),
+						       result->m_dwctxs);
+
+      *out_stack = out.release ();
+      return true;
+    }, false, out_err);
+}
 
-      std::vector <std::unique_ptr <zw_value>> values;
-      values.resize (sz);
+bool
+zw_result_next_borrowed (zw_result *result, zw_stack const **out_stack,
+			 zw_error **out_err)
+{
+  return capture_errors ([&] () {
+      *out_stack = fill_batch (result, 1) > 0 ? &result->m_views[0] : nullptr;
+      return true;
+    }, false, out_err);
+}
 
-      auto it = values.rbegin ();
-      for (size_t i = 0; i < sz; ++i)
-	*it++ = std::make_unique <zw_value> (ret->pop ());
+bool
+zw_result_next_n (zw_result *result, zw_stack const **out_stacks, size_t n,
+		  size_t *out_count, zw_error **out_err)
+{
+  return capture_errors ([&] () {
+      size_t count = fill_batch (result, n);
+      for (size_t i = 0; i < count; ++i)
+	out_stacks[i] = &result->m_views[i];
+      *out_count = count;
+      return true;
+    }, false, out_err);
+}
 
-      *out_stack = new zw_stack { std::move (values) };
+bool
+zw_query_execute_foreach (zw_query const *query, zw_stack const *input_stack,
+			  bool (*callback) (zw_stack const *stack, void *data),
+			  void *data, zw_error **out_err)
+{
+  return capture_errors ([&] () {
+      zw_result result = make_result (query, copy_input (input_stack));
+      result.m_dwctxs = input_dwctxs (input_stack);
+      while (size_t count = fill_batch (&result, 64))
+	for (size_t i = 0; i < count; ++i)
+	  if (! callback (&result.m_views[i], data))
+	    return true;
       return true;
     }, false, out_err);
 }
@@ -42,6 +42,7 @@ extern "C" {
   typedef struct zw_value zw_value;
   typedef struct zw_stack zw_stack;
   typedef struct zw_result zw_result;
+  typedef struct zw_plan zw_plan;
 
 
   void zw_error_destroy (zw_error *err);
@@ -74,6 +75,8 @@ extern "C" {
 
   size_t zw_stack_depth (zw_stack const *stack);
 
+  // N.B.: The returned value is valid for as long as STACK is.
+  // Pushing more values to STACK doesn't move it.
   zw_value const *zw_stack_at (zw_stack const *stack, size_t depth);
 
   bool zw_stack_dump_xxx (zw_stack const *stack, zw_error **out_err);
@@ -86,6 +89,11 @@ extern "C" {
 				char const *query, size_t query_len,
 				zw_error **out_err);
 
+  // N.B.: When ENABLED, queries parsed afterwards dump their parse
+  // tree to stderr, and again after each optimization pass that
+  // changes it.
+  bool zw_set_optimizer_trace (bool enabled, zw_error **out_err);
+
   void zw_query_destroy (zw_query *query);
 
 
@@ -93,9 +101,60 @@ extern "C" {
 			       zw_stack const *input_stack,
 			       zw_error **out_err);
 
+  // N.B.: Like zw_query_execute, but if QUERY starts with iteration
+  // over units of a Dwarf (such as "entry ?TAG_subprogram"), the
+  // units are split among NTHREADS worker threads.  When ORDERED,
+  // results come in the same order as they would from
+  // zw_query_execute.  Queries that can't be split this way are
+  // executed sequentially.
+  zw_result *zw_query_execute_parallel (zw_query const *query,
+					zw_stack const *input_stack,
+					unsigned nthreads, bool ordered,
+					zw_error **out_err);
+
+  // N.B.: Builds QUERY into a plan that can be executed on any
+  // number of inputs, without being built anew for each of them.
+  // zw_query_execute reuses plans of results that were already
+  // destroyed, so an explicit plan is mostly useful for keeping one
+  // per thread.
+  zw_plan *zw_query_compile (zw_query const *query, zw_error **out_err);
+
+  void zw_plan_destroy (zw_plan *plan);
+
+  // N.B.: Like zw_query_execute, but evaluates PLAN.  A plan
+  // evaluates one input at a time: executing it again ends the
+  // previous result, which must then only be destroyed.
+  zw_result *zw_plan_execute (zw_plan *plan, zw_stack const *input_stack,
+			      zw_error **out_err);
+
   bool zw_result_next (zw_result *result,
 		       zw_stack **out_stack, zw_error **out_err);
 
+  // N.B.: Like zw_result_next, but the stack stays owned by RESULT,
+  // and its values are not copied.  It is valid until the next call
+  // of any zw_result_next* function on RESULT, or until RESULT is
+  // destroyed.  *OUT_STACK is set to NULL when there are no more
+  // results.
+  bool zw_result_next_borrowed (zw_result *result,
+				zw_stack const **out_stack,
+				zw_error **out_err);
+
+  // N.B.: Produces at most N borrowed stacks (see
+  // zw_result_next_borrowed) into OUT_STACKS, and sets *OUT_COUNT to
+  // their number, which is zero when there are no more results.
+  bool zw_result_next_n (zw_result *result,
+			 zw_stack const **out_stacks, size_t n,
+			 size_t *out_count, zw_error **out_err);
+
+  // N.B.: Executes QUERY like zw_query_execute, and calls CALLBACK
+  // with each produced stack, which is borrowed for the duration of
+  // the call.  Iteration stops early when CALLBACK returns false.
+  bool zw_query_execute_foreach (zw_query const *query,
+				 zw_stack const *input_stack,
+				 bool (*callback) (zw_stack const *stack,
+						   void *data),
+				 void *data, zw_error **out_err);
+
   void zw_result_destroy (zw_result *result);
 
 
@@ -151,6 +210,12 @@ extern "C" {
   zw_value *zw_value_init_dwarf (char const *filename, zw_error **out_err);
   zw_value *zw_value_init_dwarf_raw (char const *filename, zw_error **out_err);
 
+  // N.B.: Sets a directory where DIE indices are kept between runs,
+  // keyed by build-id of the file that they describe.  This affects
+  // Dwarf values created afterwards.  Passing NULL or an empty
+  // string turns the cache off.
+  bool zw_set_index_cache_dir (char const *dir, zw_error **out_err);
+
   void zw_value_destroy (zw_value *value);
 
 #ifdef __cplusplus
@@ -29,7 +29,11 @@
 
 #include <string>
 #include <memory>
+#include <exception>
 
+#include "dwfl_context.hh"
+#include "op.hh"
+#include "plan.hh"
 #include "tree.hh"
 
 struct vocabulary;
@@ -47,23 +51,115 @@ struct zw_vocabulary
 struct zw_query
 {
   tree m_query;
+
+  // Plans that zw_query_execute and zw_query_execute_foreach reuse.
+  // Shared with results that currently use one of them, so that the
+  // plan can be put back even if the query is gone by then.
+  std::shared_ptr <query_plan_pool> m_plans;
+
+  explicit zw_query (tree const &query)
+    : m_query {query}
+    , m_plans {std::make_shared <query_plan_pool> (query)}
+  {}
 };
 
-struct zw_result
+struct zw_plan
 {
-  std::shared_ptr <op> m_op;
+  query_plan m_plan;
 };
 
 struct zw_value
 {
-  std::unique_ptr <value> m_value;
+  // Values made by zw_value_init_* own the underlying value.  Values
+  // of stacks borrowed from a zw_result merely point into a stack
+  // that the result holds.
+  std::unique_ptr <value> m_owned;
+  value const *m_value;
+
+  // Contexts that the value may refer to, see dwctx_registry.  Null
+  // for values that don't come from Dwarf.
+  std::shared_ptr <dwctx_registry const> m_dwctxs;
+
+  zw_value (std::unique_ptr <value> value,
+	    std::shared_ptr <dwctx_registry const> dwctxs = nullptr)
+    : m_owned {std::move (value)}
+    , m_value {m_owned.get ()}
+    , m_dwctxs {std::move (dwctxs)}
+  {}
 
-  zw_value (std::unique_ptr <value> value)
-    : m_value {std::move (value)}
+  zw_value (value const &value,
+	    std::shared_ptr <dwctx_registry const> dwctxs)
+    : m_value {&value}
+    , m_dwctxs {std::move (dwctxs)}
   {}
 };
 
 struct zw_stack
 {
-  std::vector <std::unique_ptr <zw_value>> m_values;
+  // Bottom of the stack first.  Stacks that the client owns keep each
+  // value in an allocation of its own, so that values that
+  // zw_stack_at handed out stay put when the stack grows.  Borrowed
+  // stacks can't grow.  They keep their values in M_VIEW, which the
+  // next call that fills them reuses without allocation.  Only one
+  // of the two vectors is used by any given stack.
+  std::vector <std::unique_ptr <zw_value>> m_owned;
+  std::vector <zw_value> m_view;
+
+  size_t
+  size () const
+  {
+    return m_owned.size () + m_view.size ();
+  }
+
+  zw_value const &
+  at (size_t i) const
+  {
+    return m_view.empty () ? *m_owned[i] : m_view[i];
+  }
+};
+
+struct zw_result
+{
+  // Contexts of the input, and contexts that the query opens, which
+  // values that the result produces refer to.  Declared first so that
+  // it is destroyed last.
+  std::shared_ptr <dwctx_registry> m_dwctxs;
+
+  std::shared_ptr <op> m_op;
+
+  // Stacks produced by the last call to the borrowing interface, and
+  // views of them that were handed out.  Both are reused by the next
+  // call, so that no allocation is made for each result.
+  stack_batch m_batch;
+  std::vector <zw_stack> m_views;
+
+  // When an error comes up after part of a batch was produced, that
+  // part is handed out first, and the error is reported by the next
+  // call.
+  std::exception_ptr m_error;
+
+  // The plan that M_OP comes from, if it was taken from a pool.  It
+  // is put back when the result is destroyed.
+  std::unique_ptr <query_plan> m_plan;
+  std::shared_ptr <query_plan_pool> m_pool;
+
+  explicit zw_result (std::shared_ptr <op> op)
+    : m_op {op}
+  {}
+
+  zw_result (std::shared_ptr <op> op, std::unique_ptr <query_plan> plan,
+	     std::shared_ptr <query_plan_pool> pool)
+    : m_op {op}
+    , m_plan {std::move (plan)}
+    , m_pool {pool}
+  {}
+
+  zw_result (zw_result &&that) = default;
+
+  ~zw_result ()
+  {
+    m_op = nullptr;
+    if (m_plan != nullptr)
+      m_pool->put (std::move (m_plan));
+  }
 };
@@ -29,7 +29,6 @@
 #include <iostream>
 #include <sstream>
 #include <memory>
-#include <set>
 #include <algorithm>
 
 #include "op.hh"
@@ -77,6 +76,19 @@ namespace
   }
 }
 
+size_t
+op::next_batch (stack_batch &out, size_t max)
+{
+  size_t n = 0;
+  for (; n < max; ++n)
+    if (auto stk = next ())
+      out.push_back (std::move (stk));
+    else
+      break;
+  return n;
+}
+
+
 stack::uptr
 op_origin::next ()
 {
@@ -132,6 +144,26 @@ op_assert::next ()
   return nullptr;
 }
 
+size_t
+op_assert::next_batch (stack_batch &out, size_t max)
+{
+  // Filter whole upstream batches in place, and keep pulling until
+  // something passes.
+  size_t const start = out.size ();
+  while (out.size () == start)
+    {
+      if (m_upstream->next_batch (out, max) == 0)
+	return 0;
+
+      filter_batch (out, start, [this] (stack &stk)
+		    {
+		      return m_pred->result (stk) == pred_result::yes;
+		    });
+    }
+
+  return out.size () - start;
+}
+
 std::string
 op_assert::name () const
 {
@@ -225,6 +257,11 @@ struct op_format::pimpl
   std::shared_ptr <stringer> m_stringer;
   size_t m_pos;
 
+  // Stacks pulled from upstream in a batch that weren't formatted
+  // yet, starting at M_PENDING_I.
+  stack_batch m_pending;
+  size_t m_pending_i;
+
   pimpl (std::shared_ptr <op> upstream,
 	 std::shared_ptr <stringer_origin> origin,
 	 std::shared_ptr <stringer> stringer)
@@ -232,6 +269,7 @@ struct op_format::pimpl
     , m_origin {origin}
     , m_stringer {stringer}
     , m_pos {0}
+    , m_pending_i {0}
   {}
 
   void
@@ -242,7 +280,23 @@ struct op_format::pimpl
   }
 
   stack::uptr
-  next ()
+  next_upstream (size_t max)
+  {
+    if (m_pending_i == m_pending.size ())
+      {
+	m_pending.clear ();
+	m_pending_i = 0;
+	if (max <= 1)
+	  return m_upstream->next ();
+	if (m_upstream->next_batch (m_pending, max) == 0)
+	  return nullptr;
+      }
+
+    return std::move (m_pending[m_pending_i++]);
+  }
+
+  stack::uptr
+  next (size_t max)
   {
     while (true)
       {
@@ -254,7 +308,7 @@ struct op_format::pimpl
 	    return std::move (stk.first);
 	  }
 
-	if (auto stk = m_upstream->next ())
+	if (auto stk = next_upstream (max))
 	  {
 	    reset_me ();
 	    m_origin->set_next (std::move (stk));
@@ -264,10 +318,24 @@ struct op_format::pimpl
       }
   }
 
+  size_t
+  next_batch (stack_batch &out, size_t max)
+  {
+    size_t n = 0;
+    for (; n < max; ++n)
+      if (auto stk = next (max))
+	out.push_back (std::move (stk));
+      else
+	break;
+    return n;
+  }
+
   void
   reset ()
   {
     reset_me ();
+    m_pending.clear ();
+    m_pending_i = 0;
     m_upstream->reset ();
   }
 };
@@ -284,7 +352,13 @@ op_format::~op_format ()
 stack::uptr
 op_format::next ()
 {
-  return m_pimpl->next ();
+  return m_pimpl->next (1);
+}
+
+size_t
+op_format::next_batch (stack_batch &out, size_t max)
+{
+  return m_pimpl->next_batch (out, max);
 }
 
 void
@@ -487,13 +561,70 @@ op_capture::name () const
 
 namespace
 {
-  struct deref_less
+  // An open-addressing hash set of stacks, compared by value.  Used
+  // by op_tr_closure to remember which stacks it has already seen.
+  class stack_set
   {
-    template <class T>
+    struct slot
+    {
+      size_t m_hash;
+      std::shared_ptr <stack> m_stk;
+    };
+
+    // The number of slots is always a power of two, and at most half
+    // of them are used.
+    std::vector <slot> m_slots;
+    size_t m_size;
+
+    void
+    grow ()
+    {
+      std::vector <slot> old (std::max <size_t> (16, m_slots.size () * 2));
+      old.swap (m_slots);
+      size_t mask = m_slots.size () - 1;
+      for (auto &s: old)
+	if (s.m_stk != nullptr)
+	  {
+	    size_t i = s.m_hash & mask;
+	    while (m_slots[i].m_stk != nullptr)
+	      i = (i + 1) & mask;
+	    m_slots[i] = std::move (s);
+	  }
+    }
+
+  public:
+    stack_set ()
+      : m_size {0}
+    {}
+
+    // Returns true if STK was inserted, false if an equal stack was
+    // already present.
     bool
-    operator() (T const &a, T const &b)
+    insert (std::shared_ptr <stack> stk)
     {
-      return *a < *b;
+      if (2 * (m_size + 1) > m_slots.size ())
+	grow ();
+
+      size_t h = stk->hash ();
+      size_t mask = m_slots.size () - 1;
+      size_t i = h & mask;
+      for (; m_slots[i].m_stk != nullptr; i = (i + 1) & mask)
+	if (m_slots[i].m_hash == h && *m_slots[i].m_stk == *stk)
+	  return false;
+
+      m_slots[i] = {h, std::move (stk)};
+      ++m_size;
+      return true;
+    }
+
+    void
+    clear ()
+    {
+      if (m_size == 0)
+	return;
+      for (auto &s: m_slots)
+	s.m_stk = nullptr;
+      m_size = 0;
     }
   };
 }
@@ -504,7 +635,7 @@ struct op_tr_closure::pimpl
   std::shared_ptr <op_origin> m_origin;
   std::shared_ptr <op> m_op;
 
-  std::set <std::shared_ptr <stack>, deref_less> m_seen;
+  stack_set m_seen;
   std::vector <std::shared_ptr <stack> > m_stks;
 
   pimpl (std::shared_ptr <op> upstream,
@@ -540,7 +671,7 @@ struct op_tr_closure::pimpl
 	    if (std::shared_ptr <stack> stk = m_upstream->next ())
 	      {
 		m_stks.push_back (stk);
-		m_seen.insert (stk);
+		m_seen.insert (std::move (stk));
 	      }
 	    else
 	      return nullptr;
@@ -553,11 +684,8 @@ struct op_tr_closure::pimpl
 	m_origin->set_next (std::make_unique <stack> (*stk));
 
 	while (std::shared_ptr <stack> stk2 = m_op->next ())
-	  if (m_seen.find (stk2) == m_seen.end ())
-	    {
-	      m_stks.push_back (stk2);
-	      m_seen.insert (stk2);
-	    }
+	  if (m_seen.insert (stk2))
+	    m_stks.push_back (std::move (stk2));
 
 	return std::make_unique <stack> (*stk);
       }
@@ -862,7 +990,7 @@ struct op_read::pimpl
 	    if (auto stk = m_upstream->next ())
 	      {
 		auto frame = stk->nth_frame (m_depth);
-		value &val = frame->read_value (m_index);
+		value const &val = frame->read_value (m_index);
 		bool is_closure = val.is <value_closure> ();
 		stk->push (val.clone ());
 
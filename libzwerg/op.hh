@@ -30,12 +30,16 @@
 #define _OP_H_
 
 #include <memory>
+#include <vector>
 #include <cassert>
 
 #include "stack.hh"
 #include "pred_result.hh"
 #include "tree.hh"
 
+// A batch of stacks, see op::next_batch.
+using stack_batch = std::vector <stack::uptr>;
+
 // Subclasses of class op represent computations.  An op node is
 // typically constructed such that it directly feeds from another op
 // node, called upstream (see tree::build_exec).
@@ -48,7 +52,41 @@ public:
   virtual stack::uptr next () = 0;
   virtual void reset () = 0;
   virtual std::string name () const = 0;
-};
+
+  // Produce at most MAX next values and append them to OUT.  Return
+  // the number of values appended, which is zero only once the op is
+  // exhausted.  Calls to next and next_batch can be freely mixed.
+  // Should this throw, stacks already appended to OUT are results
+  // that precede the failure.
+  //
+  // This default implementation calls next in a loop.  Ops that sit
+  // on hot paths override it to save a virtual call chain through
+  // the whole pipeline for each value.
+  virtual size_t next_batch (stack_batch &out, size_t max);
+};
+
+// Apply F to each stack in OUT from index START on, and keep those
+// for which it returns true.  F may modify the stack.  If F throws,
+// only the stacks kept so far remain, so that OUT still holds
+// finished results (see op::next_batch).
+template <class F>
+void
+filter_batch (stack_batch &out, size_t start, F f)
+{
+  size_t j = start;
+  try
+    {
+      for (size_t i = start; i < out.size (); ++i)
+	if (f (*out[i]))
+	  out[j++] = std::move (out[i]);
+    }
+  catch (...)
+    {
+      out.erase (out.begin () + j, out.end ());
+      throw;
+    }
+  out.erase (out.begin () + j, out.end ());
+}
 
 template <class RT>
 struct value_producer
@@ -57,6 +95,38 @@ struct value_producer
 
   // Produce next value.
   virtual std::unique_ptr <RT> next () = 0;
+
+  // Produce at most MAX next values and append them to OUT, like
+  // op::next_batch does.
+  virtual size_t
+  next_batch (std::vector <std::unique_ptr <RT>> &out, size_t max)
+  {
+    size_t n = 0;
+    for (; n < max; ++n)
+      if (auto v = next ())
+	out.push_back (std::move (v));
+      else
+	break;
+    return n;
+  }
+};
+
+// Yields VALUE, unless it is nullptr, and then nothing else.
+template <class RT>
+struct value_producer_single
+  : public value_producer <RT>
+{
+  std::unique_ptr <RT> m_value;
+
+  explicit value_producer_single (std::unique_ptr <RT> value)
+    : m_value {std::move (value)}
+  {}
+
+  std::unique_ptr <RT>
+  next () override
+  {
+    return std::move (m_value);
+  }
 };
 
 template <class RT>
@@ -193,6 +263,7 @@ public:
   {}
 
   stack::uptr next () override;
+  size_t next_batch (stack_batch &out, size_t max) override;
   std::string name () const override;
 
   void reset () override
@@ -293,6 +364,7 @@ public:
   ~op_format ();
 
   stack::uptr next () override;
+  size_t next_batch (stack_batch &out, size_t max) override;
   std::string name () const override;
   void reset () override;
 };
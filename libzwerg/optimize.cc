@@ -0,0 +1,881 @@
+/*
+   Copyright (C) 2014 Red Hat, Inc.
+   This file is part of dwgrep.
+
+   This file is free software; you can redistribute it and/or modify
+   it under the terms of either
+
+     * the GNU Lesser General Public License as published by the Free
+       Software Foundation; either version 3 of the License, or (at
+       your option) any later version
+
+   or
+
+     * the GNU General Public License as published by the Free
+       Software Foundation; either version 2 of the License, or (at
+       your option) any later version
+
+   or both in parallel, as here.
+
+   dwgrep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received copies of the GNU General Public License and
+   the GNU Lesser General Public License along with this program.  If
+   not, see <http://www.gnu.org/licenses/>.  */
+
+#include <cassert>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+
+#include "builtin-cst.hh"
+#include "op.hh"
+#include "optimize.hh"
+#include "overload.hh"
+#include "scope.hh"
+#include "value-closure.hh"
+#include "value-cst.hh"
+#include "value-str.hh"
+
+namespace
+{
+  // Outcome of evaluating a predicate ahead of time.
+  enum class truth
+    {
+      no,
+      yes,
+      unknown,
+    };
+
+  bool
+  is_literal (tree const &t)
+  {
+    return t.tt () == tree_type::CONST || t.tt () == tree_type::STR;
+  }
+
+  std::unique_ptr <value>
+  literal_value (tree const &t)
+  {
+    if (t.tt () == tree_type::CONST)
+      return std::make_unique <value_cst> (t.cst (), 0);
+
+    assert (t.tt () == tree_type::STR);
+    return std::make_unique <value_str> (std::string (t.str ()), 0);
+  }
+
+  // A literal that pushes V.  NOP if V can't be written as a literal.
+  tree
+  value_literal (value &v)
+  {
+    if (auto vc = value::as <value_cst> (&v))
+      return tree {tree_type::CONST, vc->get_constant ()};
+    else if (auto vs = value::as <value_str> (&v))
+      return tree {tree_type::STR, vs->get_string ()};
+    else
+      return tree {tree_type::NOP};
+  }
+
+  // Whether V can partake in arithmetic without a warning.  Folding
+  // must not move diagnostics from run time to compile time.
+  bool
+  quiet_arith (value const &v)
+  {
+    if (auto vc = value::as <value_cst> (&v))
+      return vc->get_constant ().dom ()->safe_arith ();
+    return true;
+  }
+
+  // Same as above, for comparing A with B.
+  bool
+  quiet_compare (value const &a, value const &b)
+  {
+    auto ca = value::as <value_cst> (&a);
+    auto cb = value::as <value_cst> (&b);
+    if (ca != nullptr && cb != nullptr)
+      {
+	auto dom1 = ca->get_constant ().dom ();
+	auto dom2 = cb->get_constant ().dom ();
+	return dom1 == dom2 || dom1->safe_arith () || dom2->safe_arith ();
+      }
+
+    return a.get_type () == b.get_type () && a.is <value_str> ();
+  }
+
+  // Run BI on STK.  Return the stack that it yields, or nullptr if
+  // it yields other than exactly once, or throws.
+  stack::uptr
+  run_once (builtin const &bi, stack::uptr stk)
+  {
+    try
+      {
+	auto origin = std::make_shared <op_origin> (nullptr);
+	auto op = bi.build_exec (origin);
+	if (op == nullptr)
+	  return nullptr;
+
+	op->reset ();
+	origin->set_next (std::move (stk));
+	auto ret = op->next ();
+	if (ret == nullptr || op->next () != nullptr)
+	  return nullptr;
+	return ret;
+      }
+    catch (std::exception const &)
+      {
+	return nullptr;
+      }
+  }
+
+  // Number of values that a word described by PM takes, provided it
+  // always yields exactly once.  Otherwise (size_t) -1.
+  size_t
+  once_arity (builtin_protomap const &pm)
+  {
+    if (pm.empty ())
+      return -1;
+
+    size_t n = std::get <0> (pm.front ()).size ();
+    for (auto const &proto: pm)
+      if (std::get <1> (proto) != yield::once
+	  || std::get <0> (proto).size () != n)
+	return -1;
+
+    return n;
+  }
+
+  // Value that expression T pushes, if that is known ahead of time
+  // given that its input stacks are described by TYPES.
+  std::unique_ptr <value>
+  static_value (tree const &t, stack_types const &types)
+  {
+    if (is_literal (t))
+      return literal_value (t);
+
+    if (t.tt () != tree_type::F_BUILTIN)
+      return nullptr;
+
+    builtin const *bi = t.m_builtin.get ();
+    if (dynamic_cast <builtin_constant const *> (bi) != nullptr)
+      {
+	auto stk = run_once (*bi, std::make_unique <stack> ());
+	if (stk != nullptr && stk->size () == 1)
+	  return stk->pop ();
+      }
+    else if (dynamic_cast <builtin_type const *> (bi) != nullptr)
+      {
+	value_type vt = types.at (0);
+	if (vt != stack_types::unknown ())
+	  return std::make_unique <value_cst>
+	    (constant {vt.code (), &slot_type_dom}, 0);
+      }
+
+    return nullptr;
+  }
+
+  bool never_yields (tree const &t, stack_types types);
+
+  truth
+  static_truth (tree const &p, stack_types const &types)
+  {
+    switch (p.tt ())
+      {
+      case tree_type::PRED_NOT:
+	switch (static_truth (p.child (0), types))
+	  {
+	  case truth::no:
+	    return truth::yes;
+	  case truth::yes:
+	    return truth::no;
+	  case truth::unknown:
+	    return truth::unknown;
+	  }
+	abort ();
+
+      case tree_type::PRED_AND:
+      case tree_type::PRED_OR:
+	{
+	  // For AND, NO decides, for OR, YES does.
+	  truth decisive = p.tt () == tree_type::PRED_AND
+	    ? truth::no : truth::yes;
+	  truth a = static_truth (p.child (0), types);
+	  truth b = static_truth (p.child (1), types);
+	  if (a == decisive || b == decisive)
+	    return decisive;
+	  if (a == truth::unknown || b == truth::unknown)
+	    return truth::unknown;
+	  return a;
+	}
+
+      case tree_type::PRED_SUBX_ANY:
+	{
+	  tree const &x = p.child (0);
+	  if (x.tt () == tree_type::NOP)
+	    return truth::yes;
+	  else if (x.tt () == tree_type::ASSERT)
+	    return static_truth (x.child (0), types);
+	  else
+	    return never_yields (x, types) ? truth::no : truth::unknown;
+	}
+
+      case tree_type::PRED_SUBX_CMP:
+	{
+	  auto va = static_value (p.child (0), types);
+	  auto vb = static_value (p.child (1), types);
+	  if (va == nullptr || vb == nullptr
+	      || ! quiet_compare (*va, *vb)
+	      || p.child (2).tt () != tree_type::F_BUILTIN)
+	    return truth::unknown;
+
+	  try
+	    {
+	      auto pred = p.child (2).build_pred ();
+	      if (pred == nullptr)
+		return truth::unknown;
+
+	      stack stk;
+	      stk.push (std::move (va));
+	      stk.push (std::move (vb));
+	      pred->reset ();
+	      switch (pred->result (stk))
+		{
+		case pred_result::no:
+		  return truth::no;
+		case pred_result::yes:
+		  return truth::yes;
+		case pred_result::fail:
+		  return truth::unknown;
+		}
+	    }
+	  catch (std::exception const &)
+	    {}
+
+	  return truth::unknown;
+	}
+
+      default:
+	return truth::unknown;
+      }
+  }
+
+  // Whether T, when fed stacks described by TYPES, is known to never
+  // yield anything, because it hits an assertion that can't hold.
+  bool
+  never_yields (tree const &t, stack_types types)
+  {
+    switch (t.tt ())
+      {
+      case tree_type::ASSERT:
+	return static_truth (t.child (0), types) == truth::no;
+
+      case tree_type::SCOPE:
+	return never_yields (t.child (0), types);
+
+      case tree_type::CAT:
+	for (auto const &c: t.m_children)
+	  {
+	    if (never_yields (c, types))
+	      return true;
+	    c.infer_types (types);
+	  }
+	return false;
+
+      default:
+	return false;
+      }
+  }
+
+  bool
+  is_pred (tree const &t)
+  {
+    return t.tt () == tree_type::ASSERT
+      || (t.tt () == tree_type::F_BUILTIN
+	  && t.m_builtin->build_pred () != nullptr);
+  }
+
+  // Walks a tree and offers each node to visit (), together with
+  // types of stacks that flow into that node.
+  class walker
+  {
+    bool m_changed;
+
+  protected:
+    // Rewrite T in place if possible.  TYPES describes stacks that T
+    // is fed.  Return true if T was rewritten.
+    virtual bool visit (tree &t, stack_types const &types) = 0;
+
+  public:
+    walker ()
+      : m_changed {false}
+    {}
+
+    virtual ~walker () {}
+
+    bool
+    changed () const
+    {
+      return m_changed;
+    }
+
+    // On return TYPES describes stacks that T yields.
+    void walk (tree &t, stack_types &types);
+  };
+
+  void
+  walker::walk (tree &t, stack_types &types)
+  {
+    if (visit (t, types))
+      m_changed = true;
+
+    switch (t.tt ())
+      {
+      case tree_type::CAT:
+	for (auto &c: t.m_children)
+	  walk (c, types);
+	return;
+
+      case tree_type::ALT:
+      case tree_type::OR:
+	{
+	  std::vector <stack_types> branch_types (t.m_children.size (), types);
+	  for (size_t i = 0; i < t.m_children.size (); ++i)
+	    walk (t.child (i), branch_types[i]);
+	  types = stack_types::join (branch_types);
+	  return;
+	}
+
+      case tree_type::IFELSE:
+	{
+	  stack_types cond_types = types;
+	  walk (t.child (0), cond_types);
+
+	  std::vector <stack_types> branch_types (2, types);
+	  walk (t.child (1), branch_types[0]);
+	  walk (t.child (2), branch_types[1]);
+	  types = stack_types::join (branch_types);
+	  return;
+	}
+
+      case tree_type::SCOPE:
+	walk (t.child (0), types);
+	return;
+
+      case tree_type::SUBX_EVAL:
+	{
+	  stack_types sub = types;
+	  walk (t.child (0), sub);
+	  size_t keep = t.cst ().value ().uval ();
+	  for (size_t i = keep; i-- > 0; )
+	    types.push (sub.at (i));
+	  return;
+	}
+
+      case tree_type::BLOCK:
+      case tree_type::CLOSE_STAR:
+	{
+	  // Closure bodies are fed stacks from places unknown, resp.
+	  // from previous iterations.
+	  stack_types sub;
+	  walk (t.child (0), sub);
+	  t.infer_types (types);
+	  return;
+	}
+
+      case tree_type::PRED_AND:
+      case tree_type::PRED_OR:
+      case tree_type::PRED_NOT:
+      case tree_type::PRED_SUBX_ANY:
+      case tree_type::PRED_SUBX_CMP:
+	for (auto &c: t.m_children)
+	  {
+	    stack_types sub = types;
+	    walk (c, sub);
+	  }
+	return;
+
+      default:
+	// Sub-expressions of the remaining nodes are fed the same
+	// stacks as the node itself.
+	for (auto &c: t.m_children)
+	  {
+	    stack_types sub = types;
+	    walk (c, sub);
+	  }
+	t.infer_types (types);
+	return;
+      }
+  }
+
+  template <class Walker>
+  class walker_pass
+    : public pass
+  {
+    char const *m_name;
+
+  public:
+    explicit walker_pass (char const *name)
+      : m_name {name}
+    {}
+
+    char const *
+    name () const override
+    {
+      return m_name;
+    }
+
+    bool
+    run (tree &t) const override
+    {
+      Walker w;
+      stack_types types;
+      w.walk (t, types);
+      return w.changed ();
+    }
+  };
+
+  class fold_walker
+    : public walker
+  {
+    // CS[I] is a word.  If its inputs are literals that immediately
+    // precede it, and the overload that applies is known, replace
+    // the literals and the word with literals of the result.
+    static bool
+    fold_word (std::vector <tree> &cs, size_t &i)
+    {
+      auto ovl = dynamic_cast <overloaded_builtin const *>
+	(cs[i].m_builtin.get ());
+      if (ovl == nullptr || cs[i].m_builtin->build_pred () != nullptr)
+	return false;
+
+      size_t k = 0;
+      while (k < i && is_literal (cs[i - k - 1]))
+	++k;
+
+      stack_types lit_types;
+      for (size_t j = i - k; j < i; ++j)
+	lit_types.push (cs[j].tt () == tree_type::CONST
+			? value_cst::vtype : value_str::vtype);
+
+      auto pegged = ovl->peg (lit_types);
+      if (pegged == nullptr)
+	return false;
+
+      size_t n = once_arity (pegged->protomap ());
+      if (n > k)
+	return false;
+
+      auto stk = std::make_unique <stack> ();
+      for (size_t j = i - n; j < i; ++j)
+	{
+	  auto v = literal_value (cs[j]);
+	  if (! quiet_arith (*v))
+	    return false;
+	  stk->push (std::move (v));
+	}
+
+      auto result = run_once (*pegged, std::move (stk));
+      if (result == nullptr)
+	return false;
+
+      std::vector <tree> lits;
+      while (result->size () > 0)
+	{
+	  auto v = result->pop ();
+	  tree lit = value_literal (*v);
+	  if (lit.tt () == tree_type::NOP)
+	    return false;
+	  lits.insert (lits.begin (), lit);
+	}
+
+      cs.erase (cs.begin () + (i - n), cs.begin () + (i + 1));
+      cs.insert (cs.begin () + (i - n), lits.begin (), lits.end ());
+      i = i - n + lits.size () - 1;
+      return true;
+    }
+
+  protected:
+    bool
+    visit (tree &t, stack_types const &types) override
+    {
+      switch (t.tt ())
+	{
+	case tree_type::CAT:
+	  {
+	    bool changed = false;
+	    for (size_t i = 0; i < t.m_children.size (); ++i)
+	      if (t.child (i).tt () == tree_type::F_BUILTIN
+		  && fold_word (t.m_children, i))
+		changed = true;
+	    return changed;
+	  }
+
+	case tree_type::ASSERT:
+	  if (static_truth (t.child (0), types) == truth::yes)
+	    {
+	      t = tree {tree_type::NOP};
+	      return true;
+	    }
+	  return false;
+
+	default:
+	  return false;
+	}
+    }
+  };
+
+  class pushdown_walker
+    : public walker
+  {
+  protected:
+    bool
+    visit (tree &t, stack_types const &types) override
+    {
+      if (t.tt () != tree_type::CAT)
+	return false;
+
+      bool changed = false;
+      auto &cs = t.m_children;
+      for (size_t i = 0; i + 1 < cs.size (); ++i)
+	if (cs[i].tt () == tree_type::ALT && is_pred (cs[i + 1]))
+	  {
+	    size_t e = i + 1;
+	    while (e < cs.size () && is_pred (cs[e]))
+	      ++e;
+
+	    // (X, Y) P Q -> (X P Q, Y P Q)
+	    for (auto &branch: cs[i].m_children)
+	      {
+		tree cat {tree_type::CAT};
+		cat.push_child (branch);
+		for (size_t j = i + 1; j < e; ++j)
+		  cat.push_child (cs[j]);
+		branch = cat;
+	      }
+
+	    cs.erase (cs.begin () + i + 1, cs.begin () + e);
+	    changed = true;
+	  }
+
+      return changed;
+    }
+  };
+
+  class hoist_walker
+    : public walker
+  {
+    // Types of values that variables were bound to, where known.
+    std::map <std::pair <scope const *, std::string>, value_type> m_bound;
+
+    // Domains of constants that variables were bound to, where those
+    // are literals of one domain.  Null otherwise.
+    std::map <std::pair <scope const *, std::string>,
+	      constant_dom const *> m_domains;
+
+    // Domain of the constant literal that P pushes, or nullptr.  `let
+    // X := LIT;' pushes it from a sub-expression.
+    static constant_dom const *
+    literal_domain (tree const &p)
+    {
+      tree const *t = &p;
+      if (t->tt () == tree_type::SUBX_EVAL
+	  && t->cst ().value ().uval () == 1)
+	{
+	  t = &t->child (0);
+	  if (t->tt () == tree_type::SCOPE)
+	    t = &t->child (0);
+	}
+
+      return t->tt () == tree_type::CONST ? t->cst ().dom () : nullptr;
+    }
+
+    // Whether predicate P gives the same answer in each iteration of
+    // a closure whose body is nested in DEPTH scopes.  Variables
+    // bound in those scopes may change between iterations, and
+    // reading a variable that holds a closure calls it.
+    bool
+    invariant (tree const &p, size_t depth) const
+    {
+      switch (p.tt ())
+	{
+	case tree_type::CONST:
+	case tree_type::STR:
+	  return true;
+
+	case tree_type::READ:
+	  {
+	    if (p.cst ().value ().uval () < depth)
+	      return false;
+	    auto it = m_bound.find ({p.scp ().get (), p.str ()});
+	    return it != m_bound.end ()
+	      && it->second != stack_types::unknown ()
+	      && it->second != value_closure::vtype;
+	  }
+
+	case tree_type::PRED_NOT:
+	case tree_type::PRED_AND:
+	case tree_type::PRED_OR:
+	  for (auto const &c: p.m_children)
+	    if (! invariant (c, depth))
+	      return false;
+	  return true;
+
+	case tree_type::PRED_SUBX_ANY:
+	  return p.child (0).tt () == tree_type::ASSERT
+	    && invariant (p.child (0).child (0), depth);
+
+	case tree_type::PRED_SUBX_CMP:
+	  return invariant (p.child (0), depth)
+	    && invariant (p.child (1), depth)
+	    && quiet_cmp (p);
+
+	default:
+	  return false;
+	}
+    }
+
+    // Type of value that an invariant operand T pushes.
+    value_type
+    operand_type (tree const &t) const
+    {
+      if (t.tt () == tree_type::READ)
+	return m_bound.find ({t.scp ().get (), t.str ()})->second;
+      return t.tt () == tree_type::CONST ? value_cst::vtype : value_str::vtype;
+    }
+
+    // A value that stands for what an invariant operand T pushes, as
+    // far as quiet_compare is concerned.  Domains of constants that
+    // variables hold are not known, so there's none for those.
+    std::unique_ptr <value>
+    operand_sample (tree const &t) const
+    {
+      if (is_literal (t))
+	return literal_value (t);
+      if (operand_type (t) == value_str::vtype)
+	return std::make_unique <value_str> (std::string (), 0);
+
+      auto it = m_domains.find ({t.scp ().get (), t.str ()});
+      if (operand_type (t) == value_cst::vtype
+	  && it != m_domains.end () && it->second != nullptr)
+	return std::make_unique <value_cst> (constant {0, it->second}, 0);
+
+      return nullptr;
+    }
+
+    // Whether the comparison P of invariant operands is known to
+    // neither warn nor fail to find an overload.  It is evaluated
+    // once up front after hoisting, even when the body of the closure
+    // never reaches it, so it must not have anything to report.
+    bool
+    quiet_cmp (tree const &p) const
+    {
+      if (p.child (2).tt () != tree_type::F_BUILTIN)
+	return false;
+
+      auto va = operand_sample (p.child (0));
+      auto vb = operand_sample (p.child (1));
+      if (va == nullptr || vb == nullptr || ! quiet_compare (*va, *vb))
+	return false;
+
+      auto ovl = dynamic_cast <overloaded_builtin const *>
+	(p.child (2).m_builtin.get ());
+      if (ovl == nullptr)
+	return false;
+
+      stack_types types;
+      types.push (operand_type (p.child (0)));
+      types.push (operand_type (p.child (1)));
+      return ovl->peg (types) != nullptr;
+    }
+
+    // T moves out of one scope.
+    static void
+    lower_reads (tree &t)
+    {
+      if (t.tt () == tree_type::READ)
+	{
+	  size_t depth = t.cst ().value ().uval ();
+	  assert (depth > 0);
+	  t.m_cst = std::make_unique <constant> (depth - 1, nullptr);
+	}
+
+      for (auto &c: t.m_children)
+	lower_reads (c);
+    }
+
+  protected:
+    bool
+    visit (tree &t, stack_types const &types) override
+    {
+      if (t.tt () == tree_type::CAT)
+	{
+	  for (size_t i = 0; i < t.m_children.size (); ++i)
+	    if (t.child (i).tt () == tree_type::BIND)
+	      {
+		auto key = std::make_pair (t.child (i).scp ().get (),
+					   t.child (i).str ());
+		auto dom = i > 0 ? literal_domain (t.child (i - 1)) : nullptr;
+		auto it = m_domains.find (key);
+		if (it == m_domains.end ())
+		  m_domains.insert (std::make_pair (key, dom));
+		else if (it->second != dom)
+		  it->second = nullptr;
+	      }
+	  return false;
+	}
+
+      if (t.tt () == tree_type::BIND)
+	{
+	  auto key = std::make_pair (t.scp ().get (), t.str ());
+	  auto it = m_bound.find (key);
+	  if (it == m_bound.end ())
+	    m_bound.insert (std::make_pair (key, types.at (0)));
+	  else if (it->second != types.at (0))
+	    it->second = stack_types::unknown ();
+	  return false;
+	}
+
+      if (t.tt () != tree_type::CLOSE_STAR)
+	return false;
+
+      tree &body = t.child (0);
+      bool scoped = body.tt () == tree_type::SCOPE;
+      tree &seq = scoped ? body.child (0) : body;
+      if (seq.tt () != tree_type::CAT)
+	return false;
+
+      std::vector <tree> hoisted;
+      std::vector <tree> rest;
+      for (auto const &c: seq.m_children)
+	if (c.tt () == tree_type::ASSERT
+	    && invariant (c.child (0), scoped ? 1 : 0))
+	  hoisted.push_back (c);
+	else
+	  rest.push_back (c);
+
+      if (hoisted.empty () || rest.empty ())
+	return false;
+
+      // (X ?P)* -> if ?P then X* else ()
+      seq.m_children = rest;
+
+      tree cond {tree_type::CAT};
+      for (auto &h: hoisted)
+	{
+	  if (scoped)
+	    lower_reads (h);
+	  cond.push_child (h);
+	}
+
+      tree ifelse {tree_type::IFELSE};
+      ifelse.push_child (cond);
+      ifelse.push_child (t);
+      ifelse.push_child (tree {tree_type::NOP});
+      t = ifelse;
+      return true;
+    }
+  };
+
+  class deadbranch_walker
+    : public walker
+  {
+  protected:
+    bool
+    visit (tree &t, stack_types const &types) override
+    {
+      switch (t.tt ())
+	{
+	case tree_type::ALT:
+	  {
+	    std::vector <tree> live;
+	    for (auto const &branch: t.m_children)
+	      if (! never_yields (branch, types))
+		live.push_back (branch);
+
+	    if (live.size () == t.m_children.size ())
+	      return false;
+
+	    // An alternation with no branches can't be expressed.
+	    // Keep one of them around.
+	    if (live.empty ())
+	      {
+		if (t.m_children.size () == 1)
+		  return false;
+		live.push_back (t.child (0));
+	      }
+
+	    if (live.size () == 1)
+	      t = live.front ();
+	    else
+	      t.m_children = live;
+	    return true;
+	  }
+
+	case tree_type::IFELSE:
+	  if (t.child (0).tt () == tree_type::NOP)
+	    {
+	      t = tree {t.child (1)};
+	      return true;
+	    }
+	  else if (never_yields (t.child (0), types))
+	    {
+	      t = tree {t.child (2)};
+	      return true;
+	    }
+	  return false;
+
+	default:
+	  return false;
+	}
+    }
+  };
+
+  // Each pass makes the tree simpler, so a fixed point should be
+  // reached in a couple rounds.  This is a safety net in case two
+  // passes keep undoing each other's work.
+  constexpr unsigned max_rounds = 16;
+}
+
+std::vector <std::unique_ptr <pass>>
+default_passes ()
+{
+  std::vector <std::unique_ptr <pass>> ret;
+  ret.push_back (std::make_unique <walker_pass <fold_walker>> ("fold"));
+  ret.push_back (std::make_unique <walker_pass <pushdown_walker>>
+		 ("pushdown"));
+  ret.push_back (std::make_unique <walker_pass <hoist_walker>> ("hoist"));
+  ret.push_back (std::make_unique <walker_pass <deadbranch_walker>>
+		 ("deadbranch"));
+  return ret;
+}
+
+void
+optimize (tree &t, std::vector <std::unique_ptr <pass>> const &passes,
+	  std::ostream *trace)
+{
+  if (trace != nullptr)
+    *trace << "parsed: " << t << std::endl;
+
+  for (unsigned round = 0; round < max_rounds; ++round)
+    {
+      bool changed = false;
+      for (auto const &p: passes)
+	if (p->run (t))
+	  {
+	    t.simplify ();
+	    changed = true;
+	    if (trace != nullptr)
+	      *trace << "after " << p->name () << ": " << t << std::endl;
+	  }
+
+      if (! changed)
+	return;
+    }
+}
+
+void
+optimize (tree &t, std::ostream *trace)
+{
+  optimize (t, default_passes (), trace);
+}
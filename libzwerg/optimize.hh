@@ -0,0 +1,77 @@
+/*
+   Copyright (C) 2014 Red Hat, Inc.
+   This file is part of dwgrep.
+
+   This file is free software; you can redistribute it and/or modify
+   it under the terms of either
+
+     * the GNU Lesser General Public License as published by the Free
+       Software Foundation; either version 3 of the License, or (at
+       your option) any later version
+
+   or
+
+     * the GNU General Public License as published by the Free
+       Software Foundation; either version 2 of the License, or (at
+       your option) any later version
+
+   or both in parallel, as here.
+
+   dwgrep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received copies of the GNU General Public License and
+   the GNU Lesser General Public License along with this program.  If
+   not, see <http://www.gnu.org/licenses/>.  */
+
+#ifndef _OPTIMIZE_H_
+#define _OPTIMIZE_H_
+
+#include <iosfwd>
+#include <memory>
+#include <vector>
+
+#include "tree.hh"
+
+// A pass is a rewrite of a simplified tree into an equivalent tree
+// that is presumably cheaper to evaluate.
+class pass
+{
+public:
+  virtual ~pass () {}
+
+  virtual char const *name () const = 0;
+
+  // Rewrite T in place.  Return true if anything changed.
+  virtual bool run (tree &t) const = 0;
+};
+
+// Passes that optimize() runs by default, in order:
+//
+//   fold -- compute arithmetic on literals, and drop assertions that
+//   are known to hold;
+//
+//   pushdown -- move predicates that follow an alternation into its
+//   branches, where they may be fused with the word that yields the
+//   values, or dropped by deadbranch;
+//
+//   hoist -- test predicates whose outcome doesn't change between
+//   iterations of X* once, before the closure is computed;
+//
+//   deadbranch -- drop branches of alternations and conditionals
+//   that are known to never be taken, given types of values that
+//   reach them.
+std::vector <std::unique_ptr <pass>> default_passes ();
+
+// Run PASSES over T repeatedly, until none of them changes anything.
+// T is simplified after each change.  If TRACE is not nullptr, the
+// tree is dumped there after each pass that changed something.
+void optimize (tree &t, std::vector <std::unique_ptr <pass>> const &passes,
+	       std::ostream *trace);
+
+// Same as above, with default_passes ().
+void optimize (tree &t, std::ostream *trace = nullptr);
+
+#endif /* _OPTIMIZE_H_ */
@@ -39,54 +39,89 @@ overload_instance::overload_instance
 {
   for (auto const &v: stencil)
     {
-      auto origin = std::make_shared <op_origin> (nullptr);
-      auto op = std::get <1> (v)->build_exec (origin);
-      auto pred = std::get <1> (v)->build_pred ();
-
-      assert (op != nullptr || pred != nullptr);
+      m_selectors.push_back (std::get <0> (v));
+      m_builtins.push_back (std::get <1> (v));
+    }
 
-      if (op == nullptr)
-	origin = nullptr;
+  m_execs.resize (m_builtins.size ());
+  m_preds.resize (m_builtins.size ());
+  m_execs_tried.resize (m_builtins.size ());
+  m_preds_tried.resize (m_builtins.size ());
 
-      m_selectors.push_back (std::get <0> (v));
-      m_execs.push_back (std::make_pair (origin, op));
-      m_preds.push_back (std::move (pred));
+  assert (m_selectors.size () < ambiguous);
+  for (unsigned code = 0; code < m_dispatch.size (); ++code)
+    {
+      uint16_t &entry = m_dispatch[code];
+      entry = no_match;
+      for (size_t i = 0; i < m_selectors.size (); ++i)
+	if (m_selectors[i].matches_tos (code))
+	  {
+	    if (entry != no_match)
+	      {
+		entry |= ambiguous;
+		break;
+	      }
+	    entry = i;
+	  }
     }
 }
 
-namespace
+ssize_t
+overload_instance::find_selector (selector profile) const
 {
-  ssize_t
-  find_selector (selector profile, std::vector <selector> const &selectors)
-  {
-    auto it = std::find_if (selectors.begin (), selectors.end (),
-			    [profile] (selector const &sel)
-			    { return sel.matches (profile); });
-    if (it == selectors.end ())
-      return -1;
-    else
-      return it - selectors.begin ();
-  }
+  uint16_t entry = m_dispatch[profile.tos_code ()];
+  if (entry == no_match)
+    return -1;
+
+  size_t idx = entry & ~ambiguous;
+  if (m_selectors[idx].matches (profile))
+    return idx;
+  if (! (entry & ambiguous))
+    return -1;
+
+  auto it = std::find_if (m_selectors.begin () + idx + 1, m_selectors.end (),
+			  [profile] (selector const &sel)
+			  { return sel.matches (profile); });
+  if (it == m_selectors.end ())
+    return -1;
+  else
+    return it - m_selectors.begin ();
 }
 
 std::pair <std::shared_ptr <op_origin>, std::shared_ptr <op>>
 overload_instance::find_exec (stack &stk)
 {
-  ssize_t idx = find_selector (selector {stk}, m_selectors);
+  ssize_t idx = find_selector (selector {stk});
   if (idx < 0)
     return {nullptr, nullptr};
-  else
-    return m_execs[idx];
+
+  auto &exec = m_execs[idx];
+  if (! m_execs_tried[idx])
+    {
+      auto origin = std::make_shared <op_origin> (nullptr);
+      if (auto op = m_builtins[idx]->build_exec (origin))
+	exec = std::make_pair (origin, op);
+      m_execs_tried[idx] = true;
+    }
+
+  return exec;
 }
 
 std::shared_ptr <pred>
 overload_instance::find_pred (stack &stk)
 {
-  ssize_t idx = find_selector (selector {stk}, m_selectors);
+  ssize_t idx = find_selector (selector {stk});
   if (idx < 0)
     return nullptr;
-  else
-    return m_preds[idx];
+
+  auto &pred = m_preds[idx];
+  if (! m_preds_tried[idx])
+    {
+      pred = m_builtins[idx]->build_pred ();
+      m_preds_tried[idx] = true;
+    }
+
+  return pred;
 }
 
 static void
@@ -152,6 +187,11 @@ struct overload_op::pimpl
   overload_instance m_ovl_inst;
   std::shared_ptr <op> m_op;
 
+  // Stacks pulled from upstream in a batch that weren't dispatched
+  // yet, starting at M_PENDING_I.
+  stack_batch m_pending;
+  size_t m_pending_i;
+
   void
   reset_me ()
   {
@@ -162,42 +202,84 @@ struct overload_op::pimpl
     : m_upstream {upstream}
     , m_ovl_inst {ovl_inst}
     , m_op {nullptr}
+    , m_pending_i {0}
   {}
 
   stack::uptr
-  next (op &self)
+  next_upstream (size_t max)
+  {
+    if (m_pending_i == m_pending.size ())
+      {
+	m_pending.clear ();
+	m_pending_i = 0;
+	if (max <= 1)
+	  return m_upstream->next ();
+	if (m_upstream->next_batch (m_pending, max) == 0)
+	  return nullptr;
+      }
+
+    return std::move (m_pending[m_pending_i++]);
+  }
+
+  // Point M_OP at the overload that the next upstream stack is
+  // dispatched to.  Return false if upstream is exhausted.
+  bool
+  dispatch (op &self, size_t max)
   {
-    while (true)
+    while (m_op == nullptr)
       {
-	while (m_op == nullptr)
+	if (auto stk = next_upstream (max))
 	  {
-	    if (auto stk = m_upstream->next ())
+	    auto ovl = m_ovl_inst.find_exec (*stk);
+	    if (std::get <0> (ovl) == nullptr)
+	      m_ovl_inst.show_error (self.name (), selector {*stk});
+	    else
 	      {
-		auto ovl = m_ovl_inst.find_exec (*stk);
-		if (std::get <0> (ovl) == nullptr)
-		  m_ovl_inst.show_error (self.name (), selector {*stk});
-		else
-		  {
-		    m_op = std::get <1> (ovl);
-		    m_op->reset ();
-		    std::get <0> (ovl)->set_next (std::move (stk));
-		  }
+		m_op = std::get <1> (ovl);
+		m_op->reset ();
+		std::get <0> (ovl)->set_next (std::move (stk));
 	      }
-	    else
-	      return nullptr;
 	  }
+	else
+	  return false;
+      }
+
+    return true;
+  }
 
+  stack::uptr
+  next (op &self)
+  {
+    while (dispatch (self, 1))
+      {
 	if (auto stk = m_op->next ())
 	  return stk;
 
 	reset_me ();
       }
+
+    return nullptr;
+  }
+
+  size_t
+  next_batch (op &self, stack_batch &out, size_t max)
+  {
+    size_t n = 0;
+    while (n < max && dispatch (self, max))
+      if (size_t m = m_op->next_batch (out, max - n))
+	n += m;
+      else
+	reset_me ();
+
+    return n;
   }
 
   void
   reset ()
   {
     reset_me ();
+    m_pending.clear ();
+    m_pending_i = 0;
     m_upstream->reset ();
   }
 };
@@ -216,6 +298,12 @@ overload_op::next ()
   return m_pimpl->next (*this);
 }
 
+size_t
+overload_op::next_batch (stack_batch &out, size_t max)
+{
+  return m_pimpl->next_batch (*this, out, max);
+}
+
 void
 overload_op::reset ()
 {
@@ -282,6 +370,22 @@ overloaded_op_builtin::create_merged (std::shared_ptr <overload_tab> tab) const
   return std::make_shared <overloaded_op_builtin> (name (), tab);
 }
 
+std::shared_ptr <op>
+reducible_op_builtin::build_exec_fused (std::shared_ptr <op> upstream,
+					tree const &next) const
+{
+  for (auto const &reduction: m_reductions)
+    if (auto op = reduction (upstream, next, *this))
+      return op;
+  return nullptr;
+}
+
+std::shared_ptr <overloaded_builtin>
+reducible_op_builtin::create_merged (std::shared_ptr <overload_tab> tab) const
+{
+  return std::make_shared <reducible_op_builtin> (name (), tab, m_reductions);
+}
+
 namespace
 {
   struct named_overload_pred
@@ -302,6 +406,71 @@ namespace
   };
 }
 
+namespace
+{
+  enum class static_match
+    {
+      yes,
+      no,
+      maybe,
+    };
+
+  static_match
+  match_statically (selector const &sel, stack_types const &types)
+  {
+    // Types of SEL are listed with TOS last.
+    auto vts = sel.get_types ();
+    static_match ret = static_match::yes;
+    for (size_t i = 0; i < vts.size (); ++i)
+      {
+	value_type vt = types.at (vts.size () - 1 - i);
+	if (vt == stack_types::unknown ())
+	  ret = static_match::maybe;
+	else if (vt != vts[i])
+	  return static_match::no;
+      }
+    return ret;
+  }
+}
+
+std::shared_ptr <builtin>
+overloaded_builtin::peg (stack_types const &types) const
+{
+  // The first overload that matches is chosen, so all those before
+  // the pegged one need to be known not to match.
+  for (auto const &ovl: m_ovl_tab->get_overloads ())
+    switch (match_statically (std::get <0> (ovl), types))
+      {
+      case static_match::yes:
+	return std::get <1> (ovl);
+      case static_match::maybe:
+	return nullptr;
+      case static_match::no:
+	break;
+      }
+
+  return nullptr;
+}
+
+void
+overloaded_builtin::apply_effect (stack_types &types) const
+{
+  builtin_protomap pm;
+  for (auto const &ovl: m_ovl_tab->get_overloads ())
+    if (match_statically (std::get <0> (ovl), types) != static_match::no)
+      {
+	auto pm1 = std::get <1> (ovl)->protomap ();
+	if (pm1.empty ())
+	  {
+	    types.forget ();
+	    return;
+	  }
+	pm.insert (pm.end (), pm1.begin (), pm1.end ());
+      }
+
+  types.apply (pm);
+}
+
 std::unique_ptr <pred>
 overloaded_pred_builtin::build_pred () const
 {
@@ -29,6 +29,8 @@
 #ifndef _OVERLOAD_H_
 #define _OVERLOAD_H_
 
+#include <array>
+#include <functional>
 #include <vector>
 #include <tuple>
 #include "std-memory.hh"
@@ -68,9 +70,28 @@
 class overload_instance
 {
   std::vector <selector> m_selectors;
+
+  // Dispatch table indexed by type code of TOS.  Each entry holds the
+  // index of the first selector that may match such a profile, or
+  // no_match.  If further selectors might match as well, the
+  // ambiguous bit is set, and the remaining selectors are scanned
+  // should the first one not match in full.
+  static uint16_t const no_match = 0xffff;
+  static uint16_t const ambiguous = 0x8000;
+  std::array <uint16_t, 256> m_dispatch;
+
+  ssize_t find_selector (selector profile) const;
+
+  // Overloads are only built when a stack is first dispatched to
+  // them.  Most queries only ever hit a handful of the overloads of
+  // each word.  Some overloads have no exec (or no pred), so it's
+  // remembered which builds were tried.
+  std::vector <std::shared_ptr <builtin>> m_builtins;
   std::vector <std::pair <std::shared_ptr <op_origin>,
 			  std::shared_ptr <op>>> m_execs;
   std::vector <std::shared_ptr <pred>> m_preds;
+  std::vector <bool> m_execs_tried;
+  std::vector <bool> m_preds_tried;
 
 public:
   overload_instance (std::vector
@@ -118,6 +139,7 @@ public:
   ~overload_op ();
 
   stack::uptr next () override final;
+  size_t next_batch (stack_batch &out, size_t max) override final;
   void reset () override final;
 };
 
@@ -165,6 +187,15 @@ public:
 
   virtual std::shared_ptr <overloaded_builtin>
   create_merged (std::shared_ptr <overload_tab> tab) const = 0;
+
+  // Return the overload that stacks described by TYPES are certain
+  // to be dispatched to, or nullptr if that can't be determined.
+  std::shared_ptr <builtin> peg (stack_types const &types) const;
+
+  // Apply to TYPES the stack effect of this word, as far as it can be
+  // determined from prototypes of those overloads that TYPES might
+  // be dispatched to.
+  void apply_effect (stack_types &types) const;
 };
 
 // Base class for overloaded operation builtins.
@@ -177,7 +208,176 @@ struct overloaded_op_builtin
     const override final;
 
   std::shared_ptr <overloaded_builtin>
-  create_merged (std::shared_ptr <overload_tab> tab) const override final;
+  create_merged (std::shared_ptr <overload_tab> tab) const override;
+};
+
+// A reduction point recognizes an expression NEXT that can be
+// computed together with word SELF more cheaply than after it (see
+// builtin::build_exec_fused), and builds an op that does so.  It
+// returns nullptr if NEXT isn't recognized.
+using reduction_point = std::function
+  <std::shared_ptr <op> (std::shared_ptr <op> upstream, tree const &next,
+			 builtin const &self)>;
+
+// Overloaded operation builtin with reduction points.  They are tried
+// in turn, and the first one that recognizes NEXT builds the op.
+struct reducible_op_builtin
+  : public overloaded_op_builtin
+{
+  std::vector <reduction_point> m_reductions;
+
+  reducible_op_builtin (char const *name, std::shared_ptr <overload_tab> t,
+			std::vector <reduction_point> reductions)
+    : overloaded_op_builtin {name, t}
+    , m_reductions {std::move (reductions)}
+  {}
+
+  std::shared_ptr <op>
+  build_exec_fused (std::shared_ptr <op> upstream,
+		    tree const &next) const override;
+
+  std::shared_ptr <overloaded_builtin>
+  create_merged (std::shared_ptr <overload_tab> tab) const override;
+};
+
+// Reduced form of `W NEXT'.  For operands that a subclass recognizes
+// (see make_producer), values come from a producer instead of from
+// W.  That yields a superset of what `W NEXT' would, with the same
+// positions, and each value is checked against VERIFY, unless that
+// is nullptr.  Stacks with other operands are handed over to the
+// unreduced computation.
+template <class RT>
+class op_reduced_base
+  : public inner_op
+{
+  std::unique_ptr <pred> m_verify;
+  std::string m_name;
+
+  std::shared_ptr <op_origin> m_origin;
+  std::shared_ptr <op> m_op;
+  bool m_in_op;
+
+  stack::uptr m_stk;
+  std::unique_ptr <value_producer <RT>> m_prod;
+
+  void
+  reset_me ()
+  {
+    m_in_op = false;
+    m_stk = nullptr;
+    m_prod = nullptr;
+  }
+
+protected:
+  // If the operand on top of STK is recognized, pop it, store into
+  // RET a producer of values for it, and return true.
+  virtual bool make_producer (stack &stk,
+			      std::unique_ptr <value_producer <RT>> &ret) = 0;
+
+public:
+  op_reduced_base (std::shared_ptr <op> upstream,
+		   std::unique_ptr <pred> verify,
+		   builtin const &self, tree const &next)
+    : inner_op {upstream}
+    , m_verify {std::move (verify)}
+    , m_origin {std::make_shared <op_origin> (nullptr)}
+    , m_op {next.build_exec (self.build_exec (m_origin))}
+    , m_in_op {false}
+  {
+    m_name = std::string (self.name ()) + "<" + m_op->name () + ">";
+  }
+
+  stack::uptr
+  next () override
+  {
+    while (true)
+      {
+	if (m_in_op)
+	  {
+	    if (auto stk = m_op->next ())
+	      return stk;
+	    m_in_op = false;
+	  }
+
+	if (m_prod != nullptr)
+	  {
+	    if (auto v = m_prod->next ())
+	      {
+		auto ret = std::make_unique <stack> (*m_stk);
+		ret->push (std::move (v));
+		if (m_verify == nullptr
+		    || m_verify->result (*ret) == pred_result::yes)
+		  return ret;
+		continue;
+	      }
+	    m_prod = nullptr;
+	  }
+
+	auto stk = m_upstream->next ();
+	if (stk == nullptr)
+	  return nullptr;
+
+	if (stk->size () > 0 && make_producer (*stk, m_prod))
+	  {
+	    m_stk = std::move (stk);
+	    continue;
+	  }
+
+	m_op->reset ();
+	m_origin->set_next (std::move (stk));
+	m_in_op = true;
+      }
+  }
+
+  void
+  reset () override
+  {
+    reset_me ();
+    if (m_verify != nullptr)
+      m_verify->reset ();
+    m_op->reset ();
+    inner_op::reset ();
+  }
+
+  std::string
+  name () const override
+  {
+    return m_name;
+  }
+};
+
+// Reduced form of `W NEXT', where W is an overloaded word that for
+// an operand of type VT yields values of type RT.  For such operands,
+// values come from a producer made by MAKER.
+template <class RT, class VT>
+class op_reduced
+  : public op_reduced_base <RT>
+{
+public:
+  using maker_t = std::function
+    <std::unique_ptr <value_producer <RT>> (std::unique_ptr <VT>)>;
+
+private:
+  maker_t m_maker;
+
+protected:
+  bool
+  make_producer (stack &stk,
+		 std::unique_ptr <value_producer <RT>> &ret) override
+  {
+    if (! stk.top ().is <VT> ())
+      return false;
+    ret = m_maker (stk.pop_as <VT> ());
+    return true;
+  }
+
+public:
+  op_reduced (std::shared_ptr <op> upstream, maker_t maker,
+	      std::unique_ptr <pred> verify,
+	      builtin const &self, tree const &next)
+    : op_reduced_base <RT> {upstream, std::move (verify), self, next}
+    , m_maker {maker}
+  {}
 };
 
 // Base class for overloaded predicate builtins.
@@ -417,6 +617,31 @@ public:
     return nullptr;
   }
 
+  size_t
+  next_batch (stack_batch &out, size_t max) override final
+  {
+    size_t const start = out.size ();
+    while (out.size () == start)
+      {
+	if (this->m_upstream->next_batch (out, max) == 0)
+	  return 0;
+
+	filter_batch
+	  (out, start, [this] (stack &stk)
+	   {
+	     auto nv = call_operate
+	       (std::index_sequence_for <VT...> {},
+		op_overload_impl <VT...>::template collect <0, VT...> (stk));
+	     if (nv == nullptr)
+	       return false;
+	     stk.push (std::move (nv));
+	     return true;
+	   });
+      }
+
+    return out.size () - start;
+  }
+
   virtual std::unique_ptr <RT> operate (std::unique_ptr <VT>... vals) = 0;
 
   static builtin_protomap
@@ -461,6 +686,26 @@ public:
     return nullptr;
   }
 
+  size_t
+  next_batch (stack_batch &out, size_t max) override final
+  {
+    size_t const start = out.size ();
+    if (this->m_upstream->next_batch (out, max) == 0)
+      return 0;
+
+    filter_batch
+      (out, start, [this] (stack &stk)
+       {
+	 auto ret = call_operate
+		(std::index_sequence_for <VT...> {},
+		 op_overload_impl <VT...>::template collect <0, VT...> (stk));
+	 stk.push (std::make_unique <RT> (std::move (ret)));
+	 return true;
+       });
+
+    return out.size () - start;
+  }
+
   virtual RT operate (std::unique_ptr <VT>... vals) = 0;
 
   static builtin_protomap
@@ -485,16 +730,66 @@ class op_yielding_overload
     return operate (std::move (std::get <I> (args))...);
   }
 
+  template <size_t... I>
+  bool
+  call_operate_single (std::index_sequence <I...>,
+		       std::tuple <std::unique_ptr <VT>...> &args,
+		       std::unique_ptr <RT> &ret)
+  {
+    return operate_single (ret, *std::get <I> (args)...);
+  }
+
   stack::uptr m_stk;
   std::unique_ptr <value_producer <RT>> m_prod;
 
+  // The value that operate_single yielded for M_STK, if any.
+  std::unique_ptr <RT> m_single;
+
+  // Scratch space for values that next_batch gets from M_PROD.
+  std::vector <std::unique_ptr <RT>> m_vals;
+
   void
   reset_me ()
   {
     m_prod = nullptr;
+    m_single = nullptr;
     m_stk = nullptr;
   }
 
+  bool
+  pending () const
+  {
+    return m_prod != nullptr || m_single != nullptr;
+  }
+
+  bool
+  start_next ()
+  {
+    if (auto stk = this->m_upstream->next ())
+      {
+	auto args = op_overload_impl <VT...>::template collect <0, VT...> (*stk);
+	m_stk = std::move (stk);
+	if (! call_operate_single (std::index_sequence_for <VT...> {},
+				   args, m_single))
+	  m_prod = call_operate (std::index_sequence_for <VT...> {},
+				 std::move (args));
+	return true;
+      }
+
+    return false;
+  }
+
+  // The stack is not needed after its single value has been
+  // yielded, so it is reused for the result instead of copied.
+  stack::uptr
+  yield_single ()
+  {
+    auto ret = std::move (m_stk);
+    ret->push (std::move (m_single));
+    reset_me ();
+    return ret;
+  }
+
 public:
   op_yielding_overload (std::shared_ptr <op> upstream)
     : stub_op {upstream}
@@ -505,17 +800,13 @@ public:
   {
     while (true)
       {
-	while (m_prod == nullptr)
-	  if (auto stk = this->m_upstream->next ())
-	    {
-	      m_prod = call_operate
-		(std::index_sequence_for <VT...> {},
-		 op_overload_impl <VT...>::template collect <0, VT...> (*stk));
-	      m_stk = std::move (stk);
-	    }
-	  else
+	while (! pending ())
+	  if (! start_next ())
 	    return nullptr;
 
+	if (m_single != nullptr)
+	  return yield_single ();
+
 	if (auto v = m_prod->next ())
 	  {
 	    auto ret = std::make_unique <stack> (*m_stk);
@@ -527,6 +818,55 @@ public:
       }
   }
 
+  size_t
+  next_batch (stack_batch &out, size_t max) override final
+  {
+    size_t n = 0;
+    while (n < max)
+      {
+	while (! pending ())
+	  if (! start_next ())
+	    return n;
+
+	if (m_single != nullptr)
+	  {
+	    out.push_back (yield_single ());
+	    ++n;
+	    continue;
+	  }
+
+	// Values produced before a failure are still results.
+	auto flush = [&] ()
+	  {
+	    for (auto &v: m_vals)
+	      {
+		auto ret = std::make_unique <stack> (*m_stk);
+		ret->push (std::move (v));
+		out.push_back (std::move (ret));
+	      }
+	    n += m_vals.size ();
+	    m_vals.clear ();
+	  };
+
+	try
+	  {
+	    if (m_prod->next_batch (m_vals, max - n) == 0)
+	      {
+		reset_me ();
+		continue;
+	      }
+	  }
+	catch (...)
+	  {
+	    flush ();
+	    throw;
+	  }
+	flush ();
+      }
+
+    return n;
+  }
+
   void
   reset () override
   {
@@ -537,6 +877,16 @@ public:
   virtual std::unique_ptr <value_producer <RT>>
 	operate (std::unique_ptr <VT>... vals) = 0;
 
+  // Overloads that mostly yield exactly one value can decode it here
+  // and skip allocating a producer.  Return true if VALS were
+  // handled, with RET set to the yielded value, or to nullptr if
+  // there is none.  Return false to have operate called instead.
+  virtual bool
+  operate_single (std::unique_ptr <RT> &ret, VT &... vals)
+  {
+    return false;
+  }
+
   static builtin_protomap
   protomap ()
   {
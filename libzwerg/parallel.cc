@@ -0,0 +1,469 @@
+/*
+   Copyright (C) 2014 Red Hat, Inc.
+   This file is part of dwgrep.
+
+   This file is free software; you can redistribute it and/or modify
+   it under the terms of either
+
+     * the GNU Lesser General Public License as published by the Free
+       Software Foundation; either version 3 of the License, or (at
+       your option) any later version
+
+   or
+
+     * the GNU General Public License as published by the Free
+       Software Foundation; either version 2 of the License, or (at
+       your option) any later version
+
+   or both in parallel, as here.
+
+   dwgrep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received copies of the GNU General Public License and
+   the GNU Lesser General Public License along with this program.  If
+   not, see <http://www.gnu.org/licenses/>.  */
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+#include "builtin-dw.hh"
+#include "dwit.hh"
+#include "dwpp.hh"
+#include "parallel.hh"
+#include "value-dw.hh"
+
+namespace
+{
+  // Decide whether QUERY is of the form `[raw|cooked]... (unit |
+  // entry) REST'.  If it is, store into REST the query that should be
+  // evaluated on each unit, and into D the doneness of those units.
+  bool
+  split_unit_query (tree const &query, doneness &d, tree &rest)
+  {
+    std::vector <tree> words;
+    if (query.tt () == tree_type::CAT)
+      words = query.m_children;
+    else
+      words.push_back (query);
+
+    for (size_t i = 0; i < words.size (); ++i)
+      {
+	if (words[i].tt () != tree_type::F_BUILTIN)
+	  return false;
+
+	std::string name = words[i].m_builtin->name ();
+	if (name == "raw")
+	  d = doneness::raw;
+	else if (name == "cooked")
+	  d = doneness::cooked;
+	else if (name == "unit" || name == "entry")
+	  {
+	    // `entry' on a Dwarf behaves like `unit entry', so it stays
+	    // in REST to be applied to each unit.
+	    if (name == "unit")
+	      ++i;
+
+	    rest = tree {tree_type::CAT};
+	    rest.m_children.assign (words.begin () + i, words.end ());
+	    return true;
+	  }
+	else
+	  return false;
+      }
+
+    return false;
+  }
+
+  struct unit_ref
+  {
+    // Index into all_dwarfs.
+    size_t m_dwarf;
+
+    // Offset of CU DIE.
+    Dwarf_Off m_offset;
+
+    // Position of this unit in the sequence that `unit' would yield.
+    size_t m_pos;
+  };
+
+  // An origin that yields, for each unit in a given range, a copy of
+  // the base stack with that unit pushed on top.
+  class op_unit_origin
+    : public op
+  {
+    std::shared_ptr <dwfl_context> m_dwctx;
+    std::vector <Dwarf *> m_dwarfs;
+    stack const &m_base;
+    unit_ref const *m_begin;
+    unit_ref const *m_end;
+    unit_ref const *m_it;
+    doneness m_doneness;
+
+  public:
+    op_unit_origin (stack const &base, doneness d)
+      : m_base (base)
+      , m_begin {nullptr}
+      , m_end {nullptr}
+      , m_it {nullptr}
+      , m_doneness {d}
+    {}
+
+    // Yield units from BEGIN to END of DWCTX next.  Takes effect on
+    // reset.
+    void
+    set_range (std::shared_ptr <dwfl_context> dwctx,
+	       unit_ref const *begin, unit_ref const *end)
+    {
+      m_dwctx = dwctx;
+      m_dwarfs = all_dwarfs (*dwctx);
+      m_begin = begin;
+      m_end = end;
+    }
+
+    stack::uptr
+    next () override
+    {
+      if (m_it == m_end)
+	return nullptr;
+
+      unit_ref const &ref = *m_it++;
+      Dwarf *dw = m_dwarfs[ref.m_dwarf];
+
+      Dwarf_Die cudie;
+      if (dwarf_offdie (dw, ref.m_offset, &cudie) == nullptr)
+	throw_libdw ();
+      cu_iterator cuit {dw, cudie};
+
+      auto stk = std::make_unique <stack> (m_base);
+      stk->push (std::make_unique <value_cu> (m_dwctx, *(*cuit)->cu,
+					       cuit.offset (), ref.m_pos,
+					       m_doneness));
+      return stk;
+    }
+
+    void
+    reset () override
+    {
+      m_it = m_begin;
+    }
+
+    std::string
+    name () const override
+    {
+      return "unit_origin";
+    }
+  };
+
+  class op_parallel_units
+    : public op
+  {
+    struct chunk
+    {
+      size_t m_begin;
+      size_t m_end;
+      std::vector <stack::uptr> m_results;
+      std::exception_ptr m_error;
+      bool m_done;
+    };
+
+    tree m_rest;
+    stack m_base;
+    std::string m_fn;
+    std::shared_ptr <dwctx_registry> m_dwctxs;
+    doneness m_doneness;
+    std::vector <unit_ref> m_units;
+    std::vector <chunk> m_chunks;
+    unsigned m_nthreads;
+    bool m_ordered;
+
+    std::vector <std::thread> m_workers;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::atomic <bool> m_cancel;
+
+    // Chunks are claimed by workers in order.  Workers don't run
+    // ahead of the consumer by more than a couple chunks, so that
+    // results of a slow chunk don't pile up unbounded number of
+    // finished ones.
+    size_t m_next_claim;
+    size_t m_taken;
+    std::deque <size_t> m_finished;
+
+    // Chunk currently being drained, and position within it.
+    chunk *m_cur;
+    size_t m_pos;
+
+    bool m_started;
+
+    size_t
+    window () const
+    {
+      return 2 * m_nthreads;
+    }
+
+    // Each chunk is evaluated on a handle of the file of its own.
+    // Results of the chunk are read by the consumer while workers go
+    // on evaluating other chunks, and libdw handles must not be used
+    // from two threads at once.  The op graph is built once per
+    // worker, and reused for all chunks that the worker claims.
+    struct worker_state
+    {
+      std::shared_ptr <op_unit_origin> m_origin;
+      std::shared_ptr <op> m_op;
+    };
+
+    void
+    run_chunk (chunk &c, worker_state &ws)
+    {
+      if (ws.m_op == nullptr)
+	{
+	  ws.m_origin = std::make_shared <op_unit_origin> (m_base, m_doneness);
+
+	  stack_types types {m_base};
+	  types.push (value_cu::vtype);
+	  ws.m_op = m_rest.build_exec (ws.m_origin, types);
+	}
+
+      auto dwctx = std::make_shared <dwfl_context> (open_dwfl (m_fn));
+      m_dwctxs->add (dwctx);
+
+      ws.m_origin->set_range (dwctx, m_units.data () + c.m_begin,
+			      m_units.data () + c.m_end);
+      ws.m_op->reset ();
+      while (auto stk = ws.m_op->next ())
+	{
+	  if (m_cancel)
+	    return;
+	  c.m_results.push_back (std::move (stk));
+	}
+
+      // Drop the graph's references to the chunk's handle before the
+      // results are handed out.
+      ws.m_op->reset ();
+    }
+
+    void
+    work ()
+    {
+      dwctx_scope scope {*m_dwctxs};
+      worker_state ws;
+      while (true)
+	{
+	  chunk *c;
+	  {
+	    std::unique_lock <std::mutex> lock {m_mutex};
+	    m_cv.wait (lock, [this] () {
+		return m_cancel
+		  || m_next_claim >= m_chunks.size ()
+		  || m_next_claim < m_taken + window ();
+	      });
+	    if (m_cancel || m_next_claim >= m_chunks.size ())
+	      return;
+	    c = &m_chunks[m_next_claim++];
+	  }
+
+	  try
+	    {
+	      run_chunk (*c, ws);
+	    }
+	  catch (...)
+	    {
+	      c->m_error = std::current_exception ();
+	    }
+
+	  {
+	    std::lock_guard <std::mutex> lock {m_mutex};
+	    c->m_done = true;
+	    m_finished.push_back (c - m_chunks.data ());
+	  }
+	  m_cv.notify_all ();
+	}
+    }
+
+    void
+    start ()
+    {
+      m_started = true;
+      size_t n = std::min <size_t> (m_nthreads, m_chunks.size ());
+      for (size_t i = 0; i < n; ++i)
+	m_workers.emplace_back (&op_parallel_units::work, this);
+    }
+
+    void
+    stop ()
+    {
+      {
+	std::lock_guard <std::mutex> lock {m_mutex};
+	m_cancel = true;
+      }
+      m_cv.notify_all ();
+
+      for (auto &w: m_workers)
+	w.join ();
+      m_workers.clear ();
+    }
+
+    chunk *
+    take_chunk ()
+    {
+      std::unique_lock <std::mutex> lock {m_mutex};
+
+      chunk *c;
+      if (m_ordered)
+	{
+	  c = &m_chunks[m_taken];
+	  m_cv.wait (lock, [c] () { return c->m_done; });
+	}
+      else
+	{
+	  m_cv.wait (lock, [this] () { return ! m_finished.empty (); });
+	  c = &m_chunks[m_finished.front ()];
+	  m_finished.pop_front ();
+	}
+
+      ++m_taken;
+      lock.unlock ();
+      m_cv.notify_all ();
+
+      return c;
+    }
+
+  public:
+    op_parallel_units (tree const &rest, stack::uptr base,
+		       std::string const &fn, doneness d,
+		       std::vector <unit_ref> units,
+		       unsigned nthreads, bool ordered,
+		       std::shared_ptr <dwctx_registry> dwctxs)
+      : m_rest {rest}
+      , m_base {std::move (*base)}
+      , m_fn {fn}
+      , m_dwctxs {dwctxs}
+      , m_doneness {d}
+      , m_units {std::move (units)}
+      , m_nthreads {nthreads}
+      , m_ordered {ordered}
+      , m_cancel {false}
+      , m_next_claim {0}
+      , m_taken {0}
+      , m_cur {nullptr}
+      , m_pos {0}
+      , m_started {false}
+    {
+      assert (m_nthreads > 0);
+
+      // Make a couple chunks per thread, so that a particularly
+      // heavy unit doesn't stall all the others.
+      size_t nchunks = std::min <size_t> (m_units.size (), 8 * m_nthreads);
+      for (size_t i = 0; i < nchunks; ++i)
+	m_chunks.push_back ({m_units.size () * i / nchunks,
+			     m_units.size () * (i + 1) / nchunks,
+			     {}, nullptr, false});
+    }
+
+    ~op_parallel_units ()
+    {
+      stop ();
+    }
+
+    stack::uptr
+    next () override
+    {
+      if (! m_started)
+	start ();
+
+      while (true)
+	{
+	  if (m_cur != nullptr)
+	    {
+	      if (m_pos < m_cur->m_results.size ())
+		return std::move (m_cur->m_results[m_pos++]);
+
+	      // Release storage of the chunk once its results are all
+	      // handed out.
+	      m_cur->m_results.clear ();
+	      m_cur->m_results.shrink_to_fit ();
+	      m_cur = nullptr;
+	    }
+
+	  if (m_taken == m_chunks.size ())
+	    return nullptr;
+
+	  m_cur = take_chunk ();
+	  m_pos = 0;
+	  if (m_cur->m_error != nullptr)
+	    std::rethrow_exception (m_cur->m_error);
+	}
+    }
+
+    void
+    reset () override
+    {
+      stop ();
+
+      for (auto &c: m_chunks)
+	{
+	  c.m_results.clear ();
+	  c.m_error = nullptr;
+	  c.m_done = false;
+	}
+
+      m_cancel = false;
+      m_next_claim = 0;
+      m_taken = 0;
+      m_finished.clear ();
+      m_cur = nullptr;
+      m_pos = 0;
+      m_started = false;
+    }
+
+    std::string
+    name () const override
+    {
+      return "parallel_units";
+    }
+  };
+}
+
+std::shared_ptr <op>
+build_parallel_exec (tree const &query, stack const &input,
+		     unsigned nthreads, bool ordered,
+		     std::shared_ptr <dwctx_registry> dwctxs)
+{
+  if (input.size () == 0)
+    return nullptr;
+
+  auto base = std::make_unique <stack> (input);
+  auto dw = base->top_as <value_dwarf> ();
+  if (dw == nullptr)
+    return nullptr;
+
+  doneness d = dw->get_doneness ();
+  tree rest;
+  if (! split_unit_query (query, d, rest))
+    return nullptr;
+
+  // Enumerate units in the same order that `unit' would yield them.
+  std::vector <unit_ref> units;
+  std::vector <Dwarf *> dwarfs = all_dwarfs (*dw->get_dwctx ());
+  size_t pos = 0;
+  for (size_t i = 0; i < dwarfs.size (); ++i)
+    for (cu_iterator it {dwarfs[i]};
+	 it != cu_iterator::end () && next_acceptable_unit (d, it); ++it)
+      units.push_back ({i, dwarf_dieoffset (*it), pos++});
+
+  std::string fn = dw->get_fn ();
+  base->pop ();
+
+  return std::make_shared <op_parallel_units>
+    (rest, std::move (base), fn, d, std::move (units), nthreads, ordered,
+     dwctxs);
+}
@@ -0,0 +1,63 @@
+/*
+   Copyright (C) 2014 Red Hat, Inc.
+   This file is part of dwgrep.
+
+   This file is free software; you can redistribute it and/or modify
+   it under the terms of either
+
+     * the GNU Lesser General Public License as published by the Free
+       Software Foundation; either version 3 of the License, or (at
+       your option) any later version
+
+   or
+
+     * the GNU General Public License as published by the Free
+       Software Foundation; either version 2 of the License, or (at
+       your option) any later version
+
+   or both in parallel, as here.
+
+   dwgrep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received copies of the GNU General Public License and
+   the GNU Lesser General Public License along with this program.  If
+   not, see <http://www.gnu.org/licenses/>.  */
+
+#ifndef _PARALLEL_H_
+#define _PARALLEL_H_
+
+#include <memory>
+
+#include "dwfl_context.hh"
+#include "op.hh"
+#include "tree.hh"
+
+// Build an op that evaluates QUERY on INPUT, spreading the work among
+// NTHREADS worker threads.
+//
+// This only works for queries of the form `[raw|cooked]... (unit |
+// entry) REST' applied to a Dwarf.  The units of the Dwarf are split
+// into chunks, and REST is evaluated on each chunk separately, on a
+// handle of the file of its own.  Results of a chunk are handed out
+// once the chunk is finished, and as no worker uses its handle after
+// that, the consumer can read them without racing any worker.
+//
+// When ORDERED, results come in the same order as they would from a
+// sequential evaluation, otherwise in the order in which chunks are
+// finished.
+//
+// Results refer to the chunks' handles, whose contexts are added to
+// DWCTXS.  Workers evaluate REST in a dwctx_scope of DWCTXS, so
+// contexts that REST opens end up there as well.
+//
+// Returns nullptr if QUERY is not of the above form, or if there's
+// no Dwarf on top of INPUT.
+std::shared_ptr <op>
+build_parallel_exec (tree const &query, stack const &input,
+		     unsigned nthreads, bool ordered,
+		     std::shared_ptr <dwctx_registry> dwctxs);
+
+#endif /* _PARALLEL_H_ */
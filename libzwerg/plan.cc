@@ -0,0 +1,85 @@
+/*
+   Copyright (C) 2014 Red Hat, Inc.
+   This file is part of dwgrep.
+
+   This file is free software; you can redistribute it and/or modify
+   it under the terms of either
+
+     * the GNU Lesser General Public License as published by the Free
+       Software Foundation; either version 3 of the License, or (at
+       your option) any later version
+
+   or
+
+     * the GNU General Public License as published by the Free
+       Software Foundation; either version 2 of the License, or (at
+       your option) any later version
+
+   or both in parallel, as here.
+
+   dwgrep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received copies of the GNU General Public License and
+   the GNU Lesser General Public License along with this program.  If
+   not, see <http://www.gnu.org/licenses/>.  */
+
+#include "plan.hh"
+#include "std-memory.hh"
+
+query_plan::query_plan (tree const &query)
+  : m_query {query}
+{}
+
+std::shared_ptr <op>
+query_plan::bind (stack::uptr stk)
+{
+  stack_types types {*stk};
+  if (m_op == nullptr || ! (types == m_types))
+    {
+      m_origin = std::make_shared <op_origin> (nullptr);
+      m_types = types;
+      m_op = m_query.build_exec (m_origin, types);
+    }
+
+  m_op->reset ();
+  m_origin->set_next (std::move (stk));
+  return m_op;
+}
+
+void
+query_plan::reset ()
+{
+  if (m_op != nullptr)
+    m_op->reset ();
+}
+
+query_plan_pool::query_plan_pool (tree const &query)
+  : m_query {query}
+{}
+
+std::unique_ptr <query_plan>
+query_plan_pool::get ()
+{
+  {
+    std::lock_guard <std::mutex> lock {m_mutex};
+    if (! m_plans.empty ())
+      {
+	auto ret = std::move (m_plans.back ());
+	m_plans.pop_back ();
+	return ret;
+      }
+  }
+
+  return std::make_unique <query_plan> (m_query);
+}
+
+void
+query_plan_pool::put (std::unique_ptr <query_plan> plan)
+{
+  plan->reset ();
+  std::lock_guard <std::mutex> lock {m_mutex};
+  m_plans.push_back (std::move (plan));
+}
@@ -0,0 +1,91 @@
+/*
+   Copyright (C) 2014 Red Hat, Inc.
+   This file is part of dwgrep.
+
+   This file is free software; you can redistribute it and/or modify
+   it under the terms of either
+
+     * the GNU Lesser General Public License as published by the Free
+       Software Foundation; either version 3 of the License, or (at
+       your option) any later version
+
+   or
+
+     * the GNU General Public License as published by the Free
+       Software Foundation; either version 2 of the License, or (at
+       your option) any later version
+
+   or both in parallel, as here.
+
+   dwgrep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received copies of the GNU General Public License and
+   the GNU Lesser General Public License along with this program.  If
+   not, see <http://www.gnu.org/licenses/>.  */
+
+#ifndef _PLAN_H_
+#define _PLAN_H_
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "builtin.hh"
+#include "op.hh"
+#include "tree.hh"
+
+// A query that's built into an op graph once, and then evaluated on
+// any number of input stacks.  Binding the plan to a new input
+// resets the graph and feeds it that input, which is much cheaper
+// than building the graph anew.
+//
+// The graph is built for stacks of a particular profile (see
+// stack_types), such as a single Dwarf.  It is rebuilt only when an
+// input of a different profile is bound.
+//
+// A plan evaluates one input at a time: binding it again ends the
+// evaluation of the previous input.
+class query_plan
+{
+  tree m_query;
+  std::shared_ptr <op_origin> m_origin;
+  std::shared_ptr <op> m_op;
+  stack_types m_types;
+
+public:
+  explicit query_plan (tree const &query);
+
+  // Bind the plan to STK, and return the op that yields results of
+  // the query.
+  std::shared_ptr <op> bind (stack::uptr stk);
+
+  // End evaluation of the current input, and drop any references
+  // that the graph holds to it.
+  void reset ();
+};
+
+// Plans of one query that aren't currently in use.  Whoever
+// evaluates the query takes a plan from the pool, and puts it back
+// when done, so that a query that is run over many inputs is only
+// built into an op graph once per concurrent evaluation.  The pool
+// can be used from several threads at once.
+class query_plan_pool
+{
+  tree m_query;
+  std::mutex m_mutex;
+  std::vector <std::unique_ptr <query_plan>> m_plans;
+
+public:
+  explicit query_plan_pool (tree const &query);
+
+  // Take a plan from the pool, or make a new one if there's none.
+  std::unique_ptr <query_plan> get ();
+
+  // Reset PLAN and return it to the pool.
+  void put (std::unique_ptr <query_plan> plan);
+};
+
+#endif /* _PLAN_H_ */
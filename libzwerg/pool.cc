@@ -0,0 +1,132 @@
+/*
+   Copyright (C) 2014 Red Hat, Inc.
+   This file is part of dwgrep.
+
+   This file is free software; you can redistribute it and/or modify
+   it under the terms of either
+
+     * the GNU Lesser General Public License as published by the Free
+       Software Foundation; either version 3 of the License, or (at
+       your option) any later version
+
+   or
+
+     * the GNU General Public License as published by the Free
+       Software Foundation; either version 2 of the License, or (at
+       your option) any later version
+
+   or both in parallel, as here.
+
+   dwgrep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received copies of the GNU General Public License and
+   the GNU Lesser General Public License along with this program.  If
+   not, see <http://www.gnu.org/licenses/>.  */
+
+#include <new>
+
+#include "pool.hh"
+
+namespace
+{
+  // Blocks are handed out in multiples of GRANULE bytes, up to
+  // NCLASSES * GRANULE.  Larger requests go straight to the global
+  // allocator.  At most MAX_FREE blocks per size class are kept
+  // around, so that a burst of allocations doesn't pin memory
+  // forever.
+  constexpr size_t granule = 16;
+  constexpr size_t nclasses = 16;
+  constexpr unsigned max_free = 1024;
+
+  struct free_block
+  {
+    free_block *m_next;
+  };
+
+  // This has to be trivially destructible, so that it stays usable
+  // while other thread-local objects (which may hold values) are
+  // being torn down.
+  struct pool_state
+  {
+    free_block *m_heads[nclasses];
+    unsigned m_counts[nclasses];
+    bool m_registered;
+    bool m_dead;
+  };
+
+  thread_local pool_state state;
+
+  // Returns the free lists to the global heap at thread exit.  Any
+  // block freed after that bypasses the pool.
+  struct pool_drain
+  {
+    bool m_armed;
+
+    ~pool_drain ()
+    {
+      for (size_t i = 0; i < nclasses; ++i)
+	while (free_block *b = state.m_heads[i])
+	  {
+	    state.m_heads[i] = b->m_next;
+	    ::operator delete (b);
+	  }
+      state.m_dead = true;
+    }
+  };
+
+  thread_local pool_drain drain;
+
+  size_t
+  size_class (size_t size)
+  {
+    return (size + granule - 1) / granule - 1;
+  }
+}
+
+void *
+pool_alloc (size_t size)
+{
+  size_t cls = size_class (size);
+  if (cls < nclasses && ! state.m_dead)
+    if (free_block *b = state.m_heads[cls])
+      {
+	state.m_heads[cls] = b->m_next;
+	--state.m_counts[cls];
+	return b;
+      }
+
+  if (cls < nclasses)
+    size = (cls + 1) * granule;
+  return ::operator new (size);
+}
+
+void
+pool_free (void *ptr, size_t size)
+{
+  if (ptr == nullptr)
+    return;
+
+  size_t cls = size_class (size);
+  if (cls >= nclasses || state.m_dead
+      || state.m_counts[cls] >= max_free)
+    {
+      ::operator delete (ptr);
+      return;
+    }
+
+  if (! state.m_registered)
+    {
+      // Touch DRAIN so that its destructor gets registered for this
+      // thread.
+      drain.m_armed = true;
+      state.m_registered = true;
+    }
+
+  auto b = static_cast <free_block *> (ptr);
+  b->m_next = state.m_heads[cls];
+  state.m_heads[cls] = b;
+  ++state.m_counts[cls];
+}
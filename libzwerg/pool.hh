@@ -0,0 +1,47 @@
+/*
+   Copyright (C) 2014 Red Hat, Inc.
+   This file is part of dwgrep.
+
+   This file is free software; you can redistribute it and/or modify
+   it under the terms of either
+
+     * the GNU Lesser General Public License as published by the Free
+       Software Foundation; either version 3 of the License, or (at
+       your option) any later version
+
+   or
+
+     * the GNU General Public License as published by the Free
+       Software Foundation; either version 2 of the License, or (at
+       your option) any later version
+
+   or both in parallel, as here.
+
+   dwgrep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received copies of the GNU General Public License and
+   the GNU Lesser General Public License along with this program.  If
+   not, see <http://www.gnu.org/licenses/>.  */
+
+#ifndef _POOL_H_
+#define _POOL_H_
+
+#include <cstddef>
+
+// Small-object allocator for objects that are created and destroyed
+// in large numbers during query execution (values, stacks).  Freed
+// blocks are kept on per-thread free lists segregated by size, so a
+// query that yields a value per DIE reuses the same handful of
+// blocks instead of going to the global heap each time.  Blocks may
+// be freed by a different thread than the one that allocated them.
+//
+// SIZE passed to pool_free must be the same as was passed to
+// pool_alloc.
+
+void *pool_alloc (size_t size);
+void pool_free (void *ptr, size_t size);
+
+#endif /* _POOL_H_ */
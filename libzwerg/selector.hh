@@ -105,6 +105,20 @@ public:
     return (profile.m_imprint & m_mask) == m_imprint;
   }
 
+  // Whether a profile whose TOS has type CODE might match this
+  // selector.
+  bool
+  matches_tos (uint8_t code) const
+  {
+    return (code & m_mask & 0xff) == (m_imprint & 0xff);
+  }
+
+  uint8_t
+  tos_code () const
+  {
+    return m_imprint & 0xff;
+  }
+
   std::vector <value_type> get_types () const;
 
   bool operator< (selector const &that) const
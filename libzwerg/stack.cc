@@ -26,6 +26,8 @@
    the GNU Lesser General Public License along with this program.  If
    not, see <http://www.gnu.org/licenses/>.  */
 
+#include <atomic>
+
 #include "stack.hh"
 
 void
@@ -40,7 +42,7 @@ frame::bind_value (var_id index, std::unique_ptr <value> val)
   m_values[index] = std::move (val);
 }
 
-value &
+value const &
 frame::read_value (var_id index)
 {
   assert (index < m_values.size ());
@@ -56,54 +58,158 @@ std::shared_ptr <frame>
 frame::clone () const
 {
   auto ret = std::make_shared <frame> (m_parent, 0);
-  for (auto const &val: m_values)
-    ret->m_values.push_back (val != nullptr ? val->clone () : nullptr);
+  ret->m_values = m_values;
   return ret;
 }
 
+struct stack::cell
+{
+  std::atomic <unsigned> m_refs;
+  std::unique_ptr <value> m_value;
+
+  // The cell below this one, which this cell holds a reference to.
+  cell *m_below;
+
+  // Profile of the stack whose TOS this cell is.  Caching it here
+  // means pop doesn't need to look W cells deep to restore it.
+  selector::sel_t m_profile;
+
+  cell (std::unique_ptr <value> value, cell *below)
+    : m_refs {1}
+    , m_value {std::move (value)}
+    , m_below {below}
+    , m_profile {(below != nullptr ? below->m_profile << 8 : 0)
+		 | m_value->get_type ().code ()}
+  {}
+
+  static void *
+  operator new (size_t size)
+  {
+    return pool_alloc (size);
+  }
+
+  static void
+  operator delete (void *ptr, size_t size)
+  {
+    pool_free (ptr, size);
+  }
+};
+
+void
+stack::acquire (cell *c)
+{
+  if (c != nullptr)
+    c->m_refs.fetch_add (1, std::memory_order_relaxed);
+}
+
+void
+stack::release (cell *c)
+{
+  // Iterate instead of recursing, stacks can get deep.
+  while (c != nullptr
+	 && c->m_refs.fetch_sub (1, std::memory_order_acq_rel) == 1)
+    {
+      cell *below = c->m_below;
+      delete c;
+      c = below;
+    }
+}
+
 stack::stack (stack const &that)
-  : m_frame {that.m_frame != nullptr ? that.m_frame->clone () : nullptr}
-  , m_profile {that.m_profile}
+  : m_top {that.m_top}
+  , m_size {that.m_size}
+  , m_frame {that.m_frame != nullptr ? that.m_frame->clone () : nullptr}
+{
+  acquire (m_top);
+}
+
+stack::stack (stack &&that)
+  : m_top {that.m_top}
+  , m_size {that.m_size}
+  , m_frame {std::move (that.m_frame)}
+{
+  that.m_top = nullptr;
+  that.m_size = 0;
+}
+
+stack::~stack ()
+{
+  release (m_top);
+}
+
+selector::sel_t
+stack::profile () const
+{
+  return m_top != nullptr ? m_top->m_profile : 0;
+}
+
+void
+stack::push (std::unique_ptr <value> vp)
+{
+  // The new cell takes over our reference to the old top.
+  m_top = new cell {std::move (vp), m_top};
+  ++m_size;
+}
+
+std::unique_ptr <value>
+stack::pop ()
+{
+  need (1);
+  cell *c = m_top;
+  m_top = c->m_below;
+  --m_size;
+
+  std::unique_ptr <value> ret;
+  if (c->m_refs.load (std::memory_order_acquire) == 1)
+    {
+      // Nobody else sees this cell, so we can steal both the value
+      // and the reference to the cell below.
+      ret = std::move (c->m_value);
+      c->m_below = nullptr;
+      delete c;
+    }
+  else
+    {
+      ret = c->m_value->clone ();
+      acquire (m_top);
+      release (c);
+    }
+
+  return ret;
+}
+
+value &
+stack::get (unsigned depth)
 {
-  for (auto const &v: that.m_values)
-    m_values.push_back (v->clone ());
+  need (depth + 1);
+  cell *c = m_top;
+  for (unsigned i = 0; i < depth; ++i)
+    c = c->m_below;
+  return *c->m_value;
 }
 
 namespace
 {
   int
-  compare_stack (std::vector <std::unique_ptr <value> > const &a,
-	       std::vector <std::unique_ptr <value> > const &b)
+  compare_stack (std::vector <value const *> const &a,
+		 std::vector <value const *> const &b)
   {
     if (a.size () < b.size ())
       return -1;
     else if (a.size () > b.size ())
       return 1;
 
-    // The stack that has nullptr where the other has non-nullptr is
-    // smaller.
-    {
-      auto it = a.begin ();
-      auto jt = b.begin ();
-      for (; it != a.end (); ++it, ++jt)
-	if (*it == nullptr && *jt != nullptr)
-	  return -1;
-	else if (*it != nullptr && *jt == nullptr)
-	  return 1;
-    }
-
     // The stack with "smaller" types is smaller.
     {
       auto it = a.begin ();
       auto jt = b.begin ();
       for (; it != a.end (); ++it, ++jt)
-	if (*it != nullptr && *jt != nullptr)
-	  {
-	    if ((*it)->get_type () < (*jt)->get_type ())
-	      return -1;
-	    else if ((*jt)->get_type () < (*it)->get_type ())
-	      return 1;
-	  }
+	{
+	  if ((*it)->get_type () < (*jt)->get_type ())
+	    return -1;
+	  else if ((*jt)->get_type () < (*it)->get_type ())
+	    return 1;
+	}
     }
 
     // We have the same number of slots with values of the same type.
@@ -112,7 +218,7 @@ namespace
       auto it = a.begin ();
       auto jt = b.begin ();
       for (; it != a.end (); ++it, ++jt)
-	if (*it != nullptr && *jt != nullptr)
+	if (*it != *jt)
 	  switch ((*it)->cmp (**jt))
 	    {
 	    case cmp_result::fail:
@@ -132,14 +238,34 @@ namespace
   }
 }
 
+std::vector <value const *>
+stack::values () const
+{
+  std::vector <value const *> ret (m_size);
+  auto it = ret.rbegin ();
+  for (cell *c = m_top; c != nullptr; c = c->m_below)
+    *it++ = c->m_value.get ();
+  return ret;
+}
+
 bool
 stack::operator< (stack const &that) const
 {
-  return compare_stack (m_values, that.m_values) < 0;
+  return compare_stack (values (), that.values ()) < 0;
 }
 
 bool
 stack::operator== (stack const &that) const
 {
-  return compare_stack (m_values, that.m_values) == 0;
+  return compare_stack (values (), that.values ()) == 0;
+}
+
+size_t
+stack::hash () const
+{
+  size_t ret = m_size;
+  for (cell *c = m_top; c != nullptr; c = c->m_below)
+    ret = hash_combine (ret, hash_combine (c->m_value->get_type ().code (),
+					   c->m_value->hash ()));
+  return ret;
 }
@@ -32,17 +32,19 @@
 #include <memory>
 #include <vector>
 
+#include "pool.hh"
 #include "value.hh"
 #include "selector.hh"
 
 enum var_id: unsigned {};
 
 // Stack frame, or activation record, of a running procedure (or other
-// sort of context).
+// sort of context).  Bound values are never modified, so frames (and
+// copies thereof) share them.
 struct frame
 {
   std::shared_ptr <frame> m_parent;
-  std::vector <std::unique_ptr <value>> m_values;
+  std::vector <std::shared_ptr <value const>> m_values;
 
   frame (std::shared_ptr <frame> parent, size_t vars)
     : m_parent {parent}
@@ -50,29 +52,59 @@ struct frame
   {}
 
   void bind_value (var_id index, std::unique_ptr <value> val);
-  value &read_value (var_id index);
+  value const &read_value (var_id index);
 
   std::shared_ptr <frame> clone () const;
 };
 
 // Value file is a container type that's used for maintaining stacks
 // of dwgrep values.
+//
+// Stacks are persistent: values are kept in a linked list of
+// reference-counted cells, and copying a stack merely shares the
+// list, so forking a stack doesn't copy any values.  A cell is only
+// modified when it's not shared; pop() clones the value if it is.
+// Values that are reached through get() and top() may thus be shared
+// with other stacks, and must not be modified in place.
 class stack
 {
-  std::vector <std::unique_ptr <value>> m_values;
+  struct cell;
+
+  cell *m_top;
+  size_t m_size;
   std::shared_ptr <frame> m_frame;
-  selector::sel_t m_profile;
+
+  static void acquire (cell *c);
+  static void release (cell *c);
+
+  // Values on this stack, bottom first.
+  std::vector <value const *> values () const;
 
 public:
   typedef std::unique_ptr <stack> uptr;
 
   stack ()
-    : m_profile {0}
+    : m_top {nullptr}
+    , m_size {0}
   {}
 
   stack (stack const &other);
-  stack (stack &&other) = default;
-  ~stack () = default;
+  stack (stack &&other);
+  ~stack ();
+
+  stack &operator= (stack const &other) = delete;
+
+  static void *
+  operator new (size_t size)
+  {
+    return pool_alloc (size);
+  }
+
+  static void
+  operator delete (void *ptr, size_t size)
+  {
+    pool_free (ptr, size);
+  }
 
   std::shared_ptr <frame>
   nth_frame (size_t depth) const
@@ -92,44 +124,21 @@ public:
   size_t
   size () const
   {
-    return m_values.size ();
+    return m_size;
   }
 
-  selector::sel_t
-  profile () const
-  {
-    return m_profile;
-  }
+  selector::sel_t profile () const;
 
-  void
-  push (std::unique_ptr <value> vp)
-  {
-    m_profile <<= 8;
-    m_profile |= vp->get_type ().code ();
-    m_values.push_back (std::move (vp));
-  }
+  void push (std::unique_ptr <value> vp);
 
   void
   need (unsigned depth) const
   {
-    if (depth > m_values.size ())
+    if (depth > m_size)
       throw std::runtime_error ("stack overflow");
   }
 
-  std::unique_ptr <value>
-  pop ()
-  {
-    need (1);
-    auto ret = std::move (m_values.back ());
-    m_values.pop_back ();
-    m_profile >>= 8;
-    if (m_values.size () >= selector::W)
-      {
-	auto code = get (selector::W - 1).get_type ().code ();
-	m_profile |= ((selector::sel_t) code) << 24;
-      }
-    return ret;
-  }
+  std::unique_ptr <value> pop ();
 
   template <class T>
   std::unique_ptr <T>
@@ -143,22 +152,15 @@ public:
   value &
   top ()
   {
-    need (1);
-    return *m_values.back ().get ();
+    return get (0);
   }
 
-  value &
-  get (unsigned depth)
-  {
-    need (depth + 1);
-    return *(m_values.rbegin () + depth)->get ();
-  }
+  value &get (unsigned depth);
 
   value const &
   get (unsigned depth) const
   {
-    need (depth + 1);
-    return *(m_values.rbegin () + depth)->get ();
+    return const_cast <stack *> (this)->get (depth);
   }
 
   template <class T>
@@ -179,6 +181,10 @@ public:
 
   bool operator< (stack const &that) const;
   bool operator== (stack const &that) const;
+
+  // Stacks that compare equal have the same hash.  Frames are
+  // ignored, as by the comparison operators.
+  size_t hash () const;
 };
 
 #endif /* _STK_H_ */
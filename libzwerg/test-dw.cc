@@ -1,12 +1,34 @@
 #include <gtest/gtest.h>
+#include <atomic>
+#include <thread>
+#include <cstdlib>
+#include <functional>
+#include <map>
+#include <set>
+#include <sstream>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
 
+#include "atval.hh"
 #include "builtin.hh"
 #include "builtin-dw.hh"
+#include "cache.hh"
+#include "dwfl_context.hh"
+#include "dwit.hh"
+#include "index-cache.hh"
 #include "init.hh"
+#include "libzwergP.hh"
+#include "value-cst.hh"
 #include "value-dw.hh"
+#include "value-str.hh"
 #include "stack.hh"
 #include "parser.hh"
 #include "op.hh"
+#include "optimize.hh"
+#include "overload.hh"
+#include "parallel.hh"
+#include "plan.hh"
 
 std::string
 test_file (std::string name)
@@ -20,30 +42,39 @@ struct ZwTest
 {
   std::unique_ptr <vocabulary> builtins;
 
+  // Contexts of files that the test opens.
+  std::shared_ptr <dwctx_registry> dwctxs;
+
   void
   SetUp () override final
   {
     builtins = std::make_unique <vocabulary>
       (*dwgrep_vocabulary_core (), *dwgrep_vocabulary_dw ());
+    dwctxs = std::make_shared <dwctx_registry> ();
   }
 };
 
 namespace
 {
+  // Values made from a Dwarf value don't keep its context alive, so
+  // the context is added to DWCTXS, which has to outlive them.
   std::unique_ptr <value_dwarf>
-  dw (std::string fn, doneness d)
+  dw (std::string fn, doneness d, dwctx_registry &dwctxs)
   {
-    return std::make_unique <value_dwarf> (test_file (fn), 0, d);
+    auto ret = std::make_unique <value_dwarf> (test_file (fn), 0, d);
+    dwctxs.add (ret->get_dwctx ());
+    return ret;
   }
 }
 
 TEST (DwValueTest, dwarf_sanity)
 {
-  auto cooked = dw ("empty", doneness::cooked);
+  dwctx_registry dwctxs;
+  auto cooked = dw ("empty", doneness::cooked, dwctxs);
   ASSERT_TRUE (cooked->is_cooked ());
   ASSERT_FALSE (cooked->is_raw ());
 
-  auto raw = dw ("empty", doneness::raw);
+  auto raw = dw ("empty", doneness::raw, dwctxs);
   ASSERT_TRUE (raw->is_raw ());
   ASSERT_FALSE (raw->is_cooked ());
 }
@@ -58,14 +89,31 @@ namespace
     return stk;
   }
 
-  std::vector <std::unique_ptr <stack>>
+  // Stacks that a query yielded, and contexts that their values
+  // refer to.
+  struct yielded_stacks
+    : public std::vector <std::unique_ptr <stack>>
+  {
+    std::shared_ptr <dwctx_registry> m_dwctxs;
+  };
+
+  // Like zw_query_execute, the query is evaluated in a scope of a
+  // registry that holds contexts of Dwarf values of the input, and
+  // the yielded stacks keep that registry.
+  yielded_stacks
   run_query (vocabulary &voc,
 	     std::unique_ptr <stack> stk, std::string q)
   {
+    yielded_stacks yielded;
+    yielded.m_dwctxs = std::make_shared <dwctx_registry> ();
+    for (size_t i = 0; i < stk->size (); ++i)
+      if (auto dwarf = value::as <value_dwarf> (&stk->get (i)))
+	yielded.m_dwctxs->add (dwarf->get_dwctx ());
+
     std::shared_ptr <op> op = parse_query (voc, q)
       .build_exec (std::make_shared <op_origin> (std::move (stk)));
 
-    std::vector <std::unique_ptr <stack>> yielded;
+    dwctx_scope scope {*yielded.m_dwctxs};
     while (auto r = op->next ())
       yielded.push_back (std::move (r));
 
@@ -73,10 +121,48 @@ namespace
   }
 
   // A query on a stack with sole value, which is a Dwarf.
-  std::vector <std::unique_ptr <stack>>
+  yielded_stacks
   run_dwquery (vocabulary &voc, std::string fn, std::string q)
   {
-    return run_query (voc, stack_with_value (dw (fn, doneness::cooked)), q);
+    dwctx_registry dwctxs;
+    auto stk = stack_with_value (dw (fn, doneness::cooked, dwctxs));
+    return run_query (voc, std::move (stk), q);
+  }
+
+  std::string
+  show_stack (stack const &stk)
+  {
+    std::stringstream ss;
+    for (size_t i = stk.size (); i-- > 0; )
+      ss << stk.get (i) << ";";
+    return ss.str ();
+  }
+
+  // Drain ops EXPECT and GOT, and check that they yield the same
+  // stacks in the same order, with values on top at the same
+  // positions.  Stacks compare equal only if their DIE's come from
+  // the same Dwarf, so when the two ops read different handles of a
+  // file, pass SAME_DWARF false to compare printed stacks only.
+  void
+  expect_same_results (std::shared_ptr <op> expect, std::shared_ptr <op> got,
+		       bool same_dwarf = true)
+  {
+    for (size_t i = 0; auto e = expect->next (); ++i)
+      {
+	auto g = got->next ();
+	ASSERT_TRUE (g != nullptr) << "Result #" << i << " missing.";
+	ASSERT_EQ (show_stack (*e), show_stack (*g)) << "Result #" << i;
+	if (same_dwarf)
+	  {
+	    ASSERT_TRUE (*e == *g) << "Result #" << i;
+	  }
+	if (e->size () > 0)
+	  {
+	    ASSERT_EQ (e->top ().get_pos (), g->top ().get_pos ())
+	      << "Result #" << i;
+	  }
+      }
+    ASSERT_TRUE (got->next () == nullptr) << "Extra results.";
   }
 
 #define SOLE_YIELDED_VALUE(TYPE, YIELDED)				\
@@ -100,7 +186,7 @@ TEST_F (ZwTest, words_dwarf_raw_cooked)
 {
   {
     auto yielded = run_query
-      (*builtins, stack_with_value (dw ("empty", doneness::cooked)),
+      (*builtins, stack_with_value (dw ("empty", doneness::cooked, *dwctxs)),
        "raw");
 
     auto produced = SOLE_YIELDED_VALUE (value_dwarf, yielded);
@@ -109,7 +195,7 @@ TEST_F (ZwTest, words_dwarf_raw_cooked)
 
   {
     auto yielded = run_query
-      (*builtins, stack_with_value (dw ("empty", doneness::raw)),
+      (*builtins, stack_with_value (dw ("empty", doneness::raw, *dwctxs)),
        "cooked");
 
     auto produced = SOLE_YIELDED_VALUE (value_dwarf, yielded);
@@ -366,6 +452,36 @@ TEST_F (ZwTest, parent_with_alt_file)
 	      "entry (offset == 0x14) parent").size ());
 }
 
+TEST_F (ZwTest, import_chains_are_shared)
+{
+  // a1.out imports partial units, so some of the DIE's that cooked
+  // entry yields come through imports.  DIE's that were reached
+  // through the same DW_TAG_imported_unit DIE's share the chain.
+  std::map <std::vector <Dwarf_Off>, import_chain const *> chains;
+  for (auto &stk: run_dwquery (*builtins, "a1.out", "entry"))
+    {
+      auto die = value::as <value_die> (&stk->get (0));
+      ASSERT_TRUE (die != nullptr);
+
+      std::vector <Dwarf_Off> path;
+      for (auto import = die->get_import (); import != nullptr;
+	   import = import->m_parent)
+	{
+	  Dwarf_Die imp = import->m_die;
+	  ASSERT_EQ (DW_TAG_imported_unit, dwarf_tag (&imp));
+	  path.push_back (dwarf_dieoffset (&imp));
+	}
+
+      if (! path.empty ())
+	{
+	  auto it = chains.insert (std::make_pair (path, die->get_import ()));
+	  ASSERT_TRUE (it.first->second == die->get_import ());
+	}
+    }
+
+  ASSERT_FALSE (chains.empty ());
+}
+
 TEST_F (ZwTest, dies_from_two_files_neq)
 {
   // Two DIE's with the same offset should not compare equal if one of
@@ -374,3 +490,1259 @@ TEST_F (ZwTest, dies_from_two_files_neq)
 	     (*builtins, "a1.out",
 	      "[raw unit root] (elem (pos == 0) == elem (pos == 1))").size ());
 }
+
+TEST_F (ZwTest, parallel_units_same_as_sequential)
+{
+  // Workers read their own handles of the file, so DIE's that they
+  // yield are only compared in print.
+  for (auto q: {"entry", "raw entry", "unit", "entry offset",
+		"entry ?TAG_subprogram name", "entry ?TAG_subprogram child"})
+    for (bool ordered: {true, false})
+      {
+	tree t = parse_query (*builtins, q);
+	t.simplify ();
+	auto stk = stack_with_value (dw ("a1.out", doneness::cooked, *dwctxs));
+	auto sequential = t.build_exec
+	  (std::make_shared <op_origin> (std::make_unique <stack> (*stk)));
+	auto parallel = build_parallel_exec (t, *stk, 3, ordered, dwctxs);
+	ASSERT_TRUE (parallel != nullptr);
+
+	if (ordered)
+	  {
+	    expect_same_results (sequential, parallel, false);
+	    continue;
+	  }
+
+	// Unordered results come by chunks as they are finished, but
+	// each one comes once.
+	std::multiset <std::string> expect, got;
+	while (auto r = sequential->next ())
+	  expect.insert (show_stack (*r));
+	while (auto r = parallel->next ())
+	  got.insert (show_stack (*r));
+	ASSERT_EQ (expect, got);
+      }
+
+  // Queries that don't start by iterating units can't be split.
+  tree t = parse_query (*builtins, "name");
+  auto stk = stack_with_value (dw ("a1.out", doneness::cooked, *dwctxs));
+  ASSERT_TRUE (build_parallel_exec (t, *stk, 3, true, dwctxs) == nullptr);
+}
+
+TEST_F (ZwTest, parallel_chunks_get_own_handles)
+{
+  // dwz-partial3-1 has seven units, each evaluated as a chunk of its
+  // own.  The consumer reads results of a chunk while the worker goes
+  // on with the next one, so each chunk has a handle of its own, even
+  // with a single worker.
+  tree t = parse_query (*builtins, "raw unit root");
+  t.simplify ();
+  auto stk = stack_with_value
+    (dw ("dwz-partial3-1", doneness::cooked, *dwctxs));
+  auto op = build_parallel_exec (t, *stk, 1, true, dwctxs);
+  ASSERT_TRUE (op != nullptr);
+
+  std::set <Dwarf *> dwarfs;
+  size_t n = 0;
+  while (auto r = op->next ())
+    {
+      auto die = value::as <value_die> (&r->top ());
+      ASSERT_TRUE (die != nullptr);
+      dwarfs.insert (dwarf_cu_getdwarf (die->get_die ().cu));
+      ++n;
+    }
+
+  ASSERT_EQ (7u, n);
+  ASSERT_EQ (7u, dwarfs.size ());
+}
+
+TEST_F (ZwTest, entry_reductions_same_as_unreduced)
+{
+  auto entry = builtins->find ("entry");
+  ASSERT_TRUE (entry != nullptr);
+
+  // a1.out imports partial units, which cooked entry inlines.  W is
+  // a typedef that dwz moved to a partial unit in the alt file.
+  for (auto fn: {"a1.out", "dwz-partial3-1", "twocus"})
+    for (auto d: {doneness::raw, doneness::cooked})
+      for (bool via_unit: {false, true})
+	for (auto q: {"?TAG_subprogram", "?TAG_variable",
+		      "?TAG_compile_unit", "?DW_TAG_base_type",
+		      "(@AT_name == \"main\")", "(\"W\" == @DW_AT_name)",
+		      "(@AT_name == \"foo\")", "(@AT_name == \"\")"})
+	  {
+	    tree next = parse_query (*builtins, q);
+	    next.simplify ();
+
+	    auto stk = stack_with_value (dw (fn, d, *dwctxs));
+	    auto build_upstream = [&] ()
+	      {
+		std::shared_ptr <op> upstream = std::make_shared <op_origin>
+		  (std::make_unique <stack> (*stk));
+		if (via_unit)
+		  upstream = builtins->find ("unit")->build_exec (upstream);
+		return upstream;
+	      };
+
+	    auto fused = entry->build_exec_fused (build_upstream (), next);
+	    ASSERT_TRUE (fused != nullptr);
+
+	    // A query that spells out the same takes the reduced op.
+	    tree whole = parse_query (*builtins, std::string ("entry ") + q);
+	    whole.simplify ();
+	    ASSERT_EQ (fused->name (), whole.build_exec (build_upstream ())
+				       ->name ());
+
+	    expect_same_results
+	      (next.build_exec (entry->build_exec (build_upstream ())), fused);
+	  }
+
+  // Other expressions are left alone.
+  for (auto q: {"!TAG_subprogram", "(@AT_name != \"main\")",
+		"(@AT_producer == \"main\")", "(name == \"main\")"})
+    {
+      tree next = parse_query (*builtins, q);
+      next.simplify ();
+      ASSERT_TRUE (entry->build_exec_fused
+		   (std::make_shared <op_origin> (nullptr), next) == nullptr);
+    }
+}
+
+TEST_F (ZwTest, lookup_reductions_same_as_unreduced)
+{
+  auto same = [this] (char const *word, std::string q,
+		      std::function <std::shared_ptr <op> ()> build_upstream)
+    {
+      tree next = parse_query (*builtins, q);
+      next.simplify ();
+
+      auto bi = builtins->find (word);
+      auto fused = bi->build_exec_fused (build_upstream (), next);
+      ASSERT_TRUE (fused != nullptr);
+
+      // A query that spells out the same takes the reduced op.
+      tree whole = parse_query (*builtins, std::string (word) + " " + q);
+      whole.simplify ();
+      ASSERT_EQ (fused->name (), whole.build_exec (build_upstream ())
+				 ->name ());
+
+      expect_same_results (next.build_exec (bi->build_exec
+					    (build_upstream ())), fused);
+    };
+
+  for (auto fn: {"a1.out", "dwz-partial3-1", "twocus"})
+    for (auto d: {doneness::raw, doneness::cooked})
+      {
+	auto stk = stack_with_value (dw (fn, d, *dwctxs));
+	auto entries = [&] ()
+	  {
+	    return builtins->find ("entry")->build_exec
+	      (std::make_shared <op_origin> (std::make_unique <stack> (*stk)));
+	  };
+
+	std::vector <std::string> offsets;
+	{
+	  auto offs = parse_query (*builtins, "offset").build_exec (entries ());
+	  for (size_t i = 0; auto stk = offs->next (); ++i)
+	    if (i % 7 == 0)
+	      offsets.push_back
+		(std::to_string (stk->top_as <value_cst> ()->get_constant ()
+				 .value ().uval ()));
+	}
+
+	for (auto const &off: offsets)
+	  {
+	    same ("entry", "(offset == " + off + ")", entries);
+	    same ("child", "(offset == " + off + ")", entries);
+	  }
+
+	for (auto q: {"(pos == 0)", "?(pos == 2)", "(1 == pos)"})
+	  same ("child", q, entries);
+
+	for (auto q: {"(label == DW_AT_name)", "(DW_AT_type == label)",
+		      "(pos == 0)", "(pos == 3)"})
+	  same ("attribute", q, entries);
+      }
+
+  for (auto word: {"elem", "relem"})
+    for (auto q: {"(pos == 0)", "(pos == 2)", "(pos == 5)"})
+      same (word, q, [this] ()
+	    {
+	      return parse_query (*builtins, "[1, \"a\", 3]").build_exec
+		(std::make_shared <op_origin> (std::make_unique <stack> ()));
+	    });
+}
+
+namespace
+{
+  // Yields what UPSTREAM does, pulling it alternately in batches of
+  // at most MAX stacks and one stack at a time, which must each pick
+  // up where the other left off.
+  class op_batch_reader
+    : public op
+  {
+    std::shared_ptr <op> m_upstream;
+    size_t m_max;
+    stack_batch m_batch;
+    size_t m_pos;
+    bool m_single;
+
+  public:
+    op_batch_reader (std::shared_ptr <op> upstream, size_t max)
+      : m_upstream {upstream}
+      , m_max {max}
+      , m_pos {0}
+      , m_single {true}
+    {}
+
+    stack::uptr
+    next () override
+    {
+      // Stacks that were handed out stay in M_BATCH as nulls, and
+      // next_batch has to append after them.
+      if (m_pos == m_batch.size ())
+	{
+	  m_single = ! m_single;
+	  if (m_single)
+	    {
+	      if (auto stk = m_upstream->next ())
+		m_batch.push_back (std::move (stk));
+	    }
+	  else
+	    {
+	      size_t n = m_upstream->next_batch (m_batch, m_max);
+	      EXPECT_TRUE (n <= m_max);
+	      EXPECT_EQ (m_pos + n, m_batch.size ());
+	    }
+
+	  if (m_pos == m_batch.size ())
+	    return nullptr;
+	}
+
+      return std::move (m_batch[m_pos++]);
+    }
+
+    void
+    reset () override
+    {
+      m_upstream->reset ();
+      m_batch.clear ();
+      m_pos = 0;
+      m_single = true;
+    }
+
+    std::string
+    name () const override
+    {
+      return "batch_reader";
+    }
+  };
+}
+
+TEST_F (ZwTest, batched_same_as_unbatched)
+{
+  for (auto fn: {"a1.out", "twocus"})
+    for (auto q: {"entry", "entry ?TAG_subprogram name",
+		  "entry attribute label", "entry (child, parent) offset",
+		  "entry \"%s:%(offset%)\"", "entry ?(name == \"main\")",
+		  "[entry] elem ?TAG_variable", "unit root (name, 1)",
+		  "entry (if child then child else parent) offset"})
+      for (size_t max: {1, 3, 64})
+	{
+	  tree t = parse_query (*builtins, q);
+	  t.simplify ();
+
+	  auto stk = stack_with_value (dw (fn, doneness::cooked, *dwctxs));
+	  stack_types types {*stk};
+	  auto batched = t.build_exec
+	    (std::make_shared <op_origin> (std::make_unique <stack> (*stk)),
+	     types);
+	  auto plain = t.build_exec
+	    (std::make_shared <op_origin> (std::move (stk)), types);
+
+	  expect_same_results
+	    (plain, std::make_shared <op_batch_reader> (batched, max));
+	}
+}
+
+namespace
+{
+  std::string
+  show_zw_stack (zw_stack const *stk)
+  {
+    std::stringstream ss;
+    for (size_t i = 0; i < zw_stack_depth (stk); ++i)
+      ss << *zw_stack_at (stk, i)->m_value << ";";
+    return ss.str ();
+  }
+}
+
+TEST (ZwApiTest, borrowed_results_same_as_owned)
+{
+  zw_error *err = nullptr;
+  zw_vocabulary const *voc = zw_vocabulary_dwarf (&err);
+  ASSERT_TRUE (voc != nullptr);
+
+  for (auto q: {"entry (name, offset)", "entry ?TAG_subprogram [child]",
+		"unit root \"%s\"", "entry ?(name == \"nothing\")"})
+    {
+      zw_query *query = zw_query_parse (voc, q, &err);
+      ASSERT_TRUE (query != nullptr);
+
+      zw_stack *input = zw_stack_init (&err);
+      zw_value *dwv = zw_value_init_dwarf
+	(test_file ("a1.out").c_str (), &err);
+      ASSERT_TRUE (zw_stack_push_take (input, dwv, &err));
+
+      // Run the query, and print what DRAIN reads from the result.
+      // Also collect addresses of the stacks that it reads.
+      std::set <zw_stack const *> stacks;
+      auto run = [&] (std::function <void (zw_result *,
+					    std::vector <std::string> &)> drain)
+	{
+	  stacks.clear ();
+	  std::vector <std::string> ret;
+	  zw_result *result = zw_query_execute (query, input, &err);
+	  drain (result, ret);
+	  zw_result_destroy (result);
+	  return ret;
+	};
+
+      auto expect = run ([&] (zw_result *result,
+			      std::vector <std::string> &ret)
+	{
+	  zw_stack *out;
+	  while (zw_result_next (result, &out, &err) && out != nullptr)
+	    {
+	      ret.push_back (show_zw_stack (out));
+	      zw_stack_destroy (out);
+	    }
+	});
+
+      // Borrowed stacks are reused by the next call.
+      auto got = run ([&] (zw_result *result,
+			   std::vector <std::string> &ret)
+	{
+	  zw_stack const *outs[7];
+	  size_t n;
+	  while (zw_result_next_n (result, outs, 7, &n, &err) && n > 0)
+	    for (size_t i = 0; i < n; ++i)
+	      {
+		ret.push_back (show_zw_stack (outs[i]));
+		stacks.insert (outs[i]);
+	      }
+	});
+      ASSERT_EQ (expect, got);
+      ASSERT_GE (7u, stacks.size ());
+
+      got = run ([&] (zw_result *result,
+		      std::vector <std::string> &ret)
+	{
+	  zw_stack const *out;
+	  while (zw_result_next_borrowed (result, &out, &err)
+		 && out != nullptr)
+	    {
+	      ret.push_back (show_zw_stack (out));
+	      stacks.insert (out);
+	    }
+	});
+      ASSERT_EQ (expect, got);
+      ASSERT_GE (1u, stacks.size ());
+
+      got.clear ();
+      ASSERT_TRUE (zw_query_execute_foreach
+		   (query, input,
+		    [] (zw_stack const *stk, void *data)
+		    {
+		      static_cast <std::vector <std::string> *> (data)
+			->push_back (show_zw_stack (stk));
+		      return true;
+		    }, &got, &err));
+      ASSERT_EQ (expect, got);
+
+      zw_stack_destroy (input);
+      zw_query_destroy (query);
+    }
+}
+
+TEST (ZwApiTest, results_outlive_input)
+{
+  zw_error *err = nullptr;
+  zw_vocabulary const *voc = zw_vocabulary_dwarf (&err);
+  zw_query *query = zw_query_parse (voc, "entry ?TAG_subprogram [child]",
+				    &err);
+  ASSERT_TRUE (query != nullptr);
+
+  zw_stack *input = zw_stack_init (&err);
+  ASSERT_TRUE (zw_stack_push_take
+	       (input, zw_value_init_dwarf (test_file ("a1.out").c_str (),
+					    &err), &err));
+
+  // Keep both owned results, and values copied out of borrowed ones.
+  std::vector <zw_stack *> owned;
+  std::vector <std::string> expect;
+  zw_stack *copied = zw_stack_init (&err);
+  {
+    zw_result *result = zw_query_execute (query, input, &err);
+    zw_stack *out;
+    while (zw_result_next (result, &out, &err) && out != nullptr)
+      {
+	expect.push_back (show_zw_stack (out));
+	owned.push_back (out);
+      }
+    zw_result_destroy (result);
+
+    result = zw_query_execute (query, input, &err);
+    zw_stack const *bout;
+    while (zw_result_next_borrowed (result, &bout, &err) && bout != nullptr)
+      ASSERT_TRUE (zw_stack_push (copied, zw_stack_at (bout, 0), &err));
+    zw_result_destroy (result);
+  }
+  ASSERT_FALSE (owned.empty ());
+
+  // With the input and query gone, the results must still be usable.
+  zw_stack_destroy (input);
+  zw_query_destroy (query);
+
+  std::vector <std::string> got;
+  for (auto out: owned)
+    {
+      got.push_back (show_zw_stack (out));
+      zw_stack_destroy (out);
+    }
+  ASSERT_EQ (expect, got);
+
+  ASSERT_EQ (owned.size (), zw_stack_depth (copied));
+  for (size_t i = 0; i < owned.size (); ++i)
+    {
+      std::stringstream ss;
+      ss << *zw_stack_at (copied, owned.size () - 1 - i)->m_value << ";";
+      ASSERT_EQ (expect[i], ss.str ());
+    }
+  zw_stack_destroy (copied);
+}
+
+TEST (ZwApiTest, stack_values_stay_put_when_stack_grows)
+{
+  zw_error *err = nullptr;
+  zw_stack *stk = zw_stack_init (&err);
+  ASSERT_TRUE (zw_stack_push_take (stk, zw_value_init_str ("bottom", &err),
+				   &err));
+  zw_value const *bottom = zw_stack_at (stk, 0);
+
+  for (int i = 0; i < 100; ++i)
+    ASSERT_TRUE (zw_stack_push_take
+		 (stk, zw_value_init_str (std::to_string (i).c_str (), &err),
+		  &err));
+
+  ASSERT_EQ (bottom, zw_stack_at (stk, 100));
+  std::stringstream ss;
+  ss << *bottom->m_value;
+  ASSERT_EQ ("bottom", ss.str ());
+  zw_stack_destroy (stk);
+}
+
+TEST (ZwApiTest, opened_dies_outlive_query)
+{
+  zw_error *err = nullptr;
+  zw_vocabulary const *voc = zw_vocabulary_dwarf (&err);
+  std::string fn = test_file ("a1.out");
+
+  // DIE's that parallel workers yield come from the workers' own
+  // handles, and those of `dwopen' from a file that only the query
+  // opens.  Neither is in the input, but the results must outlive
+  // both the query and the result they come from, like those of a
+  // plain query on the same file do.
+  auto run = [&] (std::string q, bool with_dwarf, unsigned nthreads)
+    {
+      zw_query *query = zw_query_parse (voc, q.c_str (), &err);
+      zw_stack *input = zw_stack_init (&err);
+      if (with_dwarf)
+	zw_stack_push_take (input, zw_value_init_dwarf (fn.c_str (), &err),
+			    &err);
+
+      std::vector <zw_stack *> owned;
+      zw_result *result
+	= zw_query_execute_parallel (query, input, nthreads, true, &err);
+      zw_stack *out;
+      while (zw_result_next (result, &out, &err) && out != nullptr)
+	owned.push_back (out);
+
+      zw_result_destroy (result);
+      zw_stack_destroy (input);
+      zw_query_destroy (query);
+
+      std::vector <std::string> ret;
+      for (auto out: owned)
+	{
+	  ret.push_back (show_zw_stack (out));
+	  zw_stack_destroy (out);
+	}
+      return ret;
+    };
+
+  for (auto q: {"entry", "unit", "entry ?TAG_subprogram child"})
+    {
+      auto expect = run (q, true, 1);
+      ASSERT_FALSE (expect.empty ());
+      ASSERT_EQ (expect, run (q, true, 3));
+      ASSERT_EQ (expect, run ("\"" + fn + "\" dwopen " + q, false, 1));
+    }
+}
+
+TEST_F (ZwTest, rebound_plan_same_as_fresh_build)
+{
+  for (auto q: {"entry ?TAG_subprogram name", "unit root child* offset",
+		"[entry ?AT_name] length", "entry (name == \"main\")",
+		"let A := unit; A entry ?(A == unit) offset"})
+    {
+      tree t = parse_query (*builtins, q);
+      t.simplify ();
+      query_plan plan {t};
+
+      // All inputs are a Dwarf, so the graph is built once.
+      std::shared_ptr <op> first;
+      for (auto fn: {"a1.out", "twocus", "empty", "a1.out"})
+	for (auto d: {doneness::cooked, doneness::raw})
+	  {
+	    auto stk = stack_with_value (dw (fn, d, *dwctxs));
+	    stack_types types {*stk};
+	    auto fresh = t.build_exec
+	      (std::make_shared <op_origin> (std::make_unique <stack> (*stk)),
+	       types);
+	    auto rebound = plan.bind (std::move (stk));
+	    if (first == nullptr)
+	      first = rebound;
+	    ASSERT_TRUE (rebound == first);
+
+	    expect_same_results (fresh, rebound);
+	  }
+    }
+
+  // An input of a different profile gets a graph of its own.
+  {
+    query_plan plan {parse_query (*builtins, "length")};
+    auto stk = std::make_unique <stack> ();
+    stk->push (std::make_unique <value_str> ("abc", 0));
+    auto str_op = plan.bind (std::move (stk));
+    ASSERT_TRUE (str_op->next () != nullptr);
+
+    auto seq = parse_query (*builtins, "[1, 2]").build_exec
+      (std::make_shared <op_origin> (std::make_unique <stack> ()))->next ();
+    auto seq_op = plan.bind (std::move (seq));
+    ASSERT_TRUE (seq_op != str_op);
+    auto got = seq_op->next ();
+    ASSERT_TRUE (got != nullptr);
+    ASSERT_EQ (2, got->top_as <value_cst> ()->get_constant ().value ());
+  }
+}
+
+TEST (OverloadTest, overloads_built_on_first_dispatch)
+{
+  struct counting_builtin
+    : public builtin
+  {
+    size_t &m_builds;
+    bool m_has_exec;
+
+    explicit counting_builtin (size_t &builds, bool has_exec = true)
+      : m_builds (builds)
+      , m_has_exec {has_exec}
+    {}
+
+    std::shared_ptr <op>
+    build_exec (std::shared_ptr <op> upstream) const override
+    {
+      ++m_builds;
+      if (! m_has_exec)
+	return nullptr;
+      return std::make_shared <op_nop> (upstream);
+    }
+
+    std::unique_ptr <pred>
+    build_pred () const override
+    {
+      ++m_builds;
+      return nullptr;
+    }
+
+    char const *name () const override { return "counting"; }
+  };
+
+  size_t str_builds = 0, cst_builds = 0;
+  overload_tab tab;
+  tab.add_overload (selector {value_str::vtype},
+		    std::make_shared <counting_builtin> (str_builds));
+  tab.add_overload (selector {value_cst::vtype},
+		    std::make_shared <counting_builtin> (cst_builds));
+
+  auto inst = tab.instantiate ();
+  ASSERT_EQ (0, str_builds);
+  ASSERT_EQ (0, cst_builds);
+
+  stack stk;
+  stk.push (std::make_unique <value_str> ("abc", 0));
+  for (int i = 0; i < 3; ++i)
+    ASSERT_TRUE (inst.find_exec (stk).second != nullptr);
+  ASSERT_EQ (1, str_builds);
+  ASSERT_EQ (0, cst_builds);
+
+  // Overloads that build to nullptr are only tried once, too.
+  for (int i = 0; i < 3; ++i)
+    ASSERT_TRUE (inst.find_pred (stk) == nullptr);
+  ASSERT_EQ (2, str_builds);
+
+  size_t pred_builds = 0;
+  overload_tab pred_tab;
+  pred_tab.add_overload (selector {value_str::vtype},
+			 std::make_shared <counting_builtin>
+			   (pred_builds, false));
+  auto pred_inst = pred_tab.instantiate ();
+  for (int i = 0; i < 3; ++i)
+    ASSERT_TRUE (pred_inst.find_exec (stk).first == nullptr);
+  ASSERT_EQ (1, pred_builds);
+}
+
+TEST_F (ZwTest, typed_build_same_as_untyped)
+{
+  for (auto fn: {"a1.out", "twocus"})
+    for (auto q: {"entry name", "entry ?TAG_subprogram name",
+		  "entry (child, parent) offset", "entry @AT_name length",
+		  "unit root name", "entry ?(name == \"main\") offset",
+		  "1 2 add", "\"a\" \"b\" add", "[entry] length",
+		  "entry (if child then child else parent) offset",
+		  "let X := entry; X name", "entry (name || offset)",
+		  "entry child* offset", "entry ?TAG_subprogram [child] length"})
+      {
+	tree t = parse_query (*builtins, q);
+	t.simplify ();
+
+	auto stk = stack_with_value (dw (fn, doneness::cooked, *dwctxs));
+	stack_types types {*stk};
+	auto typed = t.build_exec
+	  (std::make_shared <op_origin> (std::make_unique <stack> (*stk)),
+	   types);
+	auto untyped = t.build_exec
+	  (std::make_shared <op_origin> (std::move (stk)));
+
+	expect_same_results (untyped, typed);
+      }
+
+  // Types of what a query yields are inferred along the way.
+  {
+    tree t = parse_query (*builtins, "entry name");
+    t.simplify ();
+    stack_types types;
+    types.push (value_dwarf::vtype);
+    t.build_exec (nullptr, types);
+    ASSERT_EQ (value_str::vtype, types.at (0));
+  }
+
+  // When TOS type is known, overloaded words are built directly.
+  {
+    tree t = parse_query (*builtins, "name");
+    stack_types types;
+    ASSERT_EQ ("name", t.build_exec (nullptr, types)->name ());
+    types.push (value_die::vtype);
+    ASSERT_NE ("name", t.build_exec (nullptr, types)->name ());
+    ASSERT_EQ (value_str::vtype, types.at (0));
+  }
+}
+
+TEST_F (ZwTest, optimized_same_as_unoptimized)
+{
+  for (auto fn: {"a1.out", "twocus"})
+    for (auto q: {"1 2 add", "7 2 mod 3 mul", "\"a\" \"b\" add length",
+		  "entry (child, parent) ?TAG_subprogram offset",
+		  "entry (1, \"a\") ?(type == T_CONST)",
+		  "entry ?(type == T_DIE) offset",
+		  "entry (if (1 == 2) then child else parent) offset",
+		  "let N := 3; entry (child ?(N == 3))* offset",
+		  "let N := 3; entry (child ?(N == 4))* offset",
+		  "let F := {child}; entry (F ?(1 == 1))* offset"})
+      {
+	tree t = parse_query (*builtins, q);
+	t.simplify ();
+	tree u = t;
+	optimize (u);
+
+	auto stk = stack_with_value (dw (fn, doneness::cooked, *dwctxs));
+	expect_same_results
+	  (t.build_exec (std::make_shared <op_origin>
+			 (std::make_unique <stack> (*stk))),
+	   u.build_exec (std::make_shared <op_origin> (std::move (stk))));
+      }
+
+  auto optimized = [this] (char const *q)
+    {
+      tree t = parse_query (*builtins, q);
+      t.simplify ();
+      optimize (t);
+      std::stringstream ss;
+      ss << t;
+      return ss.str ();
+    };
+
+  // Arithmetic on literals is folded.
+  ASSERT_EQ ("(CONST<3>)", optimized ("1 2 add"));
+
+  // Only the branch that can pass the assertion remains.
+  ASSERT_EQ ("(STR<a>)", optimized ("(1, \"a\") ?(type == T_STR)"));
+
+  // Invariant predicate is tested once before the closure.
+  ASSERT_NE (std::string::npos,
+	     optimized ("let N := 3; (child ?(N == 3))*").find ("IFELSE"));
+
+  // ... but not if it could complain, as it then would even when the
+  // closure body yields nothing.
+  ASSERT_EQ (std::string::npos,
+	     optimized ("let N := 3; (child ?(N == \"a\"))*").find ("IFELSE"));
+
+  // Division by zero is left for run time.
+  ASSERT_NE (std::string::npos, optimized ("1 0 div").find ("div"));
+}
+
+TEST_F (ZwTest, address_lookups_same_as_scan)
+{
+  auto entry = builtins->find ("entry");
+  for (auto fn: {"a1.out", "dwz-partial3-1", "twocus"})
+    {
+      auto lows = run_dwquery (*builtins, fn,
+			       "entry ?TAG_subprogram @AT_low_pc");
+      if (std::string (fn) == "twocus")
+	{
+	  ASSERT_EQ (2, lows.size ());
+	}
+
+      for (auto const &low: lows)
+	for (uint64_t delta: {0, 1})
+	  {
+	    uint64_t a = low->top_as <value_cst> ()->get_constant ()
+			   .value ().uval () + delta;
+	    std::stringstream ss;
+	    ss << "0x" << std::hex << a;
+	    std::string hex = ss.str ();
+
+	    // [A] elem keeps the expression from being reduced.
+	    std::string scan = "?(address [" + hex + "] elem ?contains)";
+	    std::string lookup = "?(address " + hex + " ?contains)";
+	    for (std::string q: {scan, lookup})
+	      {
+		tree next = parse_query (*builtins, q);
+		next.simplify ();
+		ASSERT_EQ (q == lookup, entry->build_exec_fused
+			   (std::make_shared <op_origin> (nullptr), next)
+			   != nullptr);
+	      }
+
+	    for (auto d: {doneness::cooked, doneness::raw})
+	      {
+		auto stk = stack_with_value (dw (fn, d, *dwctxs));
+		auto build = [&] (std::string q)
+		  {
+		    return parse_query (*builtins, q).build_exec
+		      (std::make_shared <op_origin>
+		       (std::make_unique <stack> (*stk)));
+		  };
+
+		// Each address is in at least the subprogram it comes
+		// from.
+		ASSERT_TRUE (build ("entry " + scan)->next () != nullptr);
+		expect_same_results (build ("entry " + scan),
+				     build ("entry " + lookup));
+		if (d == doneness::raw)
+		  expect_same_results (build ("entry " + scan + " offset"),
+				       build (hex + " addr2die offset"));
+	      }
+	  }
+    }
+}
+
+TEST (StackTest, forked_stacks_are_independent)
+{
+  auto cst = [] (int i) {
+    return std::make_unique <value_cst>
+      (constant {i, &dec_constant_dom}, 0);
+  };
+
+  stack stk;
+  stk.push (cst (1));
+  stk.push (cst (2));
+
+  stack fork {stk};
+  ASSERT_TRUE (fork == stk);
+  ASSERT_EQ (stk.hash (), fork.hash ());
+
+  // Popping a shared value from the fork must leave the original
+  // alone.
+  auto v = fork.pop_as <value_cst> ();
+  v->set_pos (7);
+  fork.push (cst (3));
+  ASSERT_EQ (2, stk.size ());
+  ASSERT_EQ (0, stk.top ().get_pos ());
+  ASSERT_TRUE (stk < fork);
+
+  // Once the original goes away, the fork owns the bottom value.
+  {
+    stack moved {std::move (stk)};
+    ASSERT_EQ (0, stk.size ());
+  }
+  fork.pop ();
+  ASSERT_EQ (1, fork.size ());
+  ASSERT_EQ (constant (1, &dec_constant_dom),
+	     fork.top_as <value_cst> ()->get_constant ());
+}
+
+TEST (StackTest, equal_values_hash_equal)
+{
+  value_cst a {constant {10, &dec_constant_dom}, 0};
+  value_cst b {constant {10, &hex_constant_dom}, 1};
+  ASSERT_EQ (cmp_result::equal, a.cmp (b));
+  ASSERT_EQ (a.hash (), b.hash ());
+
+  value_cst c {constant {-1, &dec_constant_dom}, 0};
+  value_cst d {constant {-1, &hex_constant_dom}, 0};
+  ASSERT_EQ (c.hash (), d.hash ());
+}
+
+TEST (ValueStrTest, interned_same_as_owned)
+{
+  auto dwctx = std::make_shared <dwfl_context>
+    (open_dwfl (test_file ("nullptr.o")));
+  Dwarf *dw = all_dwarfs (*dwctx).front ();
+
+  // Both the structure at 0x29 and its constructor at 0x3f are
+  // called "foo".
+  std::vector <std::unique_ptr <value_str>> names;
+  for (Dwarf_Off off: {0x29, 0x3f})
+    {
+      Dwarf_Die die;
+      ASSERT_TRUE (dwarf_offdie (dw, off, &die) != nullptr);
+      names.push_back (std::make_unique <value_str>
+		       (*dwctx, dwarf_diename (&die), 0));
+    }
+
+  value_str owned {"foo", 0};
+  value_str other {"fo", 0};
+  for (auto const &name: names)
+    {
+      ASSERT_EQ (cmp_result::equal, name->cmp (owned));
+      ASSERT_EQ (cmp_result::equal, owned.cmp (*name));
+      ASSERT_EQ (owned.hash (), name->hash ());
+      ASSERT_EQ (cmp_result::greater, name->cmp (other));
+      ASSERT_EQ (cmp_result::less, other.cmp (*name));
+    }
+  ASSERT_EQ (names[0]->get_cstr (), names[1]->get_cstr ());
+
+  auto clone = names[0]->clone ();
+  names[0]->get_string () += "bar";
+  ASSERT_EQ (cmp_result::equal, clone->cmp (owned));
+  ASSERT_EQ (cmp_result::equal,
+	     names[0]->cmp (value_str {"foobar", 0}));
+  ASSERT_EQ ((value_str {"foobar", 0}.hash ()), names[0]->hash ());
+}
+
+TEST (ValueStrTest, interning_from_many_threads)
+{
+  // Two copies of enough distinct strings to make the cache grow its
+  // table of addresses a couple times while threads intern them.
+  size_t const n = 2000;
+  std::vector <std::string> strs;
+  for (size_t i = 0; i < 2 * n; ++i)
+    strs.push_back ("str" + std::to_string (i % n));
+
+  str_intern_cache cache;
+  std::vector <std::vector <interned_str const *>> seen (4);
+  std::vector <std::thread> threads;
+  for (auto &entries: seen)
+    threads.push_back (std::thread ([&] ()
+      {
+	for (auto const &str: strs)
+	  entries.push_back (&cache.intern (str.c_str ()));
+      }));
+  for (auto &thread: threads)
+    thread.join ();
+
+  for (auto const &entries: seen)
+    for (size_t i = 0; i < 2 * n; ++i)
+      {
+	ASSERT_EQ (seen[0][i], entries[i]);
+	ASSERT_EQ (seen[0][i % n], entries[i]);
+	ASSERT_EQ (strs[i], std::string (entries[i]->m_str,
+					 entries[i]->m_length));
+	ASSERT_EQ (hash_str (strs[i].data (), strs[i].length ()),
+		   entries[i]->m_hash);
+      }
+}
+
+TEST (DwflContextTest, find_parent_is_root_from_many_threads)
+{
+  for (auto fn: {"a1.out", "dwz-partial3-1", "nullptr.o", "twocus"})
+    {
+      struct die_info
+      {
+	size_t dw;
+	Dwarf_Off off;
+	Dwarf_Off paroff;
+	bool root;
+      };
+
+      // Compute the expected answers sequentially on a context of
+      // its own.
+      std::vector <die_info> expect;
+      {
+	dwfl_context ref {open_dwfl (test_file (fn))};
+	auto dwarfs = all_dwarfs (ref);
+	for (size_t i = 0; i < dwarfs.size (); ++i)
+	  for (all_dies_iterator it {dwarfs[i]};
+	       it != all_dies_iterator::end (); ++it)
+	    expect.push_back ({i, dwarf_dieoffset (*it),
+			       ref.find_parent (**it), ref.is_root (**it)});
+      }
+      ASSERT_FALSE (expect.empty ());
+
+      dwfl_context dwctx {test_file (fn), true};
+      std::atomic <size_t> failures {0};
+      std::vector <std::thread> threads;
+      for (size_t t = 0; t < 8; ++t)
+	threads.emplace_back ([&, t] ()
+	  {
+	    auto dwarfs = all_dwarfs (dwctx);
+	    for (size_t round = 0; round < 4; ++round)
+	      for (size_t j = 0; j < expect.size (); ++j)
+		{
+		  // Have each thread start at a different place, and
+		  // have every other thread walk backwards.
+		  size_t n = expect.size ();
+		  size_t k = (j + t * n / 8) % n;
+		  if (t % 2 == 1)
+		    k = n - 1 - k;
+		  die_info const &info = expect[k];
+
+		  Dwarf_Die die;
+		  if (dwarf_offdie (dwarfs[info.dw], info.off, &die) == nullptr
+		      || dwctx.find_parent (die) != info.paroff
+		      || dwctx.is_root (die) != info.root)
+		    ++failures;
+		}
+	  });
+
+      for (auto &thr: threads)
+	thr.join ();
+
+      ASSERT_EQ (0, failures.load ());
+    }
+}
+
+TEST (DwflContextTest, integrated_dies_are_shared)
+{
+  dwfl_context dwctx {open_dwfl (test_file ("nullptr.o"))};
+  Dwarf *dw = all_dwarfs (dwctx).front ();
+
+  // 0x6e is an out-of-line instance of a method, and refers to its
+  // declaration at 0x3f through DW_AT_specification.
+  Dwarf_Die die, decl;
+  ASSERT_TRUE (dwarf_offdie (dw, 0x6e, &die) != nullptr);
+  ASSERT_TRUE (dwarf_offdie (dw, 0x3f, &decl) != nullptr);
+
+  auto node = dwctx.integrated (die);
+  ASSERT_TRUE (node == dwctx.integrated (die));
+  Dwarf_Die node_die = node->m_die;
+  ASSERT_EQ (0x6eu, dwarf_dieoffset (&node_die));
+
+  std::vector <unsigned> codes;
+  for (auto const &at: node->m_attrs)
+    codes.push_back (at.code);
+  ASSERT_EQ ((std::vector <unsigned> {DW_AT_specification, DW_AT_inline,
+				      DW_AT_object_pointer, DW_AT_sibling}),
+	     codes);
+
+  ASSERT_EQ (1u, node->m_refs.size ());
+  ASSERT_TRUE (node->m_refs[0] == dwctx.integrated (decl));
+  ASSERT_TRUE (node->m_refs[0]->m_refs.empty ());
+}
+
+TEST (DwflContextTest, integration_survives_eviction)
+{
+  // A cache of sixteen nodes keeps evicting them while DIE's of the
+  // whole file are integrated, and has to give the same answers as
+  // one that keeps everything.
+  dwfl_context dwctx {open_dwfl (test_file ("nullptr.o"))};
+  integration_cache small {16};
+
+  std::function <void (integrated_die const &, integrated_die const &)>
+    same = [&] (integrated_die const &a, integrated_die const &b)
+    {
+      Dwarf_Die da = a.m_die, db = b.m_die;
+      ASSERT_EQ (dwarf_dieoffset (&da), dwarf_dieoffset (&db));
+      ASSERT_EQ (a.m_attrs.size (), b.m_attrs.size ());
+      ASSERT_EQ (a.m_refs.size (), b.m_refs.size ());
+      for (size_t i = 0; i < a.m_refs.size (); ++i)
+	{
+	  ASSERT_EQ (a.m_refs[i] == nullptr, b.m_refs[i] == nullptr);
+	  if (a.m_refs[i] != nullptr)
+	    same (*a.m_refs[i], *b.m_refs[i]);
+	}
+    };
+
+  for (int round = 0; round < 2; ++round)
+    for (auto dw: all_dwarfs (dwctx))
+      for (all_dies_iterator it {dw}; it != all_dies_iterator::end (); ++it)
+	same (*small.get (**it), *dwctx.integrated (**it));
+}
+
+TEST (AtvalTest, single_value_same_as_produced)
+{
+  for (auto fn: {"a1.out", "dwz-partial3-1", "nullptr.o",
+		 "float_const_value.o", "enum.o", "twocus"})
+    {
+      auto dwctx = std::make_shared <dwfl_context>
+	(open_dwfl (test_file (fn)));
+      size_t nsingle = 0;
+      for (Dwarf *dw: all_dwarfs (*dwctx))
+	for (all_dies_iterator it {dw}; it != all_dies_iterator::end (); ++it)
+	  {
+	    Dwarf_Die die = **it;
+	    for (attr_iterator jt {&die}; jt != attr_iterator::end (); ++jt)
+	      {
+		auto single = at_single_value (dwctx, die, **jt);
+		if (single == nullptr)
+		  continue;
+		++nsingle;
+
+		auto vpr = at_value (dwctx, die, **jt);
+		auto v = vpr->next ();
+		ASSERT_TRUE (v != nullptr);
+		ASSERT_TRUE (v->cmp (*single) == cmp_result::equal);
+		ASSERT_EQ (v->get_pos (), single->get_pos ());
+		ASSERT_TRUE (vpr->next () == nullptr);
+	      }
+	  }
+
+      // Every file has names at least, which are decoded directly.
+      ASSERT_LT (0u, nsingle);
+    }
+}
+
+namespace
+{
+  template <class F>
+  void
+  for_each_file (char const *dir, F f)
+  {
+    if (DIR *d = opendir (dir))
+      {
+	while (dirent *ent = readdir (d))
+	  if (ent->d_name[0] != '.')
+	    f (std::string (dir) + "/" + ent->d_name);
+	closedir (d);
+      }
+  }
+
+  void
+  remove_dir (char const *dir)
+  {
+    for_each_file (dir, [] (std::string const &path)
+      {
+	unlink (path.c_str ());
+      });
+    rmdir (dir);
+  }
+}
+
+TEST (IndexCacheTest, reloaded_index_gives_same_answers)
+{
+  char tmpl[] = "/tmp/test-dw-idx.XXXXXX";
+  ASSERT_TRUE (mkdtemp (tmpl) != nullptr);
+
+  for (auto fn: {"a1.out", "dwz-partial3-1", "twocus"})
+    {
+      std::vector <std::pair <Dwarf_Off, bool>> expect;
+      {
+	dwfl_context ref {open_dwfl (test_file (fn))};
+	for (auto dw: all_dwarfs (ref))
+	  for (all_dies_iterator it {dw}; it != all_dies_iterator::end (); ++it)
+	    expect.push_back (std::make_pair (ref.find_parent (**it),
+					      ref.is_root (**it)));
+      }
+
+      // The first round populates the cache, the second one should
+      // read it back.
+      set_index_cache_dir (tmpl);
+      for (int round = 0; round < 2; ++round)
+	{
+	  dwfl_context dwctx {open_dwfl (test_file (fn))};
+	  size_t i = 0;
+	  for (auto dw: all_dwarfs (dwctx))
+	    for (all_dies_iterator it {dw};
+		 it != all_dies_iterator::end (); ++it, ++i)
+	      {
+		ASSERT_LT (i, expect.size ());
+		EXPECT_EQ (expect[i].first, dwctx.find_parent (**it));
+		EXPECT_EQ (expect[i].second, dwctx.is_root (**it));
+	      }
+	  EXPECT_EQ (expect.size (), i);
+	}
+      set_index_cache_dir ("");
+    }
+
+  remove_dir (tmpl);
+}
+
+namespace
+{
+  // Everything that tag and name indices of DWCTX give for tags and
+  // names of its DIE's, flattened.
+  std::vector <uint64_t>
+  index_contents (dwfl_context &dwctx)
+  {
+    std::vector <uint64_t> ret;
+    for (auto dw: all_dwarfs (dwctx))
+      for (auto cuit = cu_iterator { dw }; cuit != cu_iterator::end (); )
+	{
+	  Dwarf_Die cudie = **cuit;
+	  Dwarf_Off cu_offset = dwarf_dieoffset (&cudie);
+	  unit_tag_index const &tags = dwctx.tag_index (cudie);
+	  ret.push_back (tags.m_has_imports);
+
+	  all_dies_iterator it (cuit);
+	  all_dies_iterator end (++cuit);
+	  for (; it != end; ++it)
+	    {
+	      auto r = tags.find (dwarf_tag (*it));
+	      for (auto jt = r.first; jt != r.second; ++jt)
+		{
+		  ret.push_back (jt->m_pos);
+		  ret.push_back (jt->m_offset);
+		}
+
+	      if (char const *name = dwarf_diename (*it))
+		for (bool cooked: {false, true})
+		  {
+		    dwarf_name_index const &names
+		      = dwctx.name_index (dw, cooked);
+		    ret.push_back (names.m_importing.has_imports (cu_offset));
+		    auto s = names.find (name, cu_offset);
+		    for (auto jt = s.first; jt != s.second; ++jt)
+		      {
+			ret.push_back (jt->m_pos);
+			ret.push_back (jt->m_offset);
+		      }
+		  }
+	    }
+	}
+    return ret;
+  }
+}
+
+TEST (IndexCacheTest, reloaded_tag_and_name_indices_give_same_answers)
+{
+  char tmpl[] = "/tmp/test-dw-idx.XXXXXX";
+  ASSERT_TRUE (mkdtemp (tmpl) != nullptr);
+
+  for (auto fn: {"a1.out", "dwz-partial3-1", "twocus"})
+    {
+      std::vector <uint64_t> expect;
+      {
+	dwfl_context ref {open_dwfl (test_file (fn))};
+	expect = index_contents (ref);
+      }
+
+      set_index_cache_dir (tmpl);
+      for (int round = 0; round < 2; ++round)
+	{
+	  dwfl_context dwctx {open_dwfl (test_file (fn))};
+	  EXPECT_EQ (expect, index_contents (dwctx));
+	}
+      set_index_cache_dir ("");
+    }
+
+  size_t ntags = 0, nnames = 0;
+  for_each_file (tmpl, [&] (std::string const &path)
+    {
+      auto ends_with = [&] (std::string const &ext)
+	{
+	  return path.size () > ext.size ()
+	    && path.compare (path.size () - ext.size (), ext.size (), ext) == 0;
+	};
+      ntags += ends_with (".tags");
+      nnames += ends_with (".names") + ends_with (".cnames");
+    });
+  EXPECT_LT (0u, ntags);
+  EXPECT_LT (0u, nnames);
+
+  remove_dir (tmpl);
+}
+
+TEST (IndexCacheTest, corrupt_files_are_rejected)
+{
+  char tmpl[] = "/tmp/test-dw-idx.XXXXXX";
+  ASSERT_TRUE (mkdtemp (tmpl) != nullptr);
+
+  std::vector <std::pair <Dwarf_Off, bool>> expect;
+  {
+    dwfl_context ref {open_dwfl (test_file ("twocus"))};
+    for (auto dw: all_dwarfs (ref))
+      for (all_dies_iterator it {dw}; it != all_dies_iterator::end (); ++it)
+	expect.push_back (std::make_pair (ref.find_parent (**it),
+					  ref.is_root (**it)));
+  }
+
+  // Files are a header with a magic, version, byte order mark, kind
+  // of the index and four 64-bit counts, followed by arrays.  Parent
+  // positions come last.
+  for (auto corrupt: {
+      // Parent position of the last DIE past the end of the array.
+      std::make_pair (-4, std::string ("\xff\xff\xff\x7f", 4)),
+      // A DIE count that overflows size computations.
+      std::make_pair (24, std::string (8, '\xff')),
+      // A file that claims to hold a tag index.
+      std::make_pair (16, std::string ("\x01\0\0\0", 4)),
+    })
+    {
+      set_index_cache_dir (tmpl);
+      {
+	dwfl_context dwctx {open_dwfl (test_file ("twocus"))};
+	for (auto dw: all_dwarfs (dwctx))
+	  dwctx.find_parent (**cu_iterator {dw});
+      }
+      set_index_cache_dir ("");
+
+      for_each_file (tmpl, [&] (std::string const &path)
+	{
+	  int fd = open (path.c_str (), O_WRONLY);
+	  ASSERT_NE (-1, fd);
+	  off_t pos = corrupt.first >= 0 ? corrupt.first
+	    : lseek (fd, 0, SEEK_END) + corrupt.first;
+	  ASSERT_EQ ((ssize_t) corrupt.second.size (),
+		     pwrite (fd, corrupt.second.data (),
+			     corrupt.second.size (), pos));
+	  close (fd);
+	});
+
+      set_index_cache_dir (tmpl);
+      dwfl_context dwctx {open_dwfl (test_file ("twocus"))};
+      index_cache idxcache {tmpl};
+      size_t i = 0;
+      for (auto dw: all_dwarfs (dwctx))
+	{
+	  EXPECT_TRUE (idxcache.find (dw) == nullptr);
+	  for (all_dies_iterator it {dw};
+	       it != all_dies_iterator::end (); ++it, ++i)
+	    {
+	      ASSERT_LT (i, expect.size ());
+	      EXPECT_EQ (expect[i].first, dwctx.find_parent (**it));
+	      EXPECT_EQ (expect[i].second, dwctx.is_root (**it));
+	    }
+	}
+      EXPECT_EQ (expect.size (), i);
+      set_index_cache_dir ("");
+
+      for_each_file (tmpl, [] (std::string const &path)
+	{
+	  unlink (path.c_str ());
+	});
+    }
+
+  remove_dir (tmpl);
+}
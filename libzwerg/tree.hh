@@ -136,6 +136,7 @@ TREE_TYPES
 class op;
 class pred;
 class scope;
+class stack_types;
 
 // This is for communication between lexical and syntactic analyzers
 // and the rest of the world.  It uses naked pointers all over the
@@ -195,9 +196,20 @@ public:
   std::shared_ptr <op>
   build_exec (std::shared_ptr <op> upstream) const;
 
+  // Like the above, but TYPES describes stacks that UPSTREAM yields.
+  // It is used to pick overloads statically where possible, and on
+  // return describes stacks that the built op yields.
+  std::shared_ptr <op>
+  build_exec (std::shared_ptr <op> upstream, stack_types &types) const;
+
   // Produce program suitable for interpretation.
   std::unique_ptr <pred> build_pred () const;
 
+  // Apply to TYPES the effect that this expression has on stacks,
+  // the same way that build_exec does, but without building
+  // anything.
+  void infer_types (stack_types &types) const;
+
   // === Parser interface ===
   //
   // The following methods are implemented in tree_cr.hh and
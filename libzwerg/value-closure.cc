@@ -73,3 +73,10 @@ value_closure::cmp (value const &v) const
   else
     return cmp_result::fail;
 }
+
+size_t
+value_closure::hash () const
+{
+  // Trees are compared structurally, so only hash the frame.
+  return std::hash <frame *> {} (m_frame.get ());
+}
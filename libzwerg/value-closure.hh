@@ -57,6 +57,7 @@ public:
   void show (std::ostream &o, brevity brv) const override;
   std::unique_ptr <value> clone () const override;
   cmp_result cmp (value const &that) const override;
+  size_t hash () const override;
 };
 
 #endif /* _VALUE_CLOSURE_H_ */
@@ -69,6 +69,15 @@ value_cst::cmp (value const &that) const
     return cmp_result::fail;
 }
 
+size_t
+value_cst::hash () const
+{
+  // Arithmetic constants from different domains may compare equal,
+  // so leave the domain out.
+  mpz_class const &v = m_cst.value ();
+  return std::hash <uint64_t> {} (v < 0 ? (uint64_t) v.sval () : v.uval ());
+}
+
 
 // value
 
@@ -26,16 +26,11 @@
    the GNU Lesser General Public License along with this program.  If
    not, see <http://www.gnu.org/licenses/>.  */
 
-#include <sys/stat.h>
-#include <sys/types.h>
-#include <fcntl.h>
-
 #include <iostream>
 #include <memory>
-#include <system_error>
-#include <cerrno>
 
 #include "atval.hh"
+#include "cache.hh"
 #include "dwcst.hh"
 #include "dwit.hh"
 #include "dwpp.hh"
@@ -45,55 +40,6 @@
 
 value_type const value_dwarf::vtype = value_type::alloc ("T_DWARF");
 
-namespace
-{
-  int
-  prime_dwflmod (Dwfl_Module *dwflmod, void **userdata, const char *name,
-		 Dwarf_Addr base, void *arg)
-  {
-    // Prime the ELF file associated with a Dwfl module.  This is
-    // necessary when later we request a Dwarf.  For dwz files, that
-    // would fail with a message about missing symbol table, but it
-    // doesn't if we first prime the ELF file.
-    GElf_Addr bias;
-    if (dwfl_module_getelf (dwflmod, &bias) == nullptr)
-      throw_libdwfl ();
-
-    return DWARF_CB_OK;
-  }
-
-  std::shared_ptr <Dwfl>
-  open_dwfl (std::string const &fn)
-  {
-    int fd = open (fn.c_str (), O_RDONLY);
-    if (fd == -1)
-      throw std::runtime_error
-	(std::error_code (errno, std::system_category ()).message ());
-
-    const static Dwfl_Callbacks callbacks =
-      {
-	.find_elf = dwfl_build_id_find_elf,
-	.find_debuginfo = dwfl_standard_find_debuginfo,
-	.section_address = dwfl_offline_section_address,
-      };
-
-    elf_version (EV_CURRENT);
-
-    auto dwfl = std::shared_ptr <Dwfl> (dwfl_begin (&callbacks), dwfl_end);
-    if (dwfl == nullptr)
-      throw_libdwfl ();
-
-    if (dwfl_report_offline (&*dwfl, fn.c_str (), fn.c_str (), fd) == nullptr)
-      throw_libdwfl ();
-    if (dwfl_report_end (&*dwfl, nullptr, nullptr) != 0)
-      throw_libdwfl ();
-
-    dwfl_getmodules (&*dwfl, &prime_dwflmod, nullptr, 0);
-
-    return dwfl;
-  }
-}
-
 value_dwarf::value_dwarf (std::string const &fn, size_t pos, doneness d)
   : value {vtype, pos}
   , doneness_aspect {d}
@@ -131,6 +77,12 @@ value_dwarf::cmp (value const &that) const
     return cmp_result::fail;
 }
 
+size_t
+value_dwarf::hash () const
+{
+  return std::hash <Dwfl *> {} (m_dwctx->get_dwfl ());
+}
+
 
 value_type const value_cu::vtype = value_type::alloc ("T_CU");
 
@@ -156,6 +108,12 @@ value_cu::cmp (value const &that) const
     return cmp_result::fail;
 }
 
+size_t
+value_cu::hash () const
+{
+  return std::hash <Dwarf_CU *> {} (&m_cu);
+}
+
 
 namespace
 {
@@ -172,7 +130,8 @@ value_type const value_die::vtype = value_type::alloc ("T_DIE");
 void
 value_die::show (std::ostream &o, brevity brv) const
 {
-  Dwarf_Die *die = &unconst (m_die);
+  Dwarf_Die die_mem = get_die ();
+  Dwarf_Die *die = &die_mem;
 
   {
     ios_flag_saver fs {o};
@@ -185,26 +144,55 @@ value_die::show (std::ostream &o, brevity brv) const
     for (auto it = attr_iterator {die}; it != attr_iterator::end (); ++it)
       {
 	o << "\n\t";
-	value_attr {m_dwctx, **it, m_die, 0, doneness::raw}
+	value_attr {m_dwctx, **it, die_mem, 0, doneness::raw}
 		.show (o, brevity::full);
       }
 }
 
+namespace
+{
+  // Compare import chains A and B the same way as DIE's themselves
+  // are compared: a chain that ends sooner is a template for the
+  // longer one.
+  cmp_result
+  compare_imports (import_chain const *a, import_chain const *b)
+  {
+    for (; a != b; a = a->m_parent, b = b->m_parent)
+      {
+	if (a == nullptr || b == nullptr)
+	  break;
+
+	auto ret = compare (dwarf_cu_getdwarf (a->m_die.cu),
+			    dwarf_cu_getdwarf (b->m_die.cu));
+	if (ret != cmp_result::equal)
+	  return ret;
+
+	ret = compare (dwarf_dieoffset (&unconst (a->m_die)),
+		       dwarf_dieoffset (&unconst (b->m_die)));
+	if (ret != cmp_result::equal)
+	  return ret;
+      }
+
+    return cmp_result::equal;
+  }
+}
+
 cmp_result
 value_die::cmp (value const &that) const
 {
   if (auto v = value::as <value_die> (&that))
     {
       {
-	auto ret = compare (dwarf_cu_getdwarf (m_die.cu),
-			    dwarf_cu_getdwarf (v->m_die.cu));
+	auto ret = compare (dwarf_cu_getdwarf (m_cu),
+			    dwarf_cu_getdwarf (v->m_cu));
 	if (ret != cmp_result::equal)
 	  return ret;
       }
 
       {
-	auto ret = compare (dwarf_dieoffset ((Dwarf_Die *) &m_die),
-			    dwarf_dieoffset ((Dwarf_Die *) &v->m_die));
+	Dwarf_Die a = get_die ();
+	Dwarf_Die b = v->get_die ();
+	auto ret = compare (dwarf_dieoffset (&a), dwarf_dieoffset (&b));
 	if (ret != cmp_result::equal)
 	  return ret;
 
@@ -219,16 +207,21 @@ value_die::cmp (value const &that) const
 	  return ret;
       }
 
-      assert (m_import != nullptr);
-      assert (v->m_import != nullptr);
-
-      // Explore recursively.
-      return m_import->cmp (*v->m_import);
+      return compare_imports (m_import, v->m_import);
     }
   else
     return cmp_result::fail;
 }
 
+size_t
+value_die::hash () const
+{
+  // Import paths are only compared sometimes, so leave them out.
+  Dwarf_Die die = get_die ();
+  return hash_combine (std::hash <Dwarf *> {} (dwarf_cu_getdwarf (m_cu)),
+		       dwarf_dieoffset (&die));
+}
+
 
 value_type const value_attr::vtype = value_type::alloc ("T_ATTR");
 
@@ -250,8 +243,8 @@ value_attr::show (std::ostream &o, brevity brv) const
       if (auto d = value::as <value_die> (v.get ()))
 	{
 	  ios_flag_saver s {o};
-	  o << "[" << std::hex
-	    << dwarf_dieoffset ((Dwarf_Die *) &d->get_die ()) << "]";
+	  Dwarf_Die die = d->get_die ();
+	  o << "[" << std::hex << dwarf_dieoffset (&die) << "]";
 	}
       else
 	v->show (o, brv);
@@ -282,6 +275,13 @@ value_attr::cmp (value const &that) const
     return cmp_result::fail;
 }
 
+size_t
+value_attr::hash () const
+{
+  return hash_combine (dwarf_dieoffset ((Dwarf_Die *) &m_die),
+		       dwarf_whatattr ((Dwarf_Attribute *) &m_attr));
+}
+
 
 value_type const value_abbrev_unit::vtype
 	= value_type::alloc ("T_ABBREV_UNIT");
@@ -314,6 +314,12 @@ value_abbrev_unit::cmp (value const &that) const
     return cmp_result::fail;
 }
 
+size_t
+value_abbrev_unit::hash () const
+{
+  return std::hash <Dwarf_CU *> {} (&m_cu);
+}
+
 
 value_type const value_abbrev::vtype
 	= value_type::alloc ("T_ABBREV");
@@ -361,6 +367,12 @@ value_abbrev::cmp (value const &that) const
     return cmp_result::fail;
 }
 
+size_t
+value_abbrev::hash () const
+{
+  return std::hash <Dwarf_Abbrev *> {} (&m_abbrev);
+}
+
 
 value_type const value_abbrev_attr::vtype
 	= value_type::alloc ("T_ABBREV_ATTR");
@@ -388,12 +400,18 @@ value_abbrev_attr::cmp (value const &that) const
     return cmp_result::fail;
 }
 
+size_t
+value_abbrev_attr::hash () const
+{
+  return std::hash <Dwarf_Off> {} (offset);
+}
+
 
 namespace
 {
   void
   show_loclist_op (std::ostream &o, brevity brv,
-		   std::shared_ptr <dwfl_context> dwctx,
+		   dwctx_handle dwctx,
 		   Dwarf_Attribute const &attr, Dwarf_Op *dwop)
   {
     o << dwop->offset << ':'
@@ -486,6 +504,15 @@ value_loclist_elem::cmp (value const &that) const
     return cmp_result::fail;
 }
 
+size_t
+value_loclist_elem::hash () const
+{
+  size_t ret = std::hash <unsigned char *> {} (m_attr.valp);
+  ret = hash_combine (ret, m_low);
+  ret = hash_combine (ret, m_high);
+  return hash_combine (ret, m_exprlen);
+}
+
 
 value_type const value_aset::vtype = value_type::alloc ("T_ASET");
 
@@ -526,6 +553,16 @@ value_aset::cmp (value const &that) const
     return cmp_result::fail;
 }
 
+size_t
+value_aset::hash () const
+{
+  size_t ret = std::hash <size_t> {} (cov.size ());
+  for (size_t i = 0; i < cov.size (); ++i)
+    ret = hash_combine (hash_combine (ret, cov.at (i).start),
+			cov.at (i).length);
+  return ret;
+}
+
 
 value_type const value_loclist_op::vtype = value_type::alloc ("T_LOCLIST_OP");
 
@@ -555,3 +592,10 @@ value_loclist_op::cmp (value const &that) const
   else
     return cmp_result::fail;
 }
+
+size_t
+value_loclist_op::hash () const
+{
+  return hash_combine (std::hash <unsigned char *> {} (m_attr.valp),
+		       m_dwop->offset);
+}
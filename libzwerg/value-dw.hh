@@ -84,6 +84,7 @@ public:
 
   void show (std::ostream &o, brevity brv) const override;
   cmp_result cmp (value const &that) const override;
+  size_t hash () const override;
   std::unique_ptr <value> clone () const override;
 };
 
@@ -95,14 +96,14 @@ class value_cu
   : public value
   , public doneness_aspect
 {
-  std::shared_ptr <dwfl_context> m_dwctx;
+  dwctx_handle m_dwctx;
   Dwarf_Off m_offset;
   Dwarf_CU &m_cu;
 
 public:
   static value_type const vtype;
 
-  value_cu (std::shared_ptr <dwfl_context> dwctx, Dwarf_CU &cu,
+  value_cu (dwctx_handle dwctx, Dwarf_CU &cu,
 	    Dwarf_Off offset, size_t pos, doneness d)
     : value {vtype, pos}
     , doneness_aspect {d}
@@ -113,7 +114,7 @@ public:
 
   value_cu (value_cu const &that) = default;
 
-  std::shared_ptr <dwfl_context> get_dwctx ()
+  dwctx_handle get_dwctx ()
   { return m_dwctx; }
 
   Dwarf_CU &get_cu ()
@@ -124,6 +125,7 @@ public:
 
   void show (std::ostream &o, brevity brv) const override;
   cmp_result cmp (value const &that) const override;
+  size_t hash () const override;
   std::unique_ptr <value> clone () const override;
 };
 
@@ -135,42 +137,53 @@ class value_die
   : public value
   , public doneness_aspect
 {
-  std::shared_ptr <dwfl_context> m_dwctx;
-  Dwarf_Die m_die;
+  dwctx_handle m_dwctx;
+
+  // Queries keep lots of DIE values around, e.g. in [...] captures,
+  // so they hold only what is needed to rehydrate the Dwarf_Die.
+  // The abbreviation is looked up again lazily by libdw.
+  void *m_addr;
+  Dwarf_CU *m_cu;
 
-  // For cooked DIE's, the DW_TAG_imported_unit DIE that this DIE went
-  // through during child traversals.
-  std::shared_ptr <value_die> m_import;
+  // For cooked DIE's, the DW_TAG_imported_unit DIE's that this DIE
+  // went through during child traversals.
+  import_chain const *m_import;
 
 public:
   static value_type const vtype;
 
-  value_die (std::shared_ptr <dwfl_context> dwctx,
-	     std::shared_ptr <value_die> import,
+  value_die (dwctx_handle dwctx, import_chain const *import,
 	     Dwarf_Die die, size_t pos, doneness d)
     : value {vtype, pos}
     , doneness_aspect {d}
-    , m_dwctx {(assert (dwctx != nullptr), dwctx)}
-    , m_die (die)
+    , m_dwctx {(assert (dwctx.get () != nullptr), std::move (dwctx))}
+    , m_addr {die.addr}
+    , m_cu {die.cu}
     , m_import {import}
   {}
 
-  value_die (std::shared_ptr <dwfl_context> dwctx,
+  value_die (dwctx_handle dwctx,
 	     Dwarf_Die die, size_t pos, doneness d)
-    : value_die {dwctx, nullptr, die, pos, d}
+    : value_die {std::move (dwctx), nullptr, die, pos, d}
   {}
 
-  std::shared_ptr <value_die>
-  get_import ()
+  import_chain const *
+  get_import () const
   {
     assert (is_cooked ());
     return m_import;
   }
 
-  Dwarf_Die &get_die ()
-  { return m_die; }
+  Dwarf_Die
+  get_die () const
+  {
+    Dwarf_Die die {};
+    die.addr = m_addr;
+    die.cu = m_cu;
+    return die;
+  }
 
-  std::shared_ptr <dwfl_context> get_dwctx ()
+  dwctx_handle get_dwctx ()
   { return m_dwctx; }
 
   void show (std::ostream &o, brevity brv) const override;
@@ -179,6 +192,7 @@ public:
   { return std::make_unique <value_die> (*this); }
 
   cmp_result cmp (value const &that) const override;
+  size_t hash () const override;
 };
 
 // -------------------------------------------------------------------
@@ -189,14 +203,14 @@ class value_attr
   : public value
   , public doneness_aspect
 {
-  std::shared_ptr <dwfl_context> m_dwctx;
+  dwctx_handle m_dwctx;
   Dwarf_Die m_die;
   Dwarf_Attribute m_attr;
 
 public:
   static value_type const vtype;
 
-  value_attr (std::shared_ptr <dwfl_context> dwctx,
+  value_attr (dwctx_handle dwctx,
 	      Dwarf_Attribute attr, Dwarf_Die die, size_t pos, doneness d)
     : value {vtype, pos}
     , doneness_aspect {d}
@@ -207,7 +221,7 @@ public:
 
   value_attr (value_attr const &that) = default;
 
-  std::shared_ptr <dwfl_context> get_dwctx ()
+  dwctx_handle get_dwctx ()
   { return m_dwctx; }
 
   Dwarf_Die &get_die ()
@@ -219,6 +233,7 @@ public:
   void show (std::ostream &o, brevity brv) const override;
   std::unique_ptr <value> clone () const override;
   cmp_result cmp (value const &that) const override;
+  size_t hash () const override;
 };
 
 // -------------------------------------------------------------------
@@ -228,13 +243,13 @@ public:
 class value_abbrev_unit
   : public value
 {
-  std::shared_ptr <dwfl_context> m_dwctx;
+  dwctx_handle m_dwctx;
   Dwarf_CU &m_cu;
 
 public:
   static value_type const vtype;
 
-  value_abbrev_unit (std::shared_ptr <dwfl_context> dwctx,
+  value_abbrev_unit (dwctx_handle dwctx,
 		     Dwarf_CU &cu, size_t pos)
     : value {vtype, pos}
     , m_dwctx {dwctx}
@@ -243,7 +258,7 @@ public:
 
   value_abbrev_unit (value_abbrev_unit const &that) = default;
 
-  std::shared_ptr <dwfl_context> get_dwctx ()
+  dwctx_handle get_dwctx ()
   { return m_dwctx; }
 
   Dwarf_CU &get_cu ()
@@ -252,6 +267,7 @@ public:
   void show (std::ostream &o, brevity brv) const override;
   std::unique_ptr <value> clone () const override;
   cmp_result cmp (value const &that) const override;
+  size_t hash () const override;
 };
 
 // -------------------------------------------------------------------
@@ -261,13 +277,13 @@ public:
 class value_abbrev
   : public value
 {
-  std::shared_ptr <dwfl_context> m_dwctx;
+  dwctx_handle m_dwctx;
   Dwarf_Abbrev &m_abbrev;
 
 public:
   static value_type const vtype;
 
-  value_abbrev (std::shared_ptr <dwfl_context> dwctx,
+  value_abbrev (dwctx_handle dwctx,
 		Dwarf_Abbrev &abbrev, size_t pos)
     : value {vtype, pos}
     , m_dwctx {dwctx}
@@ -276,7 +292,7 @@ public:
 
   value_abbrev (value_abbrev const &that) = default;
 
-  std::shared_ptr <dwfl_context> get_dwctx ()
+  dwctx_handle get_dwctx ()
   { return m_dwctx; }
 
   Dwarf_Abbrev &get_abbrev ()
@@ -285,6 +301,7 @@ public:
   void show (std::ostream &o, brevity brv) const override;
   std::unique_ptr <value> clone () const override;
   cmp_result cmp (value const &that) const override;
+  size_t hash () const override;
 };
 
 // -------------------------------------------------------------------
@@ -313,6 +330,7 @@ struct value_abbrev_attr
   void show (std::ostream &o, brevity brv) const override;
   std::unique_ptr <value> clone () const override;
   cmp_result cmp (value const &that) const override;
+  size_t hash () const override;
 };
 
 // -------------------------------------------------------------------
@@ -322,7 +340,7 @@ struct value_abbrev_attr
 class value_loclist_elem
   : public value
 {
-  std::shared_ptr <dwfl_context> m_dwctx;
+  dwctx_handle m_dwctx;
   Dwarf_Attribute m_attr;
   Dwarf_Addr m_low;
   Dwarf_Addr m_high;
@@ -332,7 +350,7 @@ class value_loclist_elem
 public:
   static value_type const vtype;
 
-  value_loclist_elem (std::shared_ptr <dwfl_context> dwctx, Dwarf_Attribute attr,
+  value_loclist_elem (dwctx_handle dwctx, Dwarf_Attribute attr,
 		      Dwarf_Addr low, Dwarf_Addr high,
 		      Dwarf_Op *expr, size_t exprlen, size_t pos)
     : value {vtype, pos}
@@ -346,7 +364,7 @@ public:
 
   value_loclist_elem (value_loclist_elem const &that) = default;
 
-  std::shared_ptr <dwfl_context> get_dwctx ()
+  dwctx_handle get_dwctx ()
   { return m_dwctx; }
 
   Dwarf_Attribute &get_attr ()
@@ -367,6 +385,7 @@ public:
   void show (std::ostream &o, brevity brv) const override;
   std::unique_ptr <value> clone () const override;
   cmp_result cmp (value const &that) const override;
+  size_t hash () const override;
 };
 
 // -------------------------------------------------------------------
@@ -393,6 +412,7 @@ struct value_aset
   void show (std::ostream &o, brevity brv) const override;
   std::unique_ptr <value> clone () const override;
   cmp_result cmp (value const &that) const override;
+  size_t hash () const override;
 };
 
 // -------------------------------------------------------------------
@@ -405,14 +425,14 @@ class value_loclist_op
   // This apparently wild pointer points into libdw-private data.  We
   // actually need to carry a pointer, as some functions require that
   // they be called with the original pointer, not our own copy.
-  std::shared_ptr <dwfl_context> m_dwctx;
+  dwctx_handle m_dwctx;
   Dwarf_Attribute m_attr;
   Dwarf_Op *m_dwop;
 
 public:
   static value_type const vtype;
 
-  value_loclist_op (std::shared_ptr <dwfl_context> dwctx, Dwarf_Attribute attr,
+  value_loclist_op (dwctx_handle dwctx, Dwarf_Attribute attr,
 		    Dwarf_Op *dwop, size_t pos)
     : value {vtype, pos}
     , m_dwctx {dwctx}
@@ -422,7 +442,7 @@ public:
 
   value_loclist_op (value_loclist_op const &that) = default;
 
-  std::shared_ptr <dwfl_context> get_dwctx ()
+  dwctx_handle get_dwctx ()
   { return m_dwctx; }
 
   Dwarf_Attribute &get_attr ()
@@ -434,6 +454,7 @@ public:
   void show (std::ostream &o, brevity brv) const override;
   std::unique_ptr <value> clone () const override;
   cmp_result cmp (value const &that) const override;
+  size_t hash () const override;
 };
 
 #endif /* _VALUE_DW_H_ */
@@ -33,6 +33,7 @@
 #include "value-seq.hh"
 #include "overload.hh"
 #include "value-cst.hh"
+#include "tree.hh"
 
 value_type const value_seq::vtype = value_type::alloc ("T_SEQ");
 
@@ -130,6 +131,16 @@ value_seq::cmp (value const &that) const
     return cmp_result::fail;
 }
 
+size_t
+value_seq::hash () const
+{
+  size_t ret = std::hash <size_t> {} (m_seq->size ());
+  for (auto const &v: *m_seq)
+    ret = hash_combine (ret, hash_combine (v->get_type ().code (),
+					   v->hash ()));
+  return ret;
+}
+
 value_seq
 op_add_seq::operate (std::unique_ptr <value_seq> a,
 		     std::unique_ptr <value_seq> b)
@@ -301,6 +312,50 @@ op_relem_seq::docstring ()
   return elem_seq_docstring;
 }
 
+namespace
+{
+  // Yield the element that sits IDX places from the front, or from
+  // the back if REVERSE, without making values of the others.
+  std::shared_ptr <op>
+  make_seq_elem_lookup (std::shared_ptr <op> upstream, tree const &next,
+			builtin const &self, bool reverse)
+  {
+    uint64_t idx;
+    if (! match_word_eq_index (next, "pos", idx))
+      return nullptr;
+
+    return std::make_shared <op_reduced <value, value_seq>>
+      (upstream,
+       [idx, reverse] (std::unique_ptr <value_seq> a)
+       {
+	 auto seq = a->get_seq ();
+	 std::unique_ptr <value> v;
+	 if (idx < seq->size ())
+	   {
+	     v = (*seq)[reverse ? seq->size () - 1 - idx : idx]->clone ();
+	     v->set_pos (idx);
+	   }
+	 return std::make_unique <value_producer_single <value>>
+	   (std::move (v));
+       },
+       next.child (0).build_pred (), self, next);
+  }
+}
+
+std::shared_ptr <op>
+reduce_elem_seq (std::shared_ptr <op> upstream, tree const &next,
+		 builtin const &self)
+{
+  return make_seq_elem_lookup (upstream, next, self, false);
+}
+
+std::shared_ptr <op>
+reduce_relem_seq (std::shared_ptr <op> upstream, tree const &next,
+		  builtin const &self)
+{
+  return make_seq_elem_lookup (upstream, next, self, true);
+}
+
 pred_result
 pred_empty_seq::result (value_seq &a)
 {
@@ -67,6 +67,7 @@ public:
   void show (std::ostream &o, brevity brv) const override;
   std::unique_ptr <value> clone () const override;
   cmp_result cmp (value const &that) const override;
+  size_t hash () const override;
 };
 
 struct op_add_seq
@@ -112,6 +113,12 @@ struct op_relem_seq
   static std::string docstring ();
 };
 
+// elem (pos == CONST), relem (pos == CONST)
+std::shared_ptr <op> reduce_elem_seq (std::shared_ptr <op> upstream,
+				      tree const &next, builtin const &self);
+std::shared_ptr <op> reduce_relem_seq (std::shared_ptr <op> upstream,
+				       tree const &next, builtin const &self);
+
 struct pred_empty_seq
   : public pred_overload <value_seq>
 {
@@ -26,20 +26,53 @@
    the GNU Lesser General Public License along with this program.  If
    not, see <http://www.gnu.org/licenses/>.  */
 
+#include <algorithm>
+#include <cstring>
 #include <iostream>
 #include <memory>
+#include <vector>
 #include <regex.h>
 
 #include "value-str.hh"
+#include "cache.hh"
+#include "dwfl_context.hh"
 #include "overload.hh"
 #include "value-cst.hh"
 
 value_type const value_str::vtype = value_type::alloc ("T_STR");
 
+value_str::value_str (dwfl_context &dwctx, char const *str, size_t pos)
+  : value {vtype, pos}
+  , m_interned {&dwctx.intern_str (str)}
+{}
+
+char const *
+value_str::get_cstr () const
+{
+  return m_interned != nullptr ? m_interned->m_str : m_str.c_str ();
+}
+
+size_t
+value_str::get_length () const
+{
+  return m_interned != nullptr ? m_interned->m_length : m_str.length ();
+}
+
+std::string &
+value_str::get_string ()
+{
+  if (m_interned != nullptr)
+    {
+      m_str.assign (m_interned->m_str, m_interned->m_length);
+      m_interned = nullptr;
+    }
+  return m_str;
+}
+
 void
 value_str::show (std::ostream &o, brevity brv) const
 {
-  o << m_str;
+  o.write (get_cstr (), get_length ());
 }
 
 std::unique_ptr <value>
@@ -52,17 +85,35 @@ cmp_result
 value_str::cmp (value const &that) const
 {
   if (auto v = value::as <value_str> (&that))
-    return compare (m_str, v->m_str);
+    {
+      if (m_interned != nullptr && m_interned == v->m_interned)
+	return cmp_result::equal;
+
+      size_t len = std::min (get_length (), v->get_length ());
+      if (int c = std::memcmp (get_cstr (), v->get_cstr (), len))
+	return compare (c, 0);
+      return compare (get_length (), v->get_length ());
+    }
   else
     return cmp_result::fail;
 }
 
+size_t
+value_str::hash () const
+{
+  if (m_interned != nullptr)
+    return m_interned->m_hash;
+  return hash_str (m_str.data (), m_str.length ());
+}
+
 
 value_str
 op_add_str::operate (std::unique_ptr <value_str> a,
 		     std::unique_ptr <value_str> b)
 {
-  return value_str {a->get_string () + b->get_string (), 0};
+  std::string &str = a->get_string ();
+  str.append (b->get_cstr (), b->get_length ());
+  return value_str {std::move (str), 0};
 }
 
 std::string
@@ -88,7 +139,7 @@ Using formatting strings may be a better way to concatenate strings::
 value_cst
 op_length_str::operate (std::unique_ptr <value_str> a)
 {
-  constant t {a->get_string ().length (), &dec_constant_dom};
+  constant t {a->get_length (), &dec_constant_dom};
   return value_cst {t, 0};
 }
 
@@ -119,8 +170,8 @@ namespace
 
     str_elem_producer_base (std::unique_ptr <value_str> v)
       : m_v {std::move (v)}
-      , m_sz {m_v->get_string ().size ()}
-      , m_buf {m_v->get_string ().c_str ()}
+      , m_sz {m_v->get_length ()}
+      , m_buf {m_v->get_cstr ()}
       , m_idx {0}
     {}
   };
@@ -211,7 +262,7 @@ op_relem_str::docstring ()
 pred_result
 pred_empty_str::result (value_str &a)
 {
-  return pred_result (a.get_string () == "");
+  return pred_result (a.get_length () == 0);
 }
 
 std::string
@@ -239,8 +290,12 @@ extern char const g_find_docstring[];
 pred_result
 pred_find_str::result (value_str &haystack, value_str &needle)
 {
-  return pred_result (haystack.get_string ().find (needle.get_string ())
-		      != std::string::npos);
+  char const *hay = haystack.get_cstr ();
+  char const *hay_end = hay + haystack.get_length ();
+  char const *need = needle.get_cstr ();
+  return pred_result (std::search (hay, hay_end,
+				   need, need + needle.get_length ())
+		      != hay_end);
 }
 
 std::string
@@ -257,11 +312,12 @@ extern char const g_starts_docstring[];
 pred_result
 pred_starts_str::result (value_str &haystack, value_str &needle)
 {
-  auto const &hay = haystack.get_string ();
-  auto const &need = needle.get_string ();
+  size_t hay_len = haystack.get_length ();
+  size_t need_len = needle.get_length ();
   return pred_result
-    (hay.size () >= need.size ()
-     && hay.compare (0, need.size (), need) == 0);
+    (hay_len >= need_len
+     && std::memcmp (haystack.get_cstr (), needle.get_cstr (),
+		     need_len) == 0);
 }
 
 std::string
@@ -278,11 +334,12 @@ extern char const g_ends_docstring[];
 pred_result
 pred_ends_str::result (value_str &haystack, value_str &needle)
 {
-  auto const &hay = haystack.get_string ();
-  auto const &need = needle.get_string ();
+  size_t hay_len = haystack.get_length ();
+  size_t need_len = needle.get_length ();
   return pred_result
-    (hay.size () >= need.size ()
-     && hay.compare (hay.size () - need.size (), need.size (), need) == 0);
+    (hay_len >= need_len
+     && std::memcmp (haystack.get_cstr () + hay_len - need_len,
+		     needle.get_cstr (), need_len) == 0);
 }
 
 std::string
@@ -294,37 +351,88 @@ pred_ends_str::docstring ()
 
 // ?match
 
+// Regular expressions compiled by one ?match, most recently used
+// first.  Needles that are literals in the query are compiled on
+// first use, and then always found at the front.  Needles computed
+// at run time are compiled once for each time that they fall out of
+// the cache.
+class pred_match_str::cache
+{
+  struct entry
+  {
+    std::string m_pattern;
+    regex_t m_re;
+
+    ~entry ()
+    {
+      regfree (&m_re);
+    }
+  };
+
+  static size_t const max_entries = 8;
+  std::vector <std::unique_ptr <entry>> m_entries;
+
+public:
+  // Return compiled pattern given by LENGTH bytes at PATTERN, or
+  // nullptr if it doesn't compile.  PATTERN has to be NUL-terminated.
+  regex_t *
+  find (char const *pattern, size_t length)
+  {
+    for (size_t i = 0; i < m_entries.size (); ++i)
+      if (m_entries[i]->m_pattern.compare (0, std::string::npos,
+					   pattern, length) == 0)
+	{
+	  std::rotate (m_entries.begin (), m_entries.begin () + i,
+		       m_entries.begin () + i + 1);
+	  return &m_entries.front ()->m_re;
+	}
+
+    regex_t re;
+    if (regcomp (&re, pattern, REG_EXTENDED | REG_NOSUB) != 0)
+      return nullptr;
+
+    if (m_entries.size () == max_entries)
+      m_entries.pop_back ();
+    m_entries.insert (m_entries.begin (),
+		      std::unique_ptr <entry>
+			(new entry {std::string (pattern, length), re}));
+    return &m_entries.front ()->m_re;
+  }
+};
+
+pred_match_str::pred_match_str ()
+  : m_cache {std::make_unique <cache> ()}
+{}
+
+pred_match_str::~pred_match_str ()
+{}
+
 pred_result
 pred_match_str::result (value_str &haystack, value_str &needle)
 {
-  regex_t re;
-  if (regcomp (&re, needle.get_string ().c_str(),
-	       REG_EXTENDED | REG_NOSUB) != 0)
+  regex_t *re = m_cache->find (needle.get_cstr (), needle.get_length ());
+  if (re == nullptr)
     {
-      std::cerr << "Error: could not compile regular expression: '"
-		<< needle.get_string () << "'\n";
+      std::cerr << "Error: could not compile regular expression: '";
+      needle.show (std::cerr, brevity::full);
+      std::cerr << "'\n";
       return pred_result::fail;
     }
 
-  const int reti = regexec (&re, haystack.get_string ().c_str (),
+  const int reti = regexec (re, haystack.get_cstr (),
 			    /* nmatch: size of pmatch array */ 0,
 			    /* pmatch: array of matches */ NULL,
 			    /* no extra flags */ 0);
 
-  pred_result retval = pred_result::fail;
   if (reti == 0)
-    retval = pred_result::yes;
+    return pred_result::yes;
   else if (reti == REG_NOMATCH)
-    retval = pred_result::no;
-  else
-    {
-      char msgbuf[100];
-      regerror (reti, &re, msgbuf, sizeof (msgbuf));
-      std::cerr << "Error: match failed: " << msgbuf << "\n";
-    }
+    return pred_result::no;
 
-  regfree (&re);
-  return retval;
+  char msgbuf[100];
+  regerror (reti, re, msgbuf, sizeof (msgbuf));
+  std::cerr << "Error: match failed: " << msgbuf << "\n";
+  return pred_result::fail;
 }
 
 std::string
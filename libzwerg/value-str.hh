@@ -29,6 +29,7 @@
 #ifndef _VALUE_STR_H_
 #define _VALUE_STR_H_
 
+#include <memory>
 #include <string>
 
 #include "value.hh"
@@ -36,10 +37,17 @@
 #include "overload.hh"
 #include "value-cst.hh"
 
+class dwfl_context;
+struct interned_str;
+
 class value_str
   : public value
 {
+  // Strings that come from DWARF are not copied.  They are interned
+  // in their dwfl_context instead, and live as long as it does.
+  // M_STR is only used when M_INTERNED is null.
   std::string m_str;
+  interned_str const *m_interned;
 
 public:
   static value_type const vtype;
@@ -47,14 +55,23 @@ public:
   value_str (std::string &&str, size_t pos)
     : value {vtype, pos}
     , m_str {std::move (str)}
+    , m_interned {nullptr}
   {}
 
-  std::string &get_string ()
-  { return m_str; }
+  // STR points into ELF data of DWCTX.
+  value_str (dwfl_context &dwctx, char const *str, size_t pos);
+
+  char const *get_cstr () const;
+  size_t get_length () const;
+
+  // The string as an owned std::string that can be modified.
+  // Interned strings are copied out on first use.
+  std::string &get_string ();
 
   void show (std::ostream &o, brevity brv) const override;
   std::unique_ptr <value> clone () const override;
   cmp_result cmp (value const &that) const override;
+  size_t hash () const override;
 };
 
 struct op_add_str
@@ -139,7 +156,13 @@ struct pred_ends_str
 struct pred_match_str
   : public pred_overload <value_str, value_str>
 {
-  using pred_overload::pred_overload;
+  // Compiled regular expressions.
+  class cache;
+  std::unique_ptr <cache> m_cache;
+
+  pred_match_str ();
+  ~pred_match_str ();
+
   pred_result result (value_str &haystack, value_str &needle) override;
 
   static std::string docstring ();
@@ -29,9 +29,11 @@
 #ifndef _VALUE_H_
 #define _VALUE_H_
 
+#include <functional>
 #include <memory>
 
 #include "constant.hh"
+#include "pool.hh"
 
 enum class cmp_result
   {
@@ -52,6 +54,13 @@ compare (T const &a, T const &b)
   return cmp_result::equal;
 }
 
+// Mix hash H into SEED, boost::hash_combine-style.
+inline size_t
+hash_combine (size_t seed, size_t h)
+{
+  return seed ^ (h + 0x9e3779b9 + (seed << 6) + (seed >> 2));
+}
+
 // We use this to keep track of types of instances of subclasses of
 // class value.  value::as uses this to avoid having to dynamic_cast,
 // which is needlessly flexible and slow for our purposes.
@@ -127,10 +136,29 @@ public:
   constant get_type_const () const;
 
   virtual ~value () {}
+
+  // Values are created and destroyed for about every DIE that a
+  // query visits, so they are carved out of a pool.
+  static void *
+  operator new (size_t size)
+  {
+    return pool_alloc (size);
+  }
+
+  static void
+  operator delete (void *ptr, size_t size)
+  {
+    pool_free (ptr, size);
+  }
+
   virtual void show (std::ostream &o, brevity brv) const = 0;
   virtual std::unique_ptr <value> clone () const = 0;
   virtual cmp_result cmp (value const &that) const = 0;
 
+  // Values that CMP as equal must have the same hash.  The hash
+  // doesn't include position.
+  virtual size_t hash () const = 0;
+
   void
   set_pos (size_t pos)
   {
@@ -177,6 +177,12 @@ expect_count 7 ./duplicate-const -e '
 	entry (@AT_decl_file =~ ".*petr.*")'
 expect_count 7 ./duplicate-const -e '
 	entry (@AT_decl_file !~ ".*pavel.*")'
+expect_count 15 ./empty -e '
+	(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 0, 1, 2) "%s"
+	?("%s" =~ "^%s$")'
+expect_count 0 ./empty -e '
+	(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 0, 1, 2) "%s"
+	?("x%s" =~ "^%s$")'
 
 # Test true/false
 expect_count 1 ./typedef.o -e '
@@ -711,6 +717,17 @@ expect_count 1 ./nullptr.o -e '
 	== [DW_AT_specification, DW_AT_inline, DW_AT_object_pointer,
 	    DW_AT_sibling, DW_AT_external, DW_AT_name]'
 
+# Integration through several rounds of references.
+expect_count 1 ./nullptr.o -e '
+	[|A| A entry (offset == 0xf0) attribute label]
+	== [DW_AT_abstract_origin, DW_AT_low_pc, DW_AT_high_pc,
+	    DW_AT_call_file, DW_AT_call_line, DW_AT_specification,
+	    DW_AT_inline, DW_AT_object_pointer, DW_AT_external, DW_AT_name]'
+expect_count 1 ./nullptr.o -e '
+	entry ?TAG_subprogram (@AT_name == "foo") !AT_decl_line'
+expect_count 1 ./nullptr.o -e '
+	entry ?TAG_inlined_subroutine (@AT_name == "foo") ?AT_object_pointer'
+
 # Test version.
 expect_count 4 ./dwz-partial -e 'unit (version == 3)'
 expect_count 5 ./dwz-partial -e 'raw unit (version == 3)'
@@ -727,5 +744,29 @@ echo -e '7 == "foo\x00bar" length' > $TMP
 expect_count 1 ./empty -f $TMP
 rm $TMP
 
+# These are answered from DIE indices.
+expect_count 2 ./twocus -e 'entry ?TAG_compile_unit'
+expect_count 2 ./twocus -e 'unit entry ?TAG_subprogram'
+expect_count 1 ./twocus -e 'entry (@AT_name == "foo")'
+expect_count 1 ./twocus -e 'entry ("main" == @AT_name) ?TAG_subprogram'
+expect_count 0 ./twocus -e 'entry (@AT_name == "bar")'
+
+# Test that parallel execution reports files in argument order, and
+# that splitting units of one file among threads yields all results.
+expect_count 2 ./twocus -j 2 -e 'unit'
+expect_count 2 ./twocus -j 2 -e 'entry ?root'
+expect_count 7 ./dwz-partial3-1 -j 3 -e 'raw entry ?root'
+expect_count 7 ./dwz-partial3-1 -j 3 --unordered -e 'raw entry ?root'
+total=$((total + 1))
+FILES="./empty ./twocus ./nullptr.o ./a1.out ./dwz-partial"
+GOT=$(timeout 10 $DWGREP -c -j 3 $FILES -e 'entry' 2>/dev/null)
+EXPECT=$(timeout 10 $DWGREP -c $FILES -e 'entry' 2>/dev/null)
+if [ "$GOT" != "$EXPECT" ]; then
+    echo "FAIL: $DWGREP -c -j 3" $FILES "-e 'entry'"
+    echo "expected: $EXPECT"
+    echo "     got: $GOT"
+    failures=$((failures + 1))
+fi
+
 echo "$total tests total, $failures failures."
 [ $failures -eq 0 ]